@@ -0,0 +1,80 @@
+#include "./async.h"
+
+#include <array>
+#include <cerrno>
+#include <system_error>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+ppl::reactor::reactor(): epoll_fd_{::epoll_create1(EPOLL_CLOEXEC)} {
+    if (epoll_fd_ < 0) {
+        throw std::system_error(errno, std::system_category(), "epoll_create1");
+    }
+}
+
+ppl::reactor::~reactor() noexcept {
+    ::close(epoll_fd_);
+}
+
+auto ppl::reactor::readable(const int fd) -> awaiter {
+    return awaiter(*this, fd, EPOLLIN);
+}
+
+auto ppl::reactor::writable(const int fd) -> awaiter {
+    return awaiter(*this, fd, EPOLLOUT);
+}
+
+auto ppl::reactor::wait(const std::chrono::milliseconds timeout) -> std::size_t {
+    if (parked_ == 0) {
+        return 0;
+    }
+    auto events = std::array<::epoll_event, 64>{};
+    const auto count = ::epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()),
+        timeout.count() < 0 ? -1 : static_cast<int>(timeout.count()));
+    if (count < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        throw std::system_error(errno, std::system_category(), "epoll_wait");
+    }
+    for (auto i = 0; i < count; ++i) {
+        auto &wait = *static_cast<internal::io_wait*>(events[static_cast<std::size_t>(i)].data.ptr);
+        wait.ready = true;
+        unpark(wait);
+    }
+    return static_cast<std::size_t>(count);
+}
+
+auto ppl::reactor::park(internal::io_wait &wait) -> void {
+    auto event = ::epoll_event{};
+    event.events = wait.events | EPOLLONESHOT;
+    event.data.ptr = &wait;
+    if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wait.fd, &event) != 0) {
+        // Regular files can't be polled, but they never block either.
+        if (errno == EPERM) {
+            wait.ready = true;
+            return;
+        }
+        throw std::system_error(errno, std::system_category(), "epoll_ctl");
+    }
+    wait.parked = true;
+    parked_++;
+}
+
+auto ppl::reactor::unpark(internal::io_wait &wait) noexcept -> void {
+    if (!wait.parked) {
+        return;
+    }
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, wait.fd, nullptr);
+    wait.parked = false;
+    parked_--;
+}
+
+auto ppl::run_async(pipeline &pipeline, reactor &reactor) -> void {
+    while (!pipeline.step()) {
+        if (pipeline.idle() && reactor.parked() != 0) {
+            reactor.wait(std::chrono::milliseconds{-1});
+        }
+    }
+}
@@ -0,0 +1,222 @@
+#ifndef COMP6771_ASYNC_H
+#define COMP6771_ASYNC_H
+
+#include "./pipeline.h"
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace ppl {
+    // Sources that read from files or sockets can be written as coroutines. Derive from
+    // `async_source<Output>` and implement `generate()`, which should `co_yield` each value,
+    // `co_await reactor.readable(fd)` whenever it would otherwise block, and return once there
+    // will be no more values. While the coroutine is waiting, polling the source reports
+    // poll::empty without blocking the rest of the pipeline, and `run_async()` sleeps in the
+    // reactor rather than spinning once every source is waiting.
+    class reactor;
+
+    namespace internal {
+        // A coroutine's request to be resumed once a file descriptor is ready.
+        struct io_wait {
+            reactor* owner = nullptr;
+            int fd = -1;
+            std::uint32_t events = 0;
+            bool parked = false;
+            bool ready = false;
+        };
+
+        struct async_promise_base {
+            io_wait* waiting = nullptr;
+            std::exception_ptr error;
+        };
+    }
+
+    // Wakes up coroutines waiting on file descriptors, using epoll. At most one coroutine may
+    // wait on each file descriptor at a time.
+    class reactor {
+    public:
+        class awaiter {
+        public:
+            awaiter(reactor &owner, const int fd, const std::uint32_t events): wait_{&owner, fd, events} {}
+            awaiter(const awaiter &) = delete;
+            auto operator=(const awaiter &) -> awaiter& = delete;
+            ~awaiter() noexcept {
+                wait_.owner->unpark(wait_);
+            }
+
+            auto await_ready() const noexcept -> bool {
+                return false;
+            }
+
+            template <typename Promise>
+            auto await_suspend(const std::coroutine_handle<Promise> handle) -> void {
+                promise_ = &handle.promise();
+                promise_->waiting = &wait_;
+                wait_.owner->park(wait_);
+            }
+
+            auto await_resume() noexcept -> void {
+                promise_->waiting = nullptr;
+            }
+
+        private:
+            internal::io_wait wait_;
+            internal::async_promise_base* promise_ = nullptr;
+        };
+
+        reactor();
+        reactor(const reactor &) = delete;
+        auto operator=(const reactor &) -> reactor& = delete;
+        ~reactor() noexcept;
+
+        // Suspends the calling coroutine until `fd` can be read or written without blocking.
+        auto readable(const int fd) -> awaiter;
+        auto writable(const int fd) -> awaiter;
+
+        // Blocks until at least one waiting coroutine is ready to resume, or `timeout` passes.
+        // A negative timeout waits for as long as it takes. Returns the number of coroutines
+        // that became ready.
+        auto wait(const std::chrono::milliseconds timeout) -> std::size_t;
+
+        // The number of coroutines waiting on a file descriptor.
+        auto parked() const noexcept -> std::size_t {
+            return parked_;
+        }
+
+    private:
+        int epoll_fd_;
+        std::size_t parked_ = 0;
+
+        auto park(internal::io_wait &wait) -> void;
+        auto unpark(internal::io_wait &wait) noexcept -> void;
+    };
+
+    // The coroutine behind an async_source: each `co_yield` publishes a value.
+    template <typename T>
+    class async_generator {
+    public:
+        struct promise_type : internal::async_promise_base {
+            std::optional<T> value;
+            bool yielded = false;
+
+            auto get_return_object() -> async_generator {
+                return async_generator(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            auto initial_suspend() const noexcept -> std::suspend_always {
+                return {};
+            }
+
+            auto final_suspend() const noexcept -> std::suspend_always {
+                return {};
+            }
+
+            auto yield_value(T v) -> std::suspend_always {
+                value = std::move(v);
+                yielded = true;
+                return {};
+            }
+
+            auto return_void() const noexcept -> void {}
+
+            auto unhandled_exception() noexcept -> void {
+                error = std::current_exception();
+            }
+        };
+
+        async_generator() = default;
+        async_generator(const async_generator &) = delete;
+        async_generator(async_generator &&other) noexcept: handle_{std::exchange(other.handle_, nullptr)} {}
+        auto operator=(const async_generator &) -> async_generator& = delete;
+        auto operator=(async_generator &&other) noexcept -> async_generator& {
+            std::swap(handle_, other.handle_);
+            return *this;
+        }
+        ~async_generator() noexcept {
+            if (handle_) {
+                handle_.destroy();
+            }
+        }
+
+        explicit operator bool() const noexcept {
+            return static_cast<bool>(handle_);
+        }
+
+        // Runs the coroutine until it next yields, waits or finishes, unless it is still waiting.
+        auto resume() -> poll {
+            if (handle_.done()) {
+                return poll::closed;
+            }
+            auto &promise = handle_.promise();
+            if (promise.waiting != nullptr && !promise.waiting->ready) {
+                promise.waiting->owner->wait(std::chrono::milliseconds{0});
+                if (!promise.waiting->ready) {
+                    return poll::empty;
+                }
+            }
+            promise.yielded = false;
+            handle_.resume();
+            if (promise.error) {
+                std::rethrow_exception(std::exchange(promise.error, nullptr));
+            }
+            if (handle_.done()) {
+                return poll::closed;
+            }
+            return promise.yielded ? poll::ready : poll::empty;
+        }
+
+        // The most recently yielded value.
+        auto value() const -> const T& {
+            return *handle_.promise().value;
+        }
+
+        auto parked() const -> bool {
+            if (!handle_ || handle_.done()) {
+                return false;
+            }
+            const auto waiting = handle_.promise().waiting;
+            return waiting != nullptr && !waiting->ready;
+        }
+
+    private:
+        explicit async_generator(const std::coroutine_handle<promise_type> handle): handle_{handle} {}
+
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    template <typename Output>
+    struct async_source : source<Output> {
+    public:
+        // Called on the first poll.
+        auto virtual generate() -> async_generator<Output> = 0;
+
+        auto value() const -> const Output& override final {
+            return values_.value();
+        }
+
+    private:
+        async_generator<Output> values_;
+
+        auto poll_next() -> poll override final {
+            if (!values_) {
+                values_ = generate();
+            }
+            return values_.resume();
+        }
+
+        auto parked() const -> bool override final {
+            return values_.parked();
+        }
+    };
+
+    // Runs the pipeline to completion like pipeline::run(), but sleeps in `reactor` instead of
+    // stepping whenever the pipeline is idle and waiting on it.
+    auto run_async(pipeline &pipeline, reactor &reactor) -> void;
+}
+
+#endif  // COMP6771_ASYNC_H
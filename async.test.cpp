@@ -0,0 +1,146 @@
+#include "./async.h"
+#include "./pipeline.h"
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <unistd.h>
+
+#include <catch2/catch.hpp>
+
+// Reads one number per line from a file descriptor.
+struct line_source : ppl::async_source<int> {
+    ppl::reactor &reactor_;
+    const int fd_;
+    int polls_ = 0;
+
+    line_source(ppl::reactor &reactor, const int &fd): reactor_{reactor}, fd_{fd} {}
+
+    auto name() const -> std::string override {
+        return "line_source";
+    }
+
+    auto generate() -> ppl::async_generator<int> override {
+        auto buffer = std::string{};
+        while (true) {
+            polls_++;
+            co_await reactor_.readable(fd_);
+            char chunk[64];
+            const auto n = ::read(fd_, chunk, sizeof(chunk));
+            if (n <= 0) {
+                co_return;
+            }
+            buffer.append(chunk, static_cast<std::size_t>(n));
+            for (auto end = buffer.find('\n'); end != std::string::npos; end = buffer.find('\n')) {
+                if (buffer.substr(0, end) == "fail") {
+                    throw std::runtime_error("bad line");
+                }
+                co_yield std::stoi(buffer.substr(0, end));
+                buffer.erase(0, end + 1);
+            }
+        }
+    }
+};
+
+struct gathering_sink : ppl::sink<int> {
+    std::vector<int> vals_;
+    const ppl::producer<int>* slot0 = nullptr;
+
+    auto name() const -> std::string override {
+        return "gathering_sink";
+    }
+
+    auto connect(const ppl::node* src, int) -> void override {
+        slot0 = static_cast<const ppl::producer<int>*>(src);
+    }
+
+    auto poll_next() -> ppl::poll override {
+        vals_.push_back(slot0->value());
+        return ppl::poll::ready;
+    }
+};
+
+// Writes `lines` to a pipe, pausing between them, then closes it. `written` says whether every
+// line was written whole, to be checked once the thread has been joined, since assertions
+// aren't safe off the test's own thread.
+auto slow_writer(const int fd, const std::vector<std::string> &lines, bool &written) -> std::thread {
+    written = true;
+    return std::thread([fd, lines, &written] {
+        for (const auto &line : lines) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            const auto text = line + "\n";
+            written = ::write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size()) && written;
+        }
+        ::close(fd);
+    });
+}
+
+TEST_CASE("Testing run_async sleeps while its sources wait for input") {
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+    auto reactor = ppl::reactor{};
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<line_source>(reactor, fds[0]);
+    const auto sink = pipeline.create_node<gathering_sink>();
+    pipeline.connect(source, sink, 0);
+
+    auto written = false;
+    auto writer = slow_writer(fds[1], {"1", "2", "3", "4", "5"}, written);
+    ppl::run_async(pipeline, reactor);
+    writer.join();
+    CHECK(written);
+    ::close(fds[0]);
+
+    CHECK(static_cast<gathering_sink*>(pipeline.get_node(sink))->vals_ == std::vector<int>{1, 2, 3, 4, 5});
+    // A wait and a read for each line, and one more to see the pipe close, rather than
+    // thousands of polls spent spinning
+    CHECK(static_cast<line_source*>(pipeline.get_node(source))->polls_ <= 7);
+    CHECK(reactor.parked() == 0);
+}
+
+TEST_CASE("Testing async sources never block step") {
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+    auto reactor = ppl::reactor{};
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<line_source>(reactor, fds[0]);
+    const auto sink = pipeline.create_node<gathering_sink>();
+    pipeline.connect(source, sink, 0);
+
+    // Nothing has been written yet
+    CHECK(!pipeline.step());
+    CHECK(pipeline.idle());
+    CHECK(reactor.parked() == 1);
+
+    CHECK(::write(fds[1], "7\n8\n", 4) == 4);
+    CHECK(!pipeline.step());
+    CHECK(!pipeline.step());
+    CHECK(static_cast<gathering_sink*>(pipeline.get_node(sink))->vals_ == std::vector<int>{7, 8});
+
+    // Erasing a parked source stops the reactor waking it
+    CHECK(!pipeline.step());
+    CHECK(reactor.parked() == 1);
+    pipeline.erase_node(source);
+    CHECK(reactor.parked() == 0);
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+TEST_CASE("Testing exceptions thrown by async sources reach the caller") {
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+    auto reactor = ppl::reactor{};
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<line_source>(reactor, fds[0]);
+    pipeline.connect(source, pipeline.create_node<gathering_sink>(), 0);
+
+    CHECK(::write(fds[1], "fail\n", 5) == 5);
+    CHECK_THROWS_AS(ppl::run_async(pipeline, reactor), std::runtime_error);
+    // The coroutine has finished, so the source is closed from now on
+    CHECK(pipeline.step());
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
@@ -0,0 +1,210 @@
+#ifndef COMP6771_BUFFER_H
+#define COMP6771_BUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace ppl {
+    // Values that are expensive to copy, such as large frames or records, can be passed between
+    // nodes as a `shared_buffer<T>` drawn from a `buffer_pool<T>`. A producer fills a
+    // `unique_buffer<T>` and publishes it with `share()`. Consumers can then keep the shared
+    // handle for as long as they like, because copying it only bumps a reference count. Once
+    // every handle has been released, the buffer goes back to its pool to be reused, along with
+    // any memory it holds.
+    template <typename T>
+    class buffer_pool;
+    template <typename T>
+    class unique_buffer;
+    template <typename T>
+    class shared_buffer;
+
+    namespace internal {
+        template <typename T>
+        struct pool_state;
+
+        template <typename T>
+        struct pooled_buffer {
+            T value{};
+            std::atomic<std::uint32_t> refs = 0;
+            pool_state<T>* owner = nullptr;
+        };
+
+        // Shared between a pool and its outstanding buffers, so that the pool may be destroyed
+        // while its buffers are still in use.
+        template <typename T>
+        struct pool_state {
+            std::mutex mutex;
+            std::vector<std::unique_ptr<pooled_buffer<T>>> buffers;
+            std::vector<pooled_buffer<T>*> free;
+            // Outstanding buffers, plus one while the pool itself is alive.
+            std::size_t users = 1;
+
+            auto acquire() -> pooled_buffer<T>* {
+                const auto lock = std::lock_guard{mutex};
+                users++;
+                if (free.empty()) {
+                    buffers.push_back(std::make_unique<pooled_buffer<T>>());
+                    buffers.back()->owner = this;
+                    return buffers.back().get();
+                }
+                const auto buffer = free.back();
+                free.pop_back();
+                return buffer;
+            }
+
+            auto release(pooled_buffer<T>* buffer) -> void {
+                auto lock = std::unique_lock{mutex};
+                free.push_back(buffer);
+                drop(lock);
+            }
+
+            // Deletes the state once the pool and all of its buffers are gone.
+            auto drop(std::unique_lock<std::mutex> &lock) -> void {
+                if (--users == 0) {
+                    lock.unlock();
+                    delete this;
+                }
+            }
+        };
+
+        template <typename T>
+        auto release_buffer(pooled_buffer<T>* buffer) -> void {
+            if (buffer != nullptr && buffer->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                buffer->owner->release(buffer);
+            }
+        }
+    }
+
+    // An exclusive, writable buffer from a pool.
+    template <typename T>
+    class unique_buffer {
+    public:
+        unique_buffer() = default;
+        unique_buffer(const unique_buffer &) = delete;
+        unique_buffer(unique_buffer &&other) noexcept: buffer_{std::exchange(other.buffer_, nullptr)} {}
+        auto operator=(const unique_buffer &) -> unique_buffer& = delete;
+        auto operator=(unique_buffer &&other) noexcept -> unique_buffer& {
+            std::swap(buffer_, other.buffer_);
+            return *this;
+        }
+        ~unique_buffer() noexcept {
+            internal::release_buffer(buffer_);
+        }
+
+        auto operator*() const -> T& {
+            return buffer_->value;
+        }
+
+        auto operator->() const -> T* {
+            return &buffer_->value;
+        }
+
+        explicit operator bool() const noexcept {
+            return buffer_ != nullptr;
+        }
+
+        // Gives up write access, so that the buffer can be shared.
+        auto share() && -> shared_buffer<T> {
+            return shared_buffer<T>(std::exchange(buffer_, nullptr));
+        }
+
+    private:
+        explicit unique_buffer(internal::pooled_buffer<T>* buffer): buffer_{buffer} {
+            buffer_->refs.store(1, std::memory_order_relaxed);
+        }
+
+        internal::pooled_buffer<T>* buffer_ = nullptr;
+        friend class buffer_pool<T>;
+    };
+
+    // A reference-counted handle to an immutable buffer. A default-constructed handle is null.
+    template <typename T>
+    class shared_buffer {
+    public:
+        shared_buffer() = default;
+        shared_buffer(const shared_buffer &other) noexcept: buffer_{other.buffer_} {
+            if (buffer_ != nullptr) {
+                buffer_->refs.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        shared_buffer(shared_buffer &&other) noexcept: buffer_{std::exchange(other.buffer_, nullptr)} {}
+        auto operator=(shared_buffer other) noexcept -> shared_buffer& {
+            std::swap(buffer_, other.buffer_);
+            return *this;
+        }
+        ~shared_buffer() noexcept {
+            internal::release_buffer(buffer_);
+        }
+
+        auto get() const noexcept -> const T* {
+            return buffer_ == nullptr ? nullptr : &buffer_->value;
+        }
+
+        auto operator*() const -> const T& {
+            return buffer_->value;
+        }
+
+        auto operator->() const -> const T* {
+            return &buffer_->value;
+        }
+
+        explicit operator bool() const noexcept {
+            return buffer_ != nullptr;
+        }
+
+        // The number of handles to this buffer, including this one.
+        auto use_count() const noexcept -> std::size_t {
+            return buffer_ == nullptr ? 0 : buffer_->refs.load(std::memory_order_relaxed);
+        }
+
+        auto reset() noexcept -> void {
+            internal::release_buffer(std::exchange(buffer_, nullptr));
+        }
+
+    private:
+        explicit shared_buffer(internal::pooled_buffer<T>* buffer): buffer_{buffer} {}
+
+        internal::pooled_buffer<T>* buffer_ = nullptr;
+        friend class unique_buffer<T>;
+    };
+
+    template <typename T>
+    class buffer_pool {
+    public:
+        buffer_pool(): state_{new internal::pool_state<T>{}} {}
+        buffer_pool(const buffer_pool &) = delete;
+        auto operator=(const buffer_pool &) -> buffer_pool& = delete;
+        ~buffer_pool() noexcept {
+            auto lock = std::unique_lock{state_->mutex};
+            state_->drop(lock);
+        }
+
+        // A buffer nobody else holds. A recycled buffer still contains whatever it held last
+        // time, so that its memory can be reused; it is up to the caller to overwrite it.
+        auto acquire() -> unique_buffer<T> {
+            return unique_buffer<T>(state_->acquire());
+        }
+
+        // The number of buffers this pool has created.
+        auto allocated() const -> std::size_t {
+            const auto lock = std::lock_guard{state_->mutex};
+            return state_->buffers.size();
+        }
+
+        // The number of buffers waiting to be reused.
+        auto available() const -> std::size_t {
+            const auto lock = std::lock_guard{state_->mutex};
+            return state_->free.size();
+        }
+
+    private:
+        internal::pool_state<T>* state_;
+    };
+}
+
+#endif  // COMP6771_BUFFER_H
@@ -0,0 +1,104 @@
+#include "./buffer.h"
+#include "./pipeline.h"
+#include <cstddef>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+using frame = ppl::shared_buffer<std::vector<std::byte>>;
+
+struct frame_source : ppl::source<frame> {
+    ppl::buffer_pool<std::vector<std::byte>> pool_;
+    frame current_;
+    int frames_ = 0;
+    const int last_;
+
+    frame_source(const int &last): last_{last} {}
+
+    auto name() const -> std::string override {
+        return "frame_source";
+    }
+
+    auto poll_next() -> ppl::poll override {
+        if (frames_ == last_) {
+            return ppl::poll::closed;
+        }
+        frames_++;
+        auto buffer = pool_.acquire();
+        buffer->assign(1 << 20, static_cast<std::byte>(frames_));
+        current_ = std::move(buffer).share();
+        return ppl::poll::ready;
+    }
+
+    auto value() const -> const frame& override {
+        return current_;
+    }
+};
+
+struct frame_sink : ppl::sink<frame> {
+    const ppl::producer<frame>* slot0 = nullptr;
+    frame held_;
+
+    auto name() const -> std::string override {
+        return "frame_sink";
+    }
+
+    void connect(const ppl::node* src, int) override {
+        slot0 = static_cast<const ppl::producer<frame>*>(src);
+    }
+
+    auto poll_next() -> ppl::poll override {
+        held_ = slot0->value();
+        return ppl::poll::ready;
+    }
+};
+
+TEST_CASE("Testing shared buffers are shared between consumers rather than copied") {
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<frame_source>(100);
+    auto sinks = std::vector<ppl::pipeline::node_id>{};
+    for (auto i = 0; i < 5; ++i) {
+        sinks.push_back(pipeline.create_node<frame_sink>());
+        pipeline.connect(source, sinks.back(), 0);
+    }
+
+    CHECK(!pipeline.step());
+    const auto published = static_cast<frame_source*>(pipeline.get_node(source))->value();
+    for (const auto &sink : sinks) {
+        const auto &held = static_cast<frame_sink*>(pipeline.get_node(sink))->held_;
+        CHECK(held.get() == published.get());
+        CHECK((*held)[0] == std::byte{1});
+    }
+    // The source, the five sinks and `published`
+    CHECK(published.use_count() == 7);
+}
+
+TEST_CASE("Testing shared buffers are recycled once every consumer releases them") {
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<frame_source>(100);
+    for (auto i = 0; i < 5; ++i) {
+        pipeline.connect(source, pipeline.create_node<frame_sink>(), 0);
+    }
+    pipeline.run();
+
+    // Each frame is released by the sinks as soon as they receive the next one
+    const auto &pool = static_cast<frame_source*>(pipeline.get_node(source))->pool_;
+    CHECK(pool.allocated() == 2);
+    CHECK(pool.available() == 1);
+}
+
+TEST_CASE("Testing shared buffers outlive their pool") {
+    auto buffer = frame{};
+    {
+        auto pool = ppl::buffer_pool<std::vector<std::byte>>{};
+        auto unique = pool.acquire();
+        unique->push_back(std::byte{42});
+        buffer = std::move(unique).share();
+    }
+    CHECK(buffer.use_count() == 1);
+    CHECK((*buffer)[0] == std::byte{42});
+    buffer.reset();
+    CHECK(!buffer);
+}
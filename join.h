@@ -0,0 +1,262 @@
+#ifndef COMP6771_JOIN_H
+#define COMP6771_JOIN_H
+
+#include "./pipeline.h"
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory_resource>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace ppl {
+    // For a hash_join whose values have no time, so that build values only expire by count.
+    struct untimed {};
+
+    // How long a hash_join keeps its build values.
+    struct join_expiry {
+        // The most build values kept. Once full, each new value evicts the oldest one.
+        std::size_t capacity = std::numeric_limits<std::size_t>::max();
+        // How far the watermark may pass a build value's time before it expires.
+        std::int64_t retention = std::numeric_limits<std::int64_t>::max();
+    };
+
+    // What a hash_join holds, and what has become of the values it was given.
+    struct join_stats {
+        // The number of build values in the table.
+        std::size_t entries = 0;
+        std::size_t peak_entries = 0;
+        // The memory allocated for the table, its bookkeeping and the pairs waiting to be
+        // published, not counting anything the values allocate themselves.
+        std::size_t bytes = 0;
+        std::size_t peak_bytes = 0;
+        // Probe values that found at least one build value to join with.
+        std::uint64_t matched = 0;
+        // Probe values that found nothing to join with, and were dropped.
+        std::uint64_t unmatched = 0;
+        // Build values dropped to stay within the capacity.
+        std::uint64_t evicted = 0;
+        // Build values dropped once the watermark had passed them by more than the retention.
+        std::uint64_t expired = 0;
+    };
+
+    // Joins two streams on a key. Slot 0 takes build values, which are kept in a hash table by
+    // `build_key(value)`; slot 1 takes probe values, each of which is published alongside every
+    // build value under `probe_key(value)`, oldest first, or dropped if there are none. Within a
+    // step, build values are added before the probe values are looked up.
+    //
+    // This is a multirate, so both inputs are taken as they come rather than in lockstep, and
+    // pairs that don't fit in one batch are published in the polls that follow. It is closed
+    // once both inputs are and every pair has been published. The table is bounded by the
+    // capacity in `expiry`. With a `Time`, which gives the time of any build or probe value,
+    // build values also expire once the watermark, the latest time seen on either input, has
+    // passed them by more than the retention. They are removed in the order they arrived, but
+    // never matched once expired. The pairs waiting to be published are only bounded by how
+    // many build values each probe value meets, up to the capacity per probe value, so they are
+    // counted in stats() along with the table.
+    template <typename Build, typename Probe, typename BuildKey, typename ProbeKey, typename Time = untimed>
+    requires std::invocable<const BuildKey&, const Build&> and std::invocable<const ProbeKey&, const Probe&>
+        and std::same_as<std::decay_t<std::invoke_result_t<const BuildKey&, const Build&>>,
+            std::decay_t<std::invoke_result_t<const ProbeKey&, const Probe&>>>
+        and (std::same_as<Time, untimed> or (std::is_invocable_r_v<std::int64_t, const Time&, const Build&>
+            and std::is_invocable_r_v<std::int64_t, const Time&, const Probe&>))
+    class hash_join : public batch_component<std::tuple<Build, Probe>, std::pair<Probe, Build>>, public multirate {
+    public:
+        using key_type = std::decay_t<std::invoke_result_t<const BuildKey&, const Build&>>;
+        using result_type = std::pair<Probe, Build>;
+
+        hash_join(BuildKey build_key, ProbeKey probe_key, const join_expiry expiry = {}, Time time = Time{})
+        : build_key_{std::move(build_key)}, probe_key_{std::move(probe_key)}, time_{std::move(time)}
+        , expiry_{expiry} {
+            if (expiry_.capacity == 0 || expiry_.retention < 0) {
+                throw std::invalid_argument("a join needs room for a value, and retention can't be negative");
+            }
+        }
+
+        hash_join(const hash_join &) = delete;
+        auto operator=(const hash_join &) -> hash_join& = delete;
+
+        auto name() const -> std::string override {
+            return "hash_join";
+        }
+
+        auto stats() const -> join_stats {
+            auto stats = stats_;
+            stats.entries = rows_.size();
+            stats.bytes = memory_.bytes();
+            return stats;
+        }
+
+        // The latest time seen on either input.
+        auto watermark() const noexcept -> std::int64_t {
+            return latest_;
+        }
+
+        auto connect(const node* src, const int slot) -> void override {
+            if (slot == 0) {
+                build_.connect(src);
+            } else {
+                probe_.connect(src);
+            }
+        }
+
+        auto poll_next_batch(const std::size_t max) -> poll override {
+            if (fresh(0)) {
+                for (const auto &value : build_.values()) {
+                    build(value);
+                }
+            }
+            if (fresh(1)) {
+                for (const auto &value : probe_.values()) {
+                    probe(value);
+                }
+            }
+            stats_.peak_entries = std::max(stats_.peak_entries, rows_.size());
+            stats_.peak_bytes = std::max(stats_.peak_bytes, memory_.bytes());
+            out_.clear();
+            while (!ready_.empty() && out_.size() < max) {
+                out_.push_back(std::move(ready_.front()));
+                ready_.pop_front();
+            }
+            set_backlog(!ready_.empty());
+            return out_.empty() ? poll::empty : poll::ready;
+        }
+
+        auto values() const -> std::span<const result_type> override {
+            return out_;
+        }
+
+    private:
+        static constexpr auto none = std::numeric_limits<std::uint64_t>::max();
+
+        struct row {
+            key_type key;
+            Build value;
+            std::int64_t time = 0;
+            // The sequence number of the next row with the same key, if any.
+            std::uint64_t next = none;
+        };
+
+        // The sequence numbers of the oldest and newest rows with a key.
+        struct rows_of_key {
+            std::uint64_t oldest;
+            std::uint64_t newest;
+        };
+
+        BuildKey build_key_;
+        ProbeKey probe_key_;
+        Time time_;
+        join_expiry expiry_;
+        batch_input<Build> build_;
+        batch_input<Probe> probe_;
+
+        internal::counting_resource memory_{std::pmr::new_delete_resource()};
+        std::pmr::unordered_map<key_type, rows_of_key> table_{&memory_};
+        // Every build value kept, in the order they arrived, with rows with the same key linked
+        // oldest to newest. Rows are numbered in the order they arrived, and rows_.front() is
+        // number first_.
+        std::pmr::deque<row> rows_{&memory_};
+        std::uint64_t first_ = 0;
+        std::int64_t latest_ = std::numeric_limits<std::int64_t>::min();
+
+        join_stats stats_;
+        // Pairs waiting to be published, which count towards the memory in stats() too.
+        std::pmr::deque<result_type> ready_{&memory_};
+        std::vector<result_type> out_;
+
+        template <typename T>
+        auto time_of(const T &value) const -> std::int64_t {
+            if constexpr (std::same_as<Time, untimed>) {
+                return 0;
+            } else {
+                return std::invoke(time_, value);
+            }
+        }
+
+        auto expired(const std::int64_t time) const -> bool {
+            return !std::same_as<Time, untimed> && latest_ > time && latest_ - time > expiry_.retention;
+        }
+
+        auto at(const std::uint64_t sequence) -> row& {
+            return rows_[static_cast<std::size_t>(sequence - first_)];
+        }
+
+        auto advance(const std::int64_t time) -> void {
+            if constexpr (!std::same_as<Time, untimed>) {
+                if (time <= latest_) {
+                    return;
+                }
+                latest_ = time;
+                while (!rows_.empty() && expired(rows_.front().time)) {
+                    remove_oldest();
+                    stats_.expired++;
+                }
+            }
+        }
+
+        auto build(const Build &value) -> void {
+            const auto time = time_of(value);
+            advance(time);
+            if (expired(time)) {
+                stats_.expired++;
+                return;
+            }
+            if (rows_.size() == expiry_.capacity) {
+                remove_oldest();
+                stats_.evicted++;
+            }
+            const auto sequence = first_ + rows_.size();
+            const auto &key = rows_.emplace_back(std::invoke(build_key_, value), value, time).key;
+            const auto [iter, added] = table_.try_emplace(key, rows_of_key{sequence, sequence});
+            if (!added) {
+                at(iter->second.newest).next = sequence;
+                iter->second.newest = sequence;
+            }
+        }
+
+        auto remove_oldest() -> void {
+            const auto &oldest = rows_.front();
+            const auto iter = table_.find(oldest.key);
+            if (oldest.next == none) {
+                table_.erase(iter);
+            } else {
+                iter->second.oldest = oldest.next;
+            }
+            rows_.pop_front();
+            first_++;
+        }
+
+        auto probe(const Probe &value) -> void {
+            advance(time_of(value));
+            const auto iter = table_.find(std::invoke(probe_key_, value));
+            auto matches = std::size_t{0};
+            if (iter != table_.end()) {
+                // Rows are only removed once they reach the front, so some may have expired.
+                for (auto sequence = iter->second.oldest; sequence != none; sequence = at(sequence).next) {
+                    if (!expired(at(sequence).time)) {
+                        ready_.emplace_back(value, at(sequence).value);
+                        matches++;
+                    }
+                }
+            }
+            if (matches == 0) {
+                stats_.unmatched++;
+            } else {
+                stats_.matched++;
+            }
+        }
+    };
+}
+
+#endif  // COMP6771_JOIN_H
@@ -0,0 +1,261 @@
+#include "./join.h"
+#include "./pipeline.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+namespace {
+    // A key and a value, or a key and a time.
+    using keyed_value = std::pair<int, std::int64_t>;
+
+    constexpr auto key_of = [](const keyed_value &v) { return v.first; };
+    constexpr auto time_of = [](const keyed_value &v) { return v.second; };
+    constexpr auto probe_key = [](const int key) { return key; };
+
+    // Publishes one entry of `schedule` per poll, coming up empty for the missing ones.
+    template <typename T>
+    struct scheduled_source : ppl::source<T> {
+        std::vector<std::optional<T>> schedule_;
+        std::size_t next_ = 0;
+
+        scheduled_source(std::vector<std::optional<T>> schedule): schedule_{std::move(schedule)} {}
+
+        auto name() const -> std::string override {
+            return "scheduled_source";
+        }
+
+        auto poll_next() -> ppl::poll override {
+            if (next_ == schedule_.size()) {
+                return ppl::poll::closed;
+            }
+            return schedule_[next_++].has_value() ? ppl::poll::ready : ppl::poll::empty;
+        }
+
+        auto value() const -> const T& override {
+            return *schedule_[next_ - 1];
+        }
+    };
+
+    template <typename T>
+    struct list_sink : ppl::batch_sink<T> {
+        ppl::batch_input<T> in_;
+        std::vector<T> values_;
+
+        auto name() const -> std::string override {
+            return "list_sink";
+        }
+
+        auto connect(const ppl::node* src, const int) -> void override {
+            in_.connect(src);
+        }
+
+        auto poll_next_batch(const std::size_t) -> ppl::poll override {
+            const auto values = in_.values();
+            values_.insert(values_.end(), values.begin(), values.end());
+            return ppl::poll::ready;
+        }
+    };
+
+    template <typename Join>
+    struct join_run {
+        ppl::join_stats stats;
+        std::vector<typename Join::result_type> results;
+    };
+
+    // Feeds `build` and `probe` to a Join made from `args`, with `setup` given the pipeline and
+    // its nodes to run it.
+    template <typename Join, typename Setup, typename... Args>
+    auto run_join(const std::vector<std::optional<typename Join::result_type::second_type>> &build,
+        const std::vector<std::optional<typename Join::result_type::first_type>> &probe, const Setup &setup,
+        Args&&... args) -> join_run<Join> {
+        auto pipeline = ppl::pipeline{};
+        const auto builds = pipeline.create_node<scheduled_source<typename Join::result_type::second_type>>(build);
+        const auto probes = pipeline.create_node<scheduled_source<typename Join::result_type::first_type>>(probe);
+        const auto join = pipeline.create_node<Join>(std::forward<Args>(args)...);
+        const auto sink = pipeline.create_node<list_sink<typename Join::result_type>>();
+        pipeline.connect(builds, join, 0);
+        pipeline.connect(probes, join, 1);
+        pipeline.connect(join, sink, 0);
+        setup(pipeline, builds, probes, join, sink);
+        return {static_cast<const Join*>(pipeline.get_node(join))->stats(),
+            static_cast<list_sink<typename Join::result_type>*>(pipeline.get_node(sink))->values_};
+    }
+}
+
+using lookup = ppl::hash_join<keyed_value, int, decltype(key_of), decltype(probe_key)>;
+
+TEST_CASE("Testing a hash join takes each input at its own rate") {
+    const auto build = std::vector<std::optional<keyed_value>>{{{1, 10}}, std::nullopt, {{2, 20}}, {{1, 11}}};
+    const auto probe = std::vector<std::optional<int>>{1, 2, 1, 2, 3, 1};
+    // The build side comes up empty and closes early, but every probe value is still looked up
+    // in the step it arrives, and joined with every build value under its key.
+    const auto expected = std::vector<lookup::result_type>{{1, {1, 10}}, {1, {1, 10}}, {2, {2, 20}}, {1, {1, 10}}, {1, {1, 11}}};
+
+    SECTION("Stepping one node at a time") {
+        const auto run = run_join<lookup>(build, probe, [](ppl::pipeline &p, auto...) { p.run(); }, key_of, probe_key);
+        CHECK(run.results == expected);
+        CHECK(run.stats.matched == 4);
+        CHECK(run.stats.unmatched == 2);
+        CHECK(run.stats.entries == 3);
+    }
+
+    SECTION("Stepping on several threads") {
+        const auto run = run_join<lookup>(build, probe, [](ppl::pipeline &p, auto...) {
+            p.set_threads(3);
+            p.run();
+        }, key_of, probe_key);
+        CHECK(run.results == expected);
+    }
+
+    SECTION("Through buffers") {
+        const auto run = run_join<lookup>(build, probe, [](ppl::pipeline &p, const auto builds, const auto probes, const auto join, auto) {
+            p.set_buffer(builds, join, 4);
+            p.set_buffer(probes, join, 4);
+            p.run();
+        }, key_of, probe_key);
+        CHECK(run.results == expected);
+    }
+
+    SECTION("Running freely on threads") {
+        // How the inputs interleave is up to the threads, but every probe value is looked up.
+        const auto run = run_join<lookup>(build, probe, [](ppl::pipeline &p, auto...) { p.run_parallel(2); }, key_of, probe_key);
+        CHECK(run.stats.matched + run.stats.unmatched == probe.size());
+    }
+
+    SECTION("From another process") {
+        const auto run = run_join<lookup>(build, probe, [](ppl::pipeline &p, const auto builds, const auto probes, auto...) {
+            p.set_partition(builds, 1);
+            p.set_partition(probes, 1);
+            CHECK(p.run_partitioned().at(1).completed);
+        }, key_of, probe_key);
+        // As on threads, but every value makes it across.
+        CHECK(run.stats.matched + run.stats.unmatched == probe.size());
+        CHECK(std::all_of(run.results.begin(), run.results.end(), [](const auto &r) { return r.first == r.second.first; }));
+        CHECK(run.stats.entries == 3);
+    }
+}
+
+TEST_CASE("Testing a hash join expires build values by count") {
+    auto build = std::vector<std::optional<keyed_value>>{};
+    auto probe = std::vector<std::optional<int>>{};
+    for (auto i = 0; i < 10; ++i) {
+        build.emplace_back(keyed_value{i, i});
+        build.emplace_back(keyed_value{0, 100 + i});
+        probe.emplace_back();
+        probe.emplace_back();
+    }
+    for (auto i = 0; i < 10; ++i) {
+        probe.emplace_back(i);
+    }
+
+    const auto run = run_join<lookup>(build, probe, [](ppl::pipeline &p, auto...) { p.run(); }, key_of, probe_key,
+        ppl::join_expiry{.capacity = 3});
+    // Only the last three values built are left, two of them under key 0.
+    CHECK(run.results == std::vector<lookup::result_type>{{0, {0, 108}}, {0, {0, 109}}, {9, {9, 9}}});
+    CHECK(run.stats.entries == 3);
+    CHECK(run.stats.peak_entries == 3);
+    CHECK(run.stats.evicted == 17);
+    CHECK(run.stats.expired == 0);
+    CHECK_THROWS_AS(lookup(key_of, probe_key, ppl::join_expiry{.capacity = 0}), std::invalid_argument);
+}
+
+TEST_CASE("Testing a hash join publishes every build value under a key") {
+    auto build = std::vector<std::optional<keyed_value>>{};
+    auto probe = std::vector<std::optional<int>>{};
+    for (auto i = 0; i < 100; ++i) {
+        build.emplace_back(keyed_value{i % 2, i});
+        probe.emplace_back();
+    }
+    probe.emplace_back(1);
+    auto expected = std::vector<lookup::result_type>{};
+    for (auto i = 1; i < 100; i += 2) {
+        expected.push_back({1, {1, i}});
+    }
+
+    SECTION("In batches") {
+        const auto run = run_join<lookup>(build, probe, [](ppl::pipeline &p, auto...) {
+            p.set_batch_size(8);
+            p.run();
+        }, key_of, probe_key);
+        CHECK(run.results == expected);
+        CHECK(run.stats.matched == 1);
+    }
+
+    SECTION("One at a time") {
+        // Buffers hold one value at a time, so the join publishes one pair per step.
+        const auto run = run_join<lookup>(build, probe, [](ppl::pipeline &p, auto, auto, const auto join, const auto sink) {
+            p.set_buffer(join, sink, 4);
+            p.run();
+        }, key_of, probe_key);
+        CHECK(run.results == expected);
+    }
+}
+
+TEST_CASE("Testing a hash join counts the pairs waiting to be published") {
+    auto build = std::vector<std::optional<keyed_value>>{};
+    auto probe = std::vector<std::optional<int>>{};
+    for (auto i = 0; i < 1000; ++i) {
+        build.emplace_back(keyed_value{1, i});
+        probe.emplace_back();
+    }
+    probe.emplace_back(1);
+
+    auto bytes = std::vector<std::size_t>{};
+    const auto run = run_join<lookup>(build, probe, [&](ppl::pipeline &p, auto, auto, const auto join, auto) {
+        p.set_batch_size(8);
+        while (!p.step()) {
+            bytes.push_back(static_cast<const lookup*>(p.get_node(join))->stats().bytes);
+        }
+    }, key_of, probe_key);
+    REQUIRE(run.results.size() == 1000);
+
+    // The one probe value meets all 1000 build values, which take many steps to publish.
+    const auto peak = std::max_element(bytes.begin(), bytes.end());
+    CHECK(*peak == run.stats.peak_bytes);
+    CHECK(*peak >= *(peak - 1) + 900 * sizeof(lookup::result_type));
+    CHECK(std::is_sorted(peak, bytes.end(), std::greater<>{}));
+    CHECK(bytes.back() + 900 * sizeof(lookup::result_type) <= *peak);
+}
+
+TEST_CASE("Testing a hash join expires build values by watermark") {
+    using timed = ppl::hash_join<keyed_value, keyed_value, decltype(key_of), decltype(key_of), decltype(time_of)>;
+    const auto build = std::vector<std::optional<keyed_value>>{{{1, 0}}, {{2, 3}}, std::nullopt, std::nullopt, {{3, 0}}};
+    const auto probe = std::vector<std::optional<keyed_value>>{std::nullopt, std::nullopt, {{1, 4}}, {{1, 6}}, {{2, 8}}};
+
+    const auto run = run_join<timed>(build, probe, [](ppl::pipeline &p, auto...) { p.run(); }, key_of, key_of,
+        ppl::join_expiry{.retention = 5}, time_of);
+    // Key 1 from time 0 has expired by time 6, and key 3 from time 0 was already too old when it came.
+    CHECK(run.results == std::vector<timed::result_type>{{{1, 4}, {1, 0}}, {{2, 8}, {2, 3}}});
+    CHECK(run.stats.unmatched == 1);
+    CHECK(run.stats.expired == 2);
+    CHECK(run.stats.entries == 1);
+}
+
+TEST_CASE("Testing a hash join's memory stays bounded over a long stream") {
+    const auto memory = [](const int count) {
+        auto build = std::vector<std::optional<keyed_value>>{};
+        auto probe = std::vector<std::optional<int>>{};
+        for (auto i = 0; i < count; ++i) {
+            build.emplace_back(keyed_value{i, i});
+            probe.emplace_back(i - 500);
+        }
+        const auto run = run_join<lookup>(build, probe, [](ppl::pipeline &p, auto...) { p.run(); }, key_of, probe_key,
+            ppl::join_expiry{.capacity = 1000});
+        CHECK(run.stats.peak_entries == 1000);
+        CHECK(run.stats.matched == static_cast<std::uint64_t>(count - 500));
+        CHECK(run.stats.bytes > 0);
+        return run.stats.peak_bytes;
+    };
+
+    const auto short_stream = memory(5000);
+    const auto long_stream = memory(100000);
+    CHECK(long_stream <= short_stream + short_stream / 8);
+}
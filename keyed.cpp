@@ -0,0 +1,73 @@
+#include "./keyed.h"
+
+ppl::internal::fork_join::fork_join(const std::size_t threads) {
+    for (std::size_t i = 1; i < threads; ++i) {
+        workers_.emplace_back([this, i] { work(i); });
+    }
+}
+
+ppl::internal::fork_join::~fork_join() noexcept {
+    {
+        const auto lock = std::lock_guard{mutex_};
+        shutdown_ = true;
+    }
+    start_.notify_all();
+    for (auto &worker : workers_) {
+        worker.join();
+    }
+}
+
+auto ppl::internal::fork_join::run(const std::function<void(std::size_t)> &task) -> void {
+    {
+        const auto lock = std::lock_guard{mutex_};
+        task_ = &task;
+        running_ = workers_.size();
+        error_ = nullptr;
+        epoch_++;
+    }
+    start_.notify_all();
+
+    auto error = std::exception_ptr();
+    try {
+        task(0);
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    auto lock = std::unique_lock{mutex_};
+    done_.wait(lock, [&] { return running_ == 0; });
+    task_ = nullptr;
+    if (error == nullptr) {
+        error = std::exchange(error_, nullptr);
+    }
+    if (error != nullptr) {
+        std::rethrow_exception(error);
+    }
+}
+
+auto ppl::internal::fork_join::work(const std::size_t worker) -> void {
+    auto seen = std::size_t{0};
+    auto lock = std::unique_lock{mutex_};
+    while (true) {
+        start_.wait(lock, [&] { return shutdown_ || epoch_ != seen; });
+        if (shutdown_) {
+            return;
+        }
+        seen = epoch_;
+        const auto &task = *task_;
+        lock.unlock();
+        auto error = std::exception_ptr();
+        try {
+            task(worker);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+        if (error != nullptr && error_ == nullptr) {
+            error_ = error;
+        }
+        if (--running_ == 0) {
+            done_.notify_one();
+        }
+    }
+}
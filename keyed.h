@@ -0,0 +1,223 @@
+#ifndef COMP6771_KEYED_H
+#define COMP6771_KEYED_H
+
+#include "./pipeline.h"
+
+#include <algorithm>
+#include <concepts>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ppl {
+    namespace internal {
+        // Runs one task per thread and waits for them all, over and over, on a fixed set of
+        // threads. The calling thread runs task 0.
+        class fork_join {
+        public:
+            explicit fork_join(const std::size_t threads);
+            fork_join(const fork_join &) = delete;
+            auto operator=(const fork_join &) -> fork_join& = delete;
+            ~fork_join() noexcept;
+
+            auto threads() const noexcept -> std::size_t {
+                return workers_.size() + 1;
+            }
+
+            // Calls task(i) for every i below threads(), returning once they have all returned.
+            // If any of them throws, the first exception is rethrown.
+            auto run(const std::function<void(std::size_t)> &task) -> void;
+
+        private:
+            auto work(const std::size_t worker) -> void;
+
+            std::vector<std::thread> workers_;
+            std::mutex mutex_;
+            std::condition_variable start_;
+            std::condition_variable done_;
+            const std::function<void(std::size_t)>* task_ = nullptr;
+            std::size_t epoch_ = 0;
+            std::size_t running_ = 0;
+            bool shutdown_ = false;
+            std::exception_ptr error_;
+        };
+
+        // Publishes whatever value it is pointed at, so that a replica can be fed one value at a time.
+        template <typename T>
+        class keyed_feed final : public producer<T> {
+        public:
+            auto name() const -> std::string override {
+                return "keyed_feed";
+            }
+
+            auto value() const -> const T& override {
+                return *current_;
+            }
+
+            auto set(const T &value) -> void {
+                current_ = &value;
+            }
+
+        private:
+            const T* current_ = nullptr;
+
+            auto poll_next() -> poll override {
+                return poll::ready;
+            }
+            auto connect(const node*, const int) -> void override {}
+        };
+    }
+
+    // A component with a single input that keeps state per key, so that copies of it can share
+    // out the keys between them.
+    template <typename N>
+    concept keyable_component = concrete_node<N>
+        and std::tuple_size_v<typename N::input_type> == 1
+        and !std::is_void_v<typename N::output_type>
+        and std::copy_constructible<typename N::output_type>;
+
+    // Runs `replicas` copies of Component side by side, each on a thread of its own, while
+    // appearing to the rest of the pipeline as a single Component. Each input value is routed to
+    // one replica by the hash of `key(value)`, so all the values with the same key go to the same
+    // replica, in order. The replicas' outputs are merged back in the order of their inputs.
+    // The replicas only run in parallel on batches, so this works best with a large batch size
+    // and batch nodes either side. Once every replica has closed, so has this; values routed to
+    // a replica that has closed are dropped.
+    template <keyable_component Component, typename Key>
+    requires std::invocable<const Key&, const std::tuple_element_t<0, typename Component::input_type>&>
+    class keyed : public batch_component<typename Component::input_type, typename Component::output_type> {
+    public:
+        using input_value = std::tuple_element_t<0, typename Component::input_type>;
+        using output_value = typename Component::output_type;
+
+        // Each replica is constructed from `args`.
+        template <typename... Args>
+        requires std::constructible_from<Component, const Args&...>
+        keyed(const std::size_t replicas, Key key, const Args&... args)
+        : key_{std::move(key)}, feeds_(std::max(replicas, std::size_t{1})), routes_(feeds_.size())
+        , closed_(feeds_.size()) {
+            for (auto &feed : feeds_) {
+                replicas_.push_back(std::make_unique<Component>(args...));
+                internal::node_access::connect(*replicas_.back(), &feed, 0);
+            }
+            if (replicas_.size() > 1) {
+                workers_ = std::make_unique<internal::fork_join>(replicas_.size());
+            }
+        }
+
+        auto name() const -> std::string override {
+            return replicas_.front()->name();
+        }
+
+        auto replicas() const noexcept -> std::size_t {
+            return replicas_.size();
+        }
+
+        // For inspecting the state of each replica.
+        auto replica(const std::size_t i) const -> const Component& {
+            return *replicas_[i];
+        }
+
+        auto connect(const node* src, const int) -> void override {
+            in_.connect(src);
+        }
+
+        auto poll_next_batch(const std::size_t) -> poll override {
+            const auto in = in_.values();
+            for (auto &route : routes_) {
+                route.clear();
+            }
+            for (std::size_t i = 0; i < in.size(); ++i) {
+                const auto hash = std::hash<std::decay_t<std::invoke_result_t<const Key&, const input_value&>>>{}(
+                    std::invoke(key_, in[i]));
+                routes_[hash % replicas_.size()].push_back(i);
+            }
+
+            results_.clear();
+            results_.resize(in.size());
+            const auto task = [&](const std::size_t r) {
+                run_replica(r, in);
+            };
+            if (workers_ != nullptr && in.size() > 1) {
+                workers_->run(task);
+            } else {
+                for (std::size_t r = 0; r < replicas_.size(); ++r) {
+                    task(r);
+                }
+            }
+
+            out_.clear();
+            for (auto &result : results_) {
+                if (result.has_value()) {
+                    out_.push_back(std::move(*result));
+                }
+            }
+            if (!out_.empty()) {
+                return poll::ready;
+            }
+            return std::find(closed_.begin(), closed_.end(), 0) == closed_.end() ? poll::closed : poll::empty;
+        }
+
+        auto values() const -> std::span<const output_value> override {
+            return out_;
+        }
+
+    private:
+        Key key_;
+        batch_input<input_value> in_;
+        std::vector<std::unique_ptr<Component>> replicas_;
+        std::vector<internal::keyed_feed<input_value>> feeds_;
+        // The positions in the batch of the values routed to each replica.
+        std::vector<std::vector<std::size_t>> routes_;
+        // What each replica published for the value at the same position in the batch.
+        std::vector<std::optional<output_value>> results_;
+        std::vector<output_value> out_;
+        // Not a vector<bool>, since replicas on different threads set their own entries.
+        std::vector<char> closed_;
+        std::unique_ptr<internal::fork_join> workers_;
+
+        // Touches only the replica's own state and its own entries of results_.
+        auto run_replica(const std::size_t r, const std::span<const input_value> in) -> void {
+            for (const auto i : routes_[r]) {
+                if (closed_[r]) {
+                    return;
+                }
+                feeds_[r].set(in[i]);
+                const auto status = internal::node_access::poll_next_batch(*replicas_[r], 1);
+                if (status == poll::ready) {
+                    results_[i].emplace(replicas_[r]->value());
+                }
+                closed_[r] = status == poll::closed;
+            }
+        }
+
+        auto save_state(state_writer &writer) const -> void override {
+            for (const auto &replica : replicas_) {
+                auto state = state_writer();
+                internal::node_access::save_state(*replica, state);
+                writer.write_string(state.bytes());
+            }
+        }
+
+        auto restore_state(state_reader &reader) -> void override {
+            for (auto &replica : replicas_) {
+                const auto state = reader.read_string();
+                auto replica_reader = state_reader(state);
+                internal::node_access::restore_state(*replica, replica_reader);
+            }
+        }
+    };
+}
+
+#endif  // COMP6771_KEYED_H
@@ -0,0 +1,201 @@
+#include "./keyed.h"
+#include "./pipeline.h"
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <set>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+namespace {
+    using record = std::pair<int, int>;
+
+    std::mutex threads_mutex;
+    std::set<std::thread::id> threads;
+}
+
+// Publishes `count` records, with keys taken round-robin from `keys` distinct ones.
+struct record_source : ppl::batch_source<record> {
+    const int count_;
+    const int keys_;
+    int next_ = 0;
+    std::vector<record> batch_;
+
+    record_source(const int count, const int keys): count_{count}, keys_{keys} {}
+
+    auto name() const -> std::string override {
+        return "record_source";
+    }
+
+    auto poll_next_batch(const std::size_t max) -> ppl::poll override {
+        batch_.clear();
+        while (batch_.size() < max && next_ < count_) {
+            batch_.emplace_back(next_ % keys_, next_);
+            next_++;
+        }
+        return batch_.empty() ? ppl::poll::closed : ppl::poll::ready;
+    }
+
+    auto values() const -> std::span<const record> override {
+        return batch_;
+    }
+};
+
+// Publishes each record's key with the running total of the values for that key so far.
+struct running_total : ppl::component<std::tuple<record>, record> {
+    const ppl::producer<record>* slot0 = nullptr;
+    std::map<int, int> totals_;
+    record val_;
+
+    auto name() const -> std::string override {
+        return "running_total";
+    }
+
+    auto connect(const ppl::node* src, int) -> void override {
+        slot0 = static_cast<const ppl::producer<record>*>(src);
+    }
+
+    auto poll_next() -> ppl::poll override {
+        {
+            const auto lock = std::lock_guard{threads_mutex};
+            threads.insert(std::this_thread::get_id());
+        }
+        const auto &[key, value] = slot0->value();
+        val_ = {key, totals_[key] += value};
+        return ppl::poll::ready;
+    }
+
+    auto value() const -> const record& override {
+        return val_;
+    }
+
+    auto save_state(ppl::state_writer &writer) const -> void override {
+        writer.write(totals_.size());
+        for (const auto &[key, total] : totals_) {
+            writer.write(key);
+            writer.write(total);
+        }
+    }
+
+    auto restore_state(ppl::state_reader &reader) -> void override {
+        totals_.clear();
+        for (auto n = reader.read<std::size_t>(); n > 0; --n) {
+            const auto key = reader.read<int>();
+            totals_[key] = reader.read<int>();
+        }
+    }
+};
+
+struct record_sink : ppl::batch_sink<record> {
+    ppl::batch_input<record> in_;
+    std::vector<record> records_;
+
+    auto name() const -> std::string override {
+        return "record_sink";
+    }
+
+    auto connect(const ppl::node* src, int) -> void override {
+        in_.connect(src);
+    }
+
+    auto poll_next_batch(const std::size_t) -> ppl::poll override {
+        const auto values = in_.values();
+        records_.insert(records_.end(), values.begin(), values.end());
+        return ppl::poll::ready;
+    }
+};
+
+constexpr auto key_of = [](const record &r) { return r.first; };
+using keyed_total = ppl::keyed<running_total, decltype(key_of)>;
+
+TEST_CASE("Testing keyed replicas publish what a single component would") {
+    const auto run = [](const std::size_t replicas) {
+        auto pipeline = ppl::pipeline{};
+        pipeline.set_batch_size(64);
+        const auto source = pipeline.create_node<record_source>(1000, 13);
+        const auto totals = pipeline.create_node<keyed_total>(replicas, key_of);
+        const auto sink = pipeline.create_node<record_sink>();
+        pipeline.connect(source, totals, 0);
+        pipeline.connect(totals, sink, 0);
+        pipeline.run();
+        return std::pair{static_cast<record_sink*>(pipeline.get_node(sink))->records_,
+            static_cast<keyed_total*>(pipeline.get_node(totals))->replica(0).totals_.size()};
+    };
+
+    threads.clear();
+    const auto [expected, all_keys] = run(1);
+    CHECK(expected.size() == 1000);
+    CHECK(all_keys == 13);
+    CHECK(threads.size() == 1);
+
+    threads.clear();
+    const auto [actual, some_keys] = run(4);
+    CHECK(actual == expected);
+    // Each key is only seen by one replica.
+    CHECK(some_keys < 13);
+    CHECK(threads.size() == 4);
+}
+
+TEST_CASE("Testing keyed falls back to one value per poll next to scalar nodes") {
+    struct scalar_sink : ppl::sink<record> {
+        const ppl::producer<record>* in_ = nullptr;
+        std::vector<record> records_;
+
+        auto name() const -> std::string override {
+            return "scalar_sink";
+        }
+
+        auto connect(const ppl::node* src, const int) -> void override {
+            in_ = static_cast<const ppl::producer<record>*>(src);
+        }
+
+        auto poll_next() -> ppl::poll override {
+            records_.push_back(in_->value());
+            return ppl::poll::ready;
+        }
+    };
+
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<record_source>(6, 2);
+    const auto totals = pipeline.create_node<keyed_total>(3, key_of);
+    const auto sink = pipeline.create_node<scalar_sink>();
+    pipeline.connect(source, totals, 0);
+    pipeline.connect(totals, sink, 0);
+    CHECK(pipeline.get_node(totals)->name() == "running_total");
+    pipeline.run();
+    CHECK(static_cast<scalar_sink*>(pipeline.get_node(sink))->records_
+        == std::vector<record>{{0, 0}, {1, 1}, {0, 2}, {1, 4}, {0, 6}, {1, 9}});
+}
+
+TEST_CASE("Testing keyed replicas keep their state across a restart") {
+    const auto build = [](ppl::pipeline &pipeline, const int count) {
+        pipeline.set_batch_size(16);
+        const auto source = pipeline.create_node<record_source>(count, 5);
+        const auto totals = pipeline.create_node<keyed_total>(3, key_of);
+        const auto sink = pipeline.create_node<record_sink>();
+        pipeline.connect(source, totals, 0);
+        pipeline.connect(totals, sink, 0);
+        return sink;
+    };
+
+    auto log = std::stringstream();
+    auto first = ppl::pipeline{};
+    build(first, 40);
+    first.run();
+    first.checkpoint(log);
+
+    auto second = ppl::pipeline{};
+    const auto sink = build(second, 5);
+    CHECK(second.restore(log));
+    second.run();
+    // Keys 0 to 4 have had 0 + 5 + ... + 35 and so on added up already.
+    CHECK(static_cast<record_sink*>(second.get_node(sink))->records_
+        == std::vector<record>{{0, 140}, {1, 149}, {2, 158}, {3, 167}, {4, 176}});
+}
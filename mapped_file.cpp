@@ -0,0 +1,153 @@
+#include "./mapped_file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ppl::mapped_file::mapped_file(const std::string &path) {
+    const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    struct ::stat info {};
+    if (::fstat(fd, &info) != 0) {
+        const auto error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::system_category(), path);
+    }
+    size_ = static_cast<std::size_t>(info.st_size);
+    // Empty files can't be mapped, but there is nothing to read from them anyway.
+    if (size_ != 0) {
+        const auto data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            const auto error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::system_category(), path);
+        }
+        ::madvise(data, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const std::byte*>(data);
+    }
+    ::close(fd);
+}
+
+ppl::mapped_file::mapped_file(mapped_file &&other) noexcept
+: data_{std::exchange(other.data_, nullptr)}, size_{std::exchange(other.size_, 0)} {}
+
+auto ppl::mapped_file::operator=(mapped_file &&other) noexcept -> mapped_file& {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    return *this;
+}
+
+ppl::mapped_file::~mapped_file() noexcept {
+    if (data_ != nullptr) {
+        ::munmap(const_cast<std::byte*>(data_), size_);
+    }
+}
+
+ppl::fixed_record_source::fixed_record_source(const std::string &path, const std::size_t width)
+: file_{path}, width_{width} {
+    if (width_ == 0) {
+        throw std::invalid_argument("record width must be positive");
+    }
+}
+
+auto ppl::fixed_record_source::poll_next_batch(const std::size_t max) -> poll {
+    const auto bytes = file_.bytes();
+    batch_.clear();
+    while (batch_.size() < max && bytes.size() - offset_ >= width_) {
+        batch_.push_back(bytes.subspan(offset_, width_));
+        offset_ += width_;
+    }
+    return batch_.empty() ? poll::closed : poll::ready;
+}
+
+ppl::line_source::line_source(const std::string &path): file_{path} {}
+
+auto ppl::line_source::poll_next_batch(const std::size_t max) -> poll {
+    const auto bytes = file_.bytes();
+    const auto text = std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    batch_.clear();
+    while (batch_.size() < max && offset_ < text.size()) {
+        const auto end = std::min(text.find('\n', offset_), text.size());
+        batch_.push_back(text.substr(offset_, end - offset_));
+        offset_ = end + 1;
+    }
+    return batch_.empty() ? poll::closed : poll::ready;
+}
+
+auto ppl::internal::file_writer::aligned_free::operator()(std::byte* p) const noexcept -> void {
+    std::free(p);
+}
+
+ppl::internal::file_writer::file_writer(const std::string &path, const std::size_t buffer_size)
+: fd_{::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)} {
+    if (fd_ < 0) {
+        throw std::system_error(errno, std::system_category(), path);
+    }
+    const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    capacity_ = std::max((buffer_size + page - 1) / page * page, page);
+    buffer_.reset(static_cast<std::byte*>(std::aligned_alloc(page, capacity_)));
+    if (buffer_ == nullptr) {
+        ::close(fd_);
+        throw std::bad_alloc();
+    }
+}
+
+ppl::internal::file_writer::~file_writer() noexcept {
+    try {
+        flush();
+    } catch (...) {
+        // Call flush() first to find out about errors.
+    }
+    ::close(fd_);
+}
+
+auto ppl::internal::file_writer::write(std::span<const std::byte> bytes) -> void {
+    if (bytes.size() > capacity_ - size_) {
+        flush();
+        // Too big to be worth buffering.
+        if (bytes.size() >= capacity_) {
+            write_all(bytes);
+            return;
+        }
+    }
+    std::memcpy(buffer_.get() + size_, bytes.data(), bytes.size());
+    size_ += bytes.size();
+}
+
+auto ppl::internal::file_writer::flush() -> void {
+    auto bytes = std::span<const std::byte>(buffer_.get(), size_);
+    try {
+        write_all(bytes);
+    } catch (...) {
+        // Keep what wasn't written, so that flushing again can pick up where this left off.
+        std::memmove(buffer_.get(), bytes.data(), bytes.size());
+        size_ = bytes.size();
+        throw;
+    }
+    size_ = 0;
+}
+
+auto ppl::internal::file_writer::write_all(std::span<const std::byte> &bytes) -> void {
+    while (!bytes.empty()) {
+        const auto written = ::write(fd_, bytes.data(), bytes.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::system_category(), "write");
+        }
+        bytes = bytes.subspan(static_cast<std::size_t>(written));
+    }
+}
@@ -0,0 +1,205 @@
+#ifndef COMP6771_MAPPED_FILE_H
+#define COMP6771_MAPPED_FILE_H
+
+#include "./pipeline.h"
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace ppl {
+    // Nodes for reading and writing files. The sources map the whole file into memory and
+    // publish views into the mapping rather than copies, so a record stays valid for as long as
+    // its source does. Both sources produce batches, and both sinks consume them.
+
+    // A read-only mapping of a whole file.
+    class mapped_file {
+    public:
+        explicit mapped_file(const std::string &path);
+        mapped_file(const mapped_file &) = delete;
+        mapped_file(mapped_file &&other) noexcept;
+        auto operator=(const mapped_file &) -> mapped_file& = delete;
+        auto operator=(mapped_file &&other) noexcept -> mapped_file&;
+        ~mapped_file() noexcept;
+
+        auto bytes() const noexcept -> std::span<const std::byte> {
+            return {data_, size_};
+        }
+
+    private:
+        const std::byte* data_ = nullptr;
+        std::size_t size_ = 0;
+    };
+
+    // Publishes each `width`-byte record of a file. A partial record at the end is ignored.
+    class fixed_record_source : public batch_source<std::span<const std::byte>> {
+    public:
+        fixed_record_source(const std::string &path, const std::size_t width);
+
+        auto name() const -> std::string override {
+            return "fixed_record_source";
+        }
+
+        auto poll_next_batch(const std::size_t max) -> poll override;
+
+        auto values() const -> std::span<const std::span<const std::byte>> override {
+            return batch_;
+        }
+
+    private:
+        mapped_file file_;
+        std::size_t width_;
+        std::size_t offset_ = 0;
+        std::vector<std::span<const std::byte>> batch_;
+
+        // Resumes from the same position in the file. Throws pipeline_error_kind::invalid_checkpoint
+        // if the position isn't the start of a record in this file.
+        auto save_state(state_writer &writer) const -> void override {
+            writer.write(offset_);
+        }
+
+        auto restore_state(state_reader &reader) -> void override {
+            const auto offset = reader.read<std::size_t>();
+            if (offset > file_.bytes().size() || offset % width_ != 0) {
+                throw pipeline_error(pipeline_error_kind::invalid_checkpoint);
+            }
+            offset_ = offset;
+        }
+    };
+
+    // Publishes each line of a file, without its newline. The last line need not end in one.
+    class line_source : public batch_source<std::string_view> {
+    public:
+        explicit line_source(const std::string &path);
+
+        auto name() const -> std::string override {
+            return "line_source";
+        }
+
+        auto poll_next_batch(const std::size_t max) -> poll override;
+
+        auto values() const -> std::span<const std::string_view> override {
+            return batch_;
+        }
+
+    private:
+        mapped_file file_;
+        std::size_t offset_ = 0;
+        std::vector<std::string_view> batch_;
+
+        // Throws pipeline_error_kind::invalid_checkpoint if the position is past the end of the file.
+        auto save_state(state_writer &writer) const -> void override {
+            writer.write(offset_);
+        }
+
+        auto restore_state(state_reader &reader) -> void override {
+            const auto offset = reader.read<std::size_t>();
+            if (offset > file_.bytes().size()) {
+                throw pipeline_error(pipeline_error_kind::invalid_checkpoint);
+            }
+            offset_ = offset;
+        }
+    };
+
+    namespace internal {
+        // Writes to a file through a page-aligned buffer, so that the kernel sees a few large
+        // writes rather than one per record. Anything still buffered is written on destruction.
+        class file_writer {
+        public:
+            file_writer(const std::string &path, const std::size_t buffer_size);
+            file_writer(const file_writer &) = delete;
+            auto operator=(const file_writer &) -> file_writer& = delete;
+            ~file_writer() noexcept;
+
+            auto write(std::span<const std::byte> bytes) -> void;
+            // Anything that couldn't be written is kept for the next flush.
+            auto flush() -> void;
+
+            // The number of bytes waiting to be flushed.
+            auto pending() const noexcept -> std::size_t {
+                return size_;
+            }
+
+        private:
+            struct aligned_free {
+                auto operator()(std::byte* p) const noexcept -> void;
+            };
+
+            int fd_;
+            std::unique_ptr<std::byte, aligned_free> buffer_;
+            std::size_t capacity_;
+            std::size_t size_ = 0;
+
+            // Leaves `bytes` holding whatever wasn't written if it throws.
+            auto write_all(std::span<const std::byte> &bytes) -> void;
+        };
+    }
+
+    // Writes each record it receives to a file, back to back.
+    class record_sink : public batch_sink<std::span<const std::byte>> {
+    public:
+        explicit record_sink(const std::string &path, const std::size_t buffer_size = std::size_t{1} << 20)
+        : writer_{path, buffer_size} {}
+
+        auto name() const -> std::string override {
+            return "record_sink";
+        }
+
+        auto connect(const node* src, const int) -> void override {
+            in_.connect(src);
+        }
+
+        auto poll_next_batch(const std::size_t) -> poll override {
+            for (const auto &record : in_.values()) {
+                writer_.write(record);
+            }
+            return poll::ready;
+        }
+
+        // Writes out anything still buffered.
+        auto flush() -> void {
+            writer_.flush();
+        }
+
+    private:
+        batch_input<std::span<const std::byte>> in_;
+        internal::file_writer writer_;
+    };
+
+    // Writes each line it receives to a file, followed by a newline.
+    class line_sink : public batch_sink<std::string_view> {
+    public:
+        explicit line_sink(const std::string &path, const std::size_t buffer_size = std::size_t{1} << 20)
+        : writer_{path, buffer_size} {}
+
+        auto name() const -> std::string override {
+            return "line_sink";
+        }
+
+        auto connect(const node* src, const int) -> void override {
+            in_.connect(src);
+        }
+
+        auto poll_next_batch(const std::size_t) -> poll override {
+            for (const auto &line : in_.values()) {
+                writer_.write(std::as_bytes(std::span(line)));
+                writer_.write(std::as_bytes(std::span("\n", 1)));
+            }
+            return poll::ready;
+        }
+
+        // Writes out anything still buffered.
+        auto flush() -> void {
+            writer_.flush();
+        }
+
+    private:
+        batch_input<std::string_view> in_;
+        internal::file_writer writer_;
+    };
+}
+
+#endif  // COMP6771_MAPPED_FILE_H
@@ -0,0 +1,230 @@
+#include "./mapped_file.h"
+#include "./pipeline.h"
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+namespace {
+    auto temp_path(const std::string &name) -> std::string {
+        return (std::filesystem::temp_directory_path() / ("ppl_mapped_file_" + name)).string();
+    }
+
+    auto write_file(const std::string &path, const std::string &contents) -> void {
+        auto out = std::ofstream(path, std::ios::binary);
+        out << contents;
+    }
+
+    auto read_file(const std::string &path) -> std::string {
+        auto in = std::ifstream(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), {});
+    }
+}
+
+// Keeps every record it receives.
+struct record_collector : ppl::batch_sink<std::span<const std::byte>> {
+    ppl::batch_input<std::span<const std::byte>> in_;
+    std::vector<std::span<const std::byte>> records_;
+    std::size_t polls_ = 0;
+
+    auto name() const -> std::string override {
+        return "record_collector";
+    }
+
+    auto connect(const node* src, const int) -> void override {
+        in_.connect(src);
+    }
+
+    auto poll_next_batch(const std::size_t) -> ppl::poll override {
+        const auto values = in_.values();
+        records_.insert(records_.end(), values.begin(), values.end());
+        ++polls_;
+        return ppl::poll::ready;
+    }
+};
+
+TEST_CASE("Testing line_source and line_sink copy a file line by line") {
+    const auto in = temp_path("lines_in");
+    const auto out = temp_path("lines_out");
+    write_file(in, "first\n\nthird line\nlast without newline");
+    {
+        auto pipeline = ppl::pipeline{};
+        pipeline.set_batch_size(2);
+        const auto source = pipeline.create_node<ppl::line_source>(in);
+        const auto sink = pipeline.create_node<ppl::line_sink>(out);
+        pipeline.connect(source, sink, 0);
+        pipeline.run();
+        static_cast<ppl::line_sink*>(pipeline.get_node(sink))->flush();
+        CHECK(read_file(out) == "first\n\nthird line\nlast without newline\n");
+    }
+    std::filesystem::remove(in);
+    std::filesystem::remove(out);
+}
+
+TEST_CASE("Testing fixed_record_source publishes views into the mapped file") {
+    const auto in = temp_path("records_in");
+    // Three 4-byte records, then a partial one.
+    write_file(in, "aaaabbbbccccdd");
+    auto pipeline = ppl::pipeline{};
+    pipeline.set_batch_size(8);
+    const auto source = pipeline.create_node<ppl::fixed_record_source>(in, 4);
+    const auto sink = pipeline.create_node<record_collector>();
+    pipeline.connect(source, sink, 0);
+    pipeline.run();
+
+    const auto &records = static_cast<record_collector*>(pipeline.get_node(sink))->records_;
+    REQUIRE(records.size() == 3);
+    CHECK(static_cast<record_collector*>(pipeline.get_node(sink))->polls_ == 1);
+    for (auto i = std::size_t{0}; i < records.size(); ++i) {
+        CHECK(records[i].size() == 4);
+        // The records are back to back, so they have not been copied out of the mapping.
+        CHECK(records[i].data() == records[0].data() + 4 * i);
+    }
+    const auto text = std::string_view(reinterpret_cast<const char*>(records[0].data()), 12);
+    CHECK(text == "aaaabbbbcccc");
+    std::filesystem::remove(in);
+}
+
+TEST_CASE("Testing record_sink writes records larger than its buffer") {
+    const auto in = temp_path("large_in");
+    const auto out = temp_path("large_out");
+    auto contents = std::string();
+    for (auto i = 0; i < 3; ++i) {
+        contents += std::string(10000, static_cast<char>('x' + i));
+    }
+    write_file(in, contents);
+    {
+        auto pipeline = ppl::pipeline{};
+        const auto source = pipeline.create_node<ppl::fixed_record_source>(in, 10000);
+        const auto sink = pipeline.create_node<ppl::record_sink>(out, 1);
+        pipeline.connect(source, sink, 0);
+        pipeline.run();
+    }
+    // The sink writes anything left over when it is destroyed.
+    CHECK(read_file(out) == contents);
+    std::filesystem::remove(in);
+    std::filesystem::remove(out);
+}
+
+TEST_CASE("Testing file sources handle empty and missing files") {
+    const auto in = temp_path("empty_in");
+    write_file(in, "");
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<ppl::line_source>(in);
+    const auto sink = pipeline.create_node<record_collector>();
+    CHECK_THROWS_AS(pipeline.connect(source, sink, 0), ppl::pipeline_error);
+    pipeline.erase_node(sink);
+    const auto lines = pipeline.create_node<ppl::line_sink>(temp_path("empty_out"));
+    pipeline.connect(source, lines, 0);
+    CHECK(pipeline.step());
+    CHECK(read_file(temp_path("empty_out")).empty());
+    CHECK_THROWS_AS(ppl::fixed_record_source(in, 0), std::invalid_argument);
+    std::filesystem::remove(in);
+    std::filesystem::remove(temp_path("empty_out"));
+
+    CHECK_THROWS_AS(ppl::mapped_file(temp_path("missing")), std::system_error);
+}
+
+TEST_CASE("Testing file sources reject checkpoints taken against a different file") {
+    const auto in = temp_path("checkpoint_in");
+    const auto out = temp_path("checkpoint_out");
+    const auto checkpoint = [](const auto &build) {
+        auto log = std::stringstream();
+        auto pipeline = ppl::pipeline{};
+        build(pipeline);
+        pipeline.run();
+        pipeline.checkpoint(log);
+        return log;
+    };
+    const auto restore = [](std::stringstream log, const auto &build) {
+        auto pipeline = ppl::pipeline{};
+        build(pipeline);
+        return pipeline.restore(log);
+    };
+    const auto lines = [&](ppl::pipeline &p) {
+        p.connect(p.create_node<ppl::line_source>(in), p.create_node<ppl::line_sink>(out), 0);
+    };
+    const auto records = [&](const std::size_t width) {
+        return [&, width](ppl::pipeline &p) {
+            p.connect(p.create_node<ppl::fixed_record_source>(in, width), p.create_node<record_collector>(), 0);
+        };
+    };
+
+    write_file(in, "a much longer file\nthan the next one\n");
+    auto past_the_end = checkpoint(lines);
+    write_file(in, "short\n");
+    CHECK_THROWS_AS(restore(std::move(past_the_end), lines), ppl::pipeline_error);
+    CHECK(restore(checkpoint(lines), lines));
+
+    // Three 2-byte records leave the source 6 bytes in, halfway through a 4-byte record.
+    write_file(in, "abcdef");
+    CHECK_THROWS_AS(restore(checkpoint(records(2)), records(4)), ppl::pipeline_error);
+    CHECK(restore(checkpoint(records(2)), records(2)));
+
+    std::filesystem::remove(in);
+    std::filesystem::remove(out);
+}
+
+TEST_CASE("Testing lines are sent by content between processes and into traces") {
+    const auto in = temp_path("wire_in");
+    const auto out = temp_path("wire_out");
+    const auto lines = [&](ppl::pipeline &p) {
+        const auto source = p.create_node<ppl::line_source>(in);
+        const auto sink = p.create_node<ppl::line_sink>(out);
+        p.connect(source, sink, 0);
+        return std::pair{source, sink};
+    };
+    write_file(in, "first\nsecond\n\nlast\n");
+
+    SECTION("Across a partition") {
+        auto pipeline = ppl::pipeline{};
+        const auto [source, sink] = lines(pipeline);
+        pipeline.set_partition(source, 1);
+        CHECK(pipeline.run_partitioned().at(1).completed);
+        static_cast<ppl::line_sink*>(pipeline.get_node(sink))->flush();
+        CHECK(read_file(out) == "first\nsecond\n\nlast\n");
+    }
+
+    SECTION("Replayed once the file has changed") {
+        auto trace = std::stringstream();
+        {
+            auto pipeline = ppl::pipeline{};
+            lines(pipeline);
+            pipeline.record(trace);
+            pipeline.run();
+            pipeline.end_trace();
+        }
+        write_file(in, "XXXXX\nXXXXXX\n\nXXXX\n");
+        auto pipeline = ppl::pipeline{};
+        const auto sink = lines(pipeline).second;
+        pipeline.replay(trace);
+        pipeline.run();
+        static_cast<ppl::line_sink*>(pipeline.get_node(sink))->flush();
+        CHECK(read_file(out) == "first\nsecond\n\nlast\n");
+    }
+
+    std::filesystem::remove(in);
+    std::filesystem::remove(out);
+}
+
+TEST_CASE("Testing a failed flush keeps the bytes it couldn't write") {
+    // Every write to /dev/full fails with ENOSPC.
+    auto writer = ppl::internal::file_writer("/dev/full", 4096);
+    const auto text = std::string_view("ten bytes\n");
+    writer.write(std::as_bytes(std::span(text)));
+    CHECK(writer.pending() == text.size());
+    CHECK_THROWS_AS(writer.flush(), std::system_error);
+    CHECK(writer.pending() == text.size());
+    CHECK_THROWS_AS(writer.flush(), std::system_error);
+    CHECK(writer.pending() == text.size());
+}
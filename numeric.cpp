@@ -0,0 +1,204 @@
+#include "./numeric.h"
+
+#include <cstring>
+
+// Each kernel is written once, in terms of GCC vector extensions, and instantiated for each
+// vector width inside a function compiled for the matching instruction set. The bodies are
+// always inlined into those functions, so they are compiled with the wider registers, and a
+// scalar loop finishes off whatever is left over.
+//
+// Since the helpers taking and returning vectors are always inlined, no vector ever crosses a
+// function boundary, and GCC's warnings about the vector ABI don't apply.
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+namespace {
+    template <typename T, std::size_t Bytes>
+    struct vector_of {
+        typedef T type __attribute__((vector_size(Bytes)));
+    };
+
+    template <typename T, std::size_t Bytes>
+    constexpr auto lanes = Bytes / sizeof(T);
+
+    template <typename V, typename T>
+    [[gnu::always_inline]] inline auto load(const T* p) -> V {
+        auto v = V{};
+        std::memcpy(&v, p, sizeof(V));
+        return v;
+    }
+
+    template <typename V, typename T>
+    [[gnu::always_inline]] inline auto store(T* p, const V &v) -> void {
+        std::memcpy(p, &v, sizeof(V));
+    }
+
+    // Each works on both vectors and scalars.
+    struct add_op {
+        template <typename V>
+        [[gnu::always_inline]] auto operator()(const V &a, const V &b) const -> V { return a + b; }
+    };
+
+    struct subtract_op {
+        template <typename V>
+        [[gnu::always_inline]] auto operator()(const V &a, const V &b) const -> V { return a - b; }
+    };
+
+    struct multiply_op {
+        template <typename V>
+        [[gnu::always_inline]] auto operator()(const V &a, const V &b) const -> V { return a * b; }
+    };
+
+    struct min_op {
+        template <typename V>
+        [[gnu::always_inline]] auto operator()(const V &a, const V &b) const -> V { return b < a ? b : a; }
+    };
+
+    struct max_op {
+        template <typename V>
+        [[gnu::always_inline]] auto operator()(const V &a, const V &b) const -> V { return a < b ? b : a; }
+    };
+
+    template <typename T, std::size_t Bytes>
+    [[gnu::always_inline]] inline auto affine_body(const T* in, const std::size_t n, const T scale,
+        const T offset, T* out) -> void {
+        auto i = std::size_t{0};
+        if constexpr (lanes<T, Bytes> > 1) {
+            using vector = typename vector_of<T, Bytes>::type;
+            for (; i + lanes<T, Bytes> <= n; i += lanes<T, Bytes>) {
+                store(out + i, load<vector>(in + i) * scale + offset);
+            }
+        }
+        for (; i < n; ++i) {
+            out[i] = in[i] * scale + offset;
+        }
+    }
+
+    template <typename T, std::size_t Bytes, typename Op>
+    [[gnu::always_inline]] inline auto combine_body(const Op op, const T* a, const T* b,
+        const std::size_t n, T* out) -> void {
+        auto i = std::size_t{0};
+        if constexpr (lanes<T, Bytes> > 1) {
+            using vector = typename vector_of<T, Bytes>::type;
+            for (; i + lanes<T, Bytes> <= n; i += lanes<T, Bytes>) {
+                store(out + i, op(load<vector>(a + i), load<vector>(b + i)));
+            }
+        }
+        for (; i < n; ++i) {
+            out[i] = op(a[i], b[i]);
+        }
+    }
+
+    // Computes several neighbouring windows at once, each lane reducing one of them, rather than
+    // keeping a running total. This costs `width` operations per value, but they are independent
+    // and there is no rounding drift.
+    template <typename T, std::size_t Bytes, typename Op>
+    [[gnu::always_inline]] inline auto window_body(const Op op, const T* in, const std::size_t n,
+        const std::size_t width, T* out) -> void {
+        auto i = std::size_t{0};
+        if constexpr (lanes<T, Bytes> > 1) {
+            using vector = typename vector_of<T, Bytes>::type;
+            for (; i + lanes<T, Bytes> <= n; i += lanes<T, Bytes>) {
+                auto total = load<vector>(in + i);
+                for (std::size_t j = 1; j < width; ++j) {
+                    total = op(total, load<vector>(in + i + j));
+                }
+                store(out + i, total);
+            }
+        }
+        for (; i < n; ++i) {
+            auto total = in[i];
+            for (std::size_t j = 1; j < width; ++j) {
+                total = op(total, in[i + j]);
+            }
+            out[i] = total;
+        }
+    }
+
+    template <typename T, std::size_t Bytes>
+    [[gnu::always_inline]] inline auto combine_dispatch(const ppl::combine_op op, const T* a, const T* b,
+        const std::size_t n, T* out) -> void {
+        switch (op) {
+        case ppl::combine_op::add: return combine_body<T, Bytes>(add_op{}, a, b, n, out);
+        case ppl::combine_op::subtract: return combine_body<T, Bytes>(subtract_op{}, a, b, n, out);
+        case ppl::combine_op::multiply: return combine_body<T, Bytes>(multiply_op{}, a, b, n, out);
+        case ppl::combine_op::min: return combine_body<T, Bytes>(min_op{}, a, b, n, out);
+        case ppl::combine_op::max: return combine_body<T, Bytes>(max_op{}, a, b, n, out);
+        }
+    }
+
+    template <typename T, std::size_t Bytes>
+    [[gnu::always_inline]] inline auto window_dispatch(const ppl::window_op op, const T* in, const std::size_t n,
+        const std::size_t width, T* out) -> void {
+        switch (op) {
+        case ppl::window_op::sum:
+        case ppl::window_op::mean: return window_body<T, Bytes>(add_op{}, in, n, width, out);
+        case ppl::window_op::min: return window_body<T, Bytes>(min_op{}, in, n, width, out);
+        case ppl::window_op::max: return window_body<T, Bytes>(max_op{}, in, n, width, out);
+        }
+    }
+
+    // One set of kernels per instruction set. The target attribute has to be on the function
+    // that the bodies are inlined into, so each set is spelled out separately.
+#define PPL_NUMERIC_KERNELS(suffix, target, bytes) \
+    template <typename T> \
+    target auto affine_##suffix(const T* in, const std::size_t n, const T scale, const T offset, T* out) -> void { \
+        affine_body<T, bytes>(in, n, scale, offset, out); \
+    } \
+    template <typename T> \
+    target auto combine_##suffix(const ppl::combine_op op, const T* a, const T* b, const std::size_t n, T* out) -> void { \
+        combine_dispatch<T, bytes>(op, a, b, n, out); \
+    } \
+    template <typename T> \
+    target auto window_##suffix(const ppl::window_op op, const T* in, const std::size_t n, const std::size_t width, T* out) -> void { \
+        window_dispatch<T, bytes>(op, in, n, width, out); \
+    } \
+    template <typename T> \
+    constexpr auto kernels_##suffix = ppl::internal::numeric_kernels<T>{affine_##suffix<T>, combine_##suffix<T>, window_##suffix<T>};
+
+    PPL_NUMERIC_KERNELS(scalar, , sizeof(T))
+#if defined(__x86_64__) || defined(__i386__)
+    PPL_NUMERIC_KERNELS(sse2, __attribute__((target("sse2"))), 16)
+    PPL_NUMERIC_KERNELS(avx2, __attribute__((target("avx2"))), 32)
+    PPL_NUMERIC_KERNELS(avx512, __attribute__((target("avx512f,avx512dq"))), 64)
+#endif
+#undef PPL_NUMERIC_KERNELS
+}
+
+auto ppl::detected_simd_level() -> simd_level {
+#if defined(__x86_64__) || defined(__i386__)
+    static const auto level = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) {
+            return simd_level::avx512;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return simd_level::avx2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return simd_level::sse2;
+        }
+        return simd_level::scalar;
+    }();
+    return level;
+#else
+    return simd_level::scalar;
+#endif
+}
+
+template <ppl::simd_numeric T>
+auto ppl::internal::kernels_for(simd_level level) -> const numeric_kernels<T>& {
+    level = std::min(level, detected_simd_level());
+    switch (level) {
+#if defined(__x86_64__) || defined(__i386__)
+    case simd_level::avx512: return kernels_avx512<T>;
+    case simd_level::avx2: return kernels_avx2<T>;
+    case simd_level::sse2: return kernels_sse2<T>;
+#endif
+    default: return kernels_scalar<T>;
+    }
+}
+
+template auto ppl::internal::kernels_for<float>(simd_level) -> const numeric_kernels<float>&;
+template auto ppl::internal::kernels_for<double>(simd_level) -> const numeric_kernels<double>&;
+template auto ppl::internal::kernels_for<std::int32_t>(simd_level) -> const numeric_kernels<std::int32_t>&;
+template auto ppl::internal::kernels_for<std::int64_t>(simd_level) -> const numeric_kernels<std::int64_t>&;
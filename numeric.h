@@ -0,0 +1,272 @@
+#ifndef COMP6771_NUMERIC_H
+#define COMP6771_NUMERIC_H
+
+#include "./pipeline.h"
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ppl {
+    // Batch components for numeric streams. Each works on a whole batch at once, using kernels
+    // built for several instruction sets; the best one the CPU supports is picked the first time
+    // a kernel is needed. They are most effective with a large batch size, and fall back to one
+    // value per poll next to scalar nodes like any other batch node.
+
+    enum class simd_level { scalar, sse2, avx2, avx512 };
+
+    // The widest instruction set that both this build and the CPU it is running on support.
+    auto detected_simd_level() -> simd_level;
+
+    enum class window_op { sum, mean, min, max };
+    enum class combine_op { add, subtract, multiply, min, max };
+
+    template <typename T>
+    concept simd_numeric = std::same_as<T, float> or std::same_as<T, double>
+        or std::same_as<T, std::int32_t> or std::same_as<T, std::int64_t>;
+
+    namespace internal {
+        template <typename T>
+        struct numeric_kernels {
+            // out[i] = in[i] * scale + offset
+            void (*affine)(const T* in, std::size_t n, T scale, T offset, T* out);
+            // out[i] = a[i] op b[i]. `out` may be `a`.
+            void (*combine)(combine_op op, const T* a, const T* b, std::size_t n, T* out);
+            // out[i] = in[i] op ... op in[i + width - 1], for op one of sum, min or max.
+            void (*window)(window_op op, const T* in, std::size_t n, std::size_t width, T* out);
+        };
+
+        // The kernels for `level`, or for the detected level if the CPU does not support `level`.
+        template <simd_numeric T>
+        auto kernels_for(simd_level level) -> const numeric_kernels<T>&;
+
+        template <simd_numeric T>
+        auto kernels() -> const numeric_kernels<T>& {
+            static const auto &selected = kernels_for<T>(detected_simd_level());
+            return selected;
+        }
+
+        template <std::size_t, typename T>
+        using ignore_index = T;
+
+        template <typename T, std::size_t N, typename = std::make_index_sequence<N>>
+        struct repeated_tuple;
+
+        template <typename T, std::size_t N, std::size_t... I>
+        struct repeated_tuple<T, N, std::index_sequence<I...>> {
+            using type = std::tuple<ignore_index<I, T>...>;
+        };
+    }
+
+    // Publishes `in * scale + offset` for each value.
+    template <simd_numeric T>
+    class affine : public batch_component<std::tuple<T>, T> {
+    public:
+        explicit affine(const T scale, const T offset = T{0}): scale_{scale}, offset_{offset} {}
+
+        auto name() const -> std::string override {
+            return "affine";
+        }
+
+        auto connect(const node* src, const int) -> void override {
+            in_.connect(src);
+        }
+
+        auto poll_next_batch(const std::size_t) -> poll override {
+            const auto in = in_.values();
+            out_.resize(in.size());
+            internal::kernels<T>().affine(in.data(), in.size(), scale_, offset_, out_.data());
+            return poll::ready;
+        }
+
+        auto values() const -> std::span<const T> override {
+            return out_;
+        }
+
+    private:
+        T scale_;
+        T offset_;
+        batch_input<T> in_;
+        std::vector<T> out_;
+    };
+
+    // Publishes the values for which `predicate` returns true, and is empty when a whole batch is
+    // filtered out. The predicate is applied to every value in the batch without branching on
+    // its result, so a simple predicate can be vectorised where the component is instantiated.
+    template <typename T, typename Predicate>
+    class filter : public batch_component<std::tuple<T>, T> {
+    public:
+        explicit filter(Predicate predicate): predicate_{std::move(predicate)} {}
+
+        auto name() const -> std::string override {
+            return "filter";
+        }
+
+        auto connect(const node* src, const int) -> void override {
+            in_.connect(src);
+        }
+
+        auto poll_next_batch(const std::size_t) -> poll override {
+            const auto in = in_.values();
+            out_.resize(in.size());
+            auto kept = std::size_t{0};
+            for (const auto &value : in) {
+                out_[kept] = value;
+                kept += static_cast<std::size_t>(static_cast<bool>(predicate_(value)));
+            }
+            out_.resize(kept);
+            return kept == 0 ? poll::empty : poll::ready;
+        }
+
+        auto values() const -> std::span<const T> override {
+            return out_;
+        }
+
+    private:
+        Predicate predicate_;
+        batch_input<T> in_;
+        std::vector<T> out_;
+    };
+
+    // Publishes the sum, mean, minimum or maximum of the last `width` values, once it has seen
+    // that many. The mean of integers is rounded towards zero.
+    template <simd_numeric T>
+    class sliding_window : public batch_component<std::tuple<T>, T> {
+    public:
+        sliding_window(const std::size_t width, const window_op op): width_{width}, op_{op} {
+            if (width_ == 0) {
+                throw std::invalid_argument("window width must be positive");
+            }
+            history_.reserve(width_ - 1);
+        }
+
+        auto name() const -> std::string override {
+            return "sliding_window";
+        }
+
+        auto connect(const node* src, const int) -> void override {
+            in_.connect(src);
+        }
+
+        auto poll_next_batch(const std::size_t) -> poll override {
+            const auto in = in_.values();
+            // The kernel needs the end of the last batch in front of this one.
+            history_.insert(history_.end(), in.begin(), in.end());
+            const auto count = history_.size() >= width_ ? history_.size() - (width_ - 1) : 0;
+            out_.resize(count);
+            if (count != 0) {
+                const auto op = op_ == window_op::mean ? window_op::sum : op_;
+                internal::kernels<T>().window(op, history_.data(), count, width_, out_.data());
+                if (op_ == window_op::mean) {
+                    for (auto &value : out_) {
+                        value /= static_cast<T>(width_);
+                    }
+                }
+                history_.erase(history_.begin(), history_.begin() + static_cast<std::ptrdiff_t>(count));
+            }
+            return count == 0 ? poll::empty : poll::ready;
+        }
+
+        auto values() const -> std::span<const T> override {
+            return out_;
+        }
+
+    private:
+        std::size_t width_;
+        window_op op_;
+        batch_input<T> in_;
+        std::vector<T> history_;
+        std::vector<T> out_;
+
+        auto save_state(state_writer &writer) const -> void override {
+            writer.write_values(std::span<const T>(history_));
+        }
+
+        auto restore_state(state_reader &reader) -> void override {
+            history_ = reader.read_values<T>();
+        }
+    };
+
+    // Publishes `in0 op in1 op ... op inN-1`, applied left to right, for each set of values in
+    // its N slots. The slots may receive batches of different sizes; values without a partner
+    // yet are held until one arrives.
+    template <simd_numeric T, std::size_t N = 2>
+    requires (N >= 2)
+    class combine : public batch_component<typename internal::repeated_tuple<T, N>::type, T> {
+    public:
+        explicit combine(const combine_op op): op_{op} {}
+
+        auto name() const -> std::string override {
+            return "combine";
+        }
+
+        auto connect(const node* src, const int slot) -> void override {
+            in_[static_cast<std::size_t>(slot)].connect(src);
+        }
+
+        auto poll_next_batch(const std::size_t) -> poll override {
+            auto in = std::array<std::span<const T>, N>{};
+            auto held = std::array<bool, N>{};
+            auto count = std::numeric_limits<std::size_t>::max();
+            for (std::size_t i = 0; i < N; ++i) {
+                in[i] = in_[i].values();
+                held[i] = !pending_[i].empty();
+                if (held[i]) {
+                    pending_[i].insert(pending_[i].end(), in[i].begin(), in[i].end());
+                    in[i] = pending_[i];
+                }
+                count = std::min(count, in[i].size());
+            }
+
+            const auto &kernels = internal::kernels<T>();
+            out_.resize(count);
+            kernels.combine(op_, in[0].data(), in[1].data(), count, out_.data());
+            for (std::size_t i = 2; i < N; ++i) {
+                kernels.combine(op_, out_.data(), in[i].data(), count, out_.data());
+            }
+
+            for (std::size_t i = 0; i < N; ++i) {
+                if (held[i]) {
+                    pending_[i].erase(pending_[i].begin(), pending_[i].begin() + static_cast<std::ptrdiff_t>(count));
+                } else {
+                    pending_[i].assign(in[i].begin() + static_cast<std::ptrdiff_t>(count), in[i].end());
+                }
+            }
+            return count == 0 ? poll::empty : poll::ready;
+        }
+
+        auto values() const -> std::span<const T> override {
+            return out_;
+        }
+
+    private:
+        combine_op op_;
+        std::array<batch_input<T>, N> in_;
+        std::array<std::vector<T>, N> pending_;
+        std::vector<T> out_;
+
+        auto save_state(state_writer &writer) const -> void override {
+            for (const auto &pending : pending_) {
+                writer.write_values(std::span<const T>(pending));
+            }
+        }
+
+        auto restore_state(state_reader &reader) -> void override {
+            for (auto &pending : pending_) {
+                pending = reader.read_values<T>();
+            }
+        }
+    };
+}
+
+#endif  // COMP6771_NUMERIC_H
@@ -0,0 +1,276 @@
+#include "./numeric.h"
+#include "./pipeline.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+// Publishes `values`, at most `chunk` of them per poll.
+template <typename T>
+struct vector_source : ppl::batch_source<T> {
+    std::vector<T> values_;
+    std::size_t chunk_;
+    std::size_t next_ = 0;
+    std::span<const T> batch_;
+
+    vector_source(std::vector<T> values, const std::size_t chunk): values_{std::move(values)}, chunk_{chunk} {}
+
+    auto name() const -> std::string override {
+        return "vector_source";
+    }
+
+    auto poll_next_batch(const std::size_t max) -> ppl::poll override {
+        if (next_ == values_.size()) {
+            return ppl::poll::closed;
+        }
+        const auto count = std::min({max, chunk_, values_.size() - next_});
+        batch_ = std::span<const T>(values_).subspan(next_, count);
+        next_ += count;
+        return ppl::poll::ready;
+    }
+
+    auto values() const -> std::span<const T> override {
+        return batch_;
+    }
+};
+
+template <typename T>
+struct vector_sink : ppl::batch_sink<T> {
+    ppl::batch_input<T> in_;
+    std::vector<T> values_;
+
+    auto name() const -> std::string override {
+        return "vector_sink";
+    }
+
+    auto connect(const ppl::node* src, const int) -> void override {
+        in_.connect(src);
+    }
+
+    auto poll_next_batch(const std::size_t) -> ppl::poll override {
+        const auto values = in_.values();
+        values_.insert(values_.end(), values.begin(), values.end());
+        return ppl::poll::ready;
+    }
+};
+
+template <typename T>
+auto iota(const std::size_t n, const T first) -> std::vector<T> {
+    auto values = std::vector<T>();
+    for (std::size_t i = 0; i < n; ++i) {
+        values.push_back(first + static_cast<T>(i * 7 % 11));
+    }
+    return values;
+}
+
+TEMPLATE_TEST_CASE("Testing every kernel level agrees with the scalar kernels", "", float, double, std::int32_t, std::int64_t) {
+    // Long enough for several AVX-512 vectors and a leftover tail.
+    const auto a = iota<TestType>(53, 1);
+    const auto b = iota<TestType>(53, 3);
+    const auto &scalar = ppl::internal::kernels_for<TestType>(ppl::simd_level::scalar);
+
+    for (const auto level : {ppl::simd_level::sse2, ppl::simd_level::avx2, ppl::simd_level::avx512}) {
+        const auto &kernels = ppl::internal::kernels_for<TestType>(level);
+        auto expected = std::vector<TestType>(a.size());
+        auto actual = std::vector<TestType>(a.size());
+
+        scalar.affine(a.data(), a.size(), 3, 2, expected.data());
+        kernels.affine(a.data(), a.size(), 3, 2, actual.data());
+        CHECK(actual == expected);
+
+        for (const auto op : {ppl::combine_op::add, ppl::combine_op::subtract, ppl::combine_op::multiply,
+                ppl::combine_op::min, ppl::combine_op::max}) {
+            scalar.combine(op, a.data(), b.data(), a.size(), expected.data());
+            kernels.combine(op, a.data(), b.data(), a.size(), actual.data());
+            CHECK(actual == expected);
+        }
+
+        for (const auto op : {ppl::window_op::sum, ppl::window_op::min, ppl::window_op::max}) {
+            scalar.window(op, a.data(), a.size() - 4, 5, expected.data());
+            kernels.window(op, a.data(), a.size() - 4, 5, actual.data());
+            CHECK(actual == expected);
+        }
+    }
+}
+
+TEST_CASE("Testing the scalar kernels") {
+    const auto in = std::vector<double>{1, 5, 2, 8, 3};
+    const auto &kernels = ppl::internal::kernels_for<double>(ppl::simd_level::scalar);
+    auto out = std::vector<double>(in.size());
+
+    kernels.affine(in.data(), in.size(), 2, 1, out.data());
+    CHECK(out == std::vector<double>{3, 11, 5, 17, 7});
+    kernels.combine(ppl::combine_op::max, in.data(), std::vector<double>{4, 4, 4, 4, 4}.data(), in.size(), out.data());
+    CHECK(out == std::vector<double>{4, 5, 4, 8, 4});
+
+    out.resize(3);
+    kernels.window(ppl::window_op::sum, in.data(), 3, 3, out.data());
+    CHECK(out == std::vector<double>{8, 15, 13});
+    kernels.window(ppl::window_op::min, in.data(), 3, 3, out.data());
+    CHECK(out == std::vector<double>{1, 2, 2});
+}
+
+TEST_CASE("Testing affine and filter transform whole batches") {
+    auto pipeline = ppl::pipeline{};
+    pipeline.set_batch_size(16);
+    const auto source = pipeline.create_node<vector_source<float>>(iota<float>(100, 0), 100);
+    const auto scale = pipeline.create_node<ppl::affine<float>>(0.5f, 1.0f);
+    const auto predicate = [](const float v) { return v >= 4.0f; };
+    const auto keep = pipeline.create_node<ppl::filter<float, decltype(predicate)>>(predicate);
+    const auto sink = pipeline.create_node<vector_sink<float>>();
+    pipeline.connect(source, scale, 0);
+    pipeline.connect(scale, keep, 0);
+    pipeline.connect(keep, sink, 0);
+    pipeline.run();
+
+    auto expected = std::vector<float>();
+    for (const auto v : iota<float>(100, 0)) {
+        if (v * 0.5f + 1.0f >= 4.0f) {
+            expected.push_back(v * 0.5f + 1.0f);
+        }
+    }
+    CHECK(static_cast<vector_sink<float>*>(pipeline.get_node(sink))->values_ == expected);
+}
+
+TEST_CASE("Testing filter is empty when it drops a whole batch") {
+    auto pipeline = ppl::pipeline{};
+    pipeline.set_batch_size(4);
+    const auto source = pipeline.create_node<vector_source<int>>(std::vector<int>{1, 2, 3, 4, 50, 6}, 4);
+    const auto predicate = [](const int v) { return v > 10; };
+    const auto keep = pipeline.create_node<ppl::filter<int, decltype(predicate)>>(predicate);
+    const auto sink = pipeline.create_node<vector_sink<int>>();
+    pipeline.connect(source, keep, 0);
+    pipeline.connect(keep, sink, 0);
+
+    CHECK_FALSE(pipeline.step());
+    CHECK(static_cast<vector_sink<int>*>(pipeline.get_node(sink))->values_.empty());
+    pipeline.run();
+    CHECK(static_cast<vector_sink<int>*>(pipeline.get_node(sink))->values_ == std::vector<int>{50});
+}
+
+TEST_CASE("Testing sliding_window carries windows across batches") {
+    const auto in = std::vector<std::int64_t>{4, 1, 7, 3, 9, 2, 8, 5, 6};
+    const auto [op, expected] = GENERATE(
+        std::tuple{ppl::window_op::sum, std::vector<std::int64_t>{12, 11, 19, 14, 19, 15, 19}},
+        std::tuple{ppl::window_op::mean, std::vector<std::int64_t>{4, 3, 6, 4, 6, 5, 6}},
+        std::tuple{ppl::window_op::min, std::vector<std::int64_t>{1, 1, 3, 2, 2, 2, 5}},
+        std::tuple{ppl::window_op::max, std::vector<std::int64_t>{7, 7, 9, 9, 9, 8, 8}});
+
+    auto pipeline = ppl::pipeline{};
+    pipeline.set_batch_size(8);
+    // Batches of 2 split most windows across two polls.
+    const auto source = pipeline.create_node<vector_source<std::int64_t>>(in, 2);
+    const auto window = pipeline.create_node<ppl::sliding_window<std::int64_t>>(3, op);
+    const auto sink = pipeline.create_node<vector_sink<std::int64_t>>();
+    pipeline.connect(source, window, 0);
+    pipeline.connect(window, sink, 0);
+
+    // The first batch doesn't fill a window.
+    CHECK_FALSE(pipeline.step());
+    CHECK(static_cast<vector_sink<std::int64_t>*>(pipeline.get_node(sink))->values_.empty());
+    pipeline.run();
+    CHECK(static_cast<vector_sink<std::int64_t>*>(pipeline.get_node(sink))->values_ == expected);
+
+    CHECK_THROWS_AS(ppl::sliding_window<float>(0, ppl::window_op::sum), std::invalid_argument);
+}
+
+TEST_CASE("Testing combine pairs up batches of different sizes") {
+    auto pipeline = ppl::pipeline{};
+    pipeline.set_batch_size(8);
+    const auto a = pipeline.create_node<vector_source<double>>(iota<double>(20, 0), 3);
+    const auto b = pipeline.create_node<vector_source<double>>(iota<double>(40, 100), 5);
+    const auto c = pipeline.create_node<vector_source<double>>(iota<double>(56, 1000), 8);
+    const auto sum = pipeline.create_node<ppl::combine<double, 3>>(ppl::combine_op::add);
+    const auto sink = pipeline.create_node<vector_sink<double>>();
+    pipeline.connect(a, sum, 0);
+    pipeline.connect(b, sum, 1);
+    pipeline.connect(c, sum, 2);
+    pipeline.connect(sum, sink, 0);
+    pipeline.run();
+
+    // Seven polls publish all 20 values from `a`, and 35 and 56 values from the others. The
+    // values `a` had no partner for are left over once it closes.
+    auto expected = std::vector<double>();
+    const auto xs = iota<double>(20, 0);
+    const auto ys = iota<double>(40, 100);
+    const auto zs = iota<double>(56, 1000);
+    for (std::size_t i = 0; i < 20; ++i) {
+        expected.push_back(xs[i] + ys[i] + zs[i]);
+    }
+    CHECK(static_cast<vector_sink<double>*>(pipeline.get_node(sink))->values_ == expected);
+}
+
+TEST_CASE("Testing numeric components fall back to single values next to scalar nodes") {
+    struct scalar_sink : ppl::sink<int> {
+        const ppl::producer<int>* in_ = nullptr;
+        std::vector<int> values_;
+
+        auto name() const -> std::string override {
+            return "scalar_sink";
+        }
+
+        auto connect(const ppl::node* src, const int) -> void override {
+            in_ = static_cast<const ppl::producer<int>*>(src);
+        }
+
+        auto poll_next() -> ppl::poll override {
+            values_.push_back(in_->value());
+            return ppl::poll::ready;
+        }
+    };
+
+    auto pipeline = ppl::pipeline{};
+    pipeline.set_batch_size(8);
+    const auto source = pipeline.create_node<vector_source<int>>(std::vector<int>{1, 2, 3}, 8);
+    const auto scale = pipeline.create_node<ppl::affine<std::int32_t>>(10);
+    const auto sink = pipeline.create_node<scalar_sink>();
+    pipeline.connect(source, scale, 0);
+    pipeline.connect(scale, sink, 0);
+    pipeline.run();
+    CHECK(static_cast<scalar_sink*>(pipeline.get_node(sink))->values_ == std::vector<int>{10, 20, 30});
+}
+
+TEST_CASE("Testing sliding_window keeps its window across a restart") {
+    const auto in = iota<double>(40, 0);
+    const auto build = [&](ppl::pipeline &pipeline) {
+        const auto source = pipeline.create_node<vector_source<double>>(in, 3);
+        const auto window = pipeline.create_node<ppl::sliding_window<double>>(5, ppl::window_op::mean);
+        const auto sink = pipeline.create_node<vector_sink<double>>();
+        pipeline.connect(source, window, 0);
+        pipeline.connect(window, sink, 0);
+        return std::pair{source, sink};
+    };
+
+    auto uninterrupted = ppl::pipeline{};
+    const auto expected_sink = build(uninterrupted).second;
+    uninterrupted.run();
+    const auto &expected = static_cast<vector_sink<double>*>(uninterrupted.get_node(expected_sink))->values_;
+
+    auto log = std::stringstream();
+    auto first = ppl::pipeline{};
+    const auto first_sink = build(first).second;
+    for (auto i = 0; i < 4; ++i) {
+        first.step();
+    }
+    first.checkpoint(log);
+
+    // vector_source has no state of its own, so skip what it had already published.
+    auto second = ppl::pipeline{};
+    const auto [second_source, second_sink] = build(second);
+    CHECK(second.restore(log));
+    static_cast<vector_source<double>*>(second.get_node(second_source))->next_ = 12;
+    second.run();
+
+    auto resumed = static_cast<vector_sink<double>*>(first.get_node(first_sink))->values_;
+    const auto &rest = static_cast<vector_sink<double>*>(second.get_node(second_sink))->values_;
+    resumed.insert(resumed.end(), rest.begin(), rest.end());
+    CHECK(resumed == expected);
+}
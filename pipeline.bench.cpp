@@ -0,0 +1,441 @@
+// Benchmarks for the pipeline. Build with optimisations, e.g.
+//   g++ -std=c++20 -O2 pipeline.bench.cpp pipeline.cpp numeric.cpp -o pipeline.bench
+// Results are printed as CSV rows of benchmark,size,value,unit so that runs can be compared.
+// `./pipeline.bench step/` only runs the benchmarks whose names contain "step/".
+
+#include "./numeric.h"
+#include "./pipeline.h"
+#include "./static_pipeline.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace {
+    // Alternates between having a value and being empty, forever.
+    struct flickering_source : ppl::source<int> {
+        int val_ = 0;
+
+        auto name() const -> std::string override {
+            return "flickering_source";
+        }
+
+        auto poll_next() -> ppl::poll override {
+            val_++;
+            return val_ % 2 == 0 ? ppl::poll::ready : ppl::poll::empty;
+        }
+
+        auto value() const -> const int& override {
+            return val_;
+        }
+    };
+
+    struct sum_component : ppl::component<std::tuple<int, int>, int> {
+        int val_ = 0;
+        const ppl::producer<int>* slot0 = nullptr;
+        const ppl::producer<int>* slot1 = nullptr;
+
+        auto name() const -> std::string override {
+            return "sum_component";
+        }
+
+        auto connect(const ppl::node* src, int slot) -> void override {
+            (slot == 0 ? slot0 : slot1) = static_cast<const ppl::producer<int>*>(src);
+        }
+
+        auto poll_next() -> ppl::poll override {
+            val_ = slot0->value() + slot1->value();
+            return ppl::poll::ready;
+        }
+
+        auto value() const -> const int& override {
+            return val_;
+        }
+    };
+
+    struct forward_component : ppl::component<std::tuple<int>, int> {
+        const ppl::producer<int>* slot0 = nullptr;
+
+        auto name() const -> std::string override {
+            return "forward_component";
+        }
+
+        auto connect(const ppl::node* src, int) -> void override {
+            slot0 = static_cast<const ppl::producer<int>*>(src);
+        }
+
+        auto poll_next() -> ppl::poll override {
+            return ppl::poll::ready;
+        }
+
+        auto value() const -> const int& override {
+            return slot0->value();
+        }
+    };
+
+    struct discard_sink : ppl::sink<int> {
+        auto name() const -> std::string override {
+            return "discard_sink";
+        }
+
+        auto connect(const ppl::node*, int) -> void override {}
+
+        auto poll_next() -> ppl::poll override {
+            return ppl::poll::ready;
+        }
+    };
+
+    // Stores every value it sees, so that the optimiser cannot discard the work feeding it.
+    struct checksum_sink : ppl::sink<int> {
+        const ppl::producer<int>* slot0 = nullptr;
+        volatile int sum_ = 0;
+
+        auto name() const -> std::string override {
+            return "checksum_sink";
+        }
+
+        auto connect(const ppl::node* src, int) -> void override {
+            slot0 = static_cast<const ppl::producer<int>*>(src);
+        }
+
+        auto poll_next() -> ppl::poll override {
+            sum_ = sum_ + slot0->value();
+            return ppl::poll::ready;
+        }
+    };
+
+    // Counts from 1 to `last`, publishing each number once.
+    struct int_payload_source : ppl::source<int> {
+        int val_ = 0;
+        const int last_;
+
+        int_payload_source(const int last): last_{last} {}
+
+        auto name() const -> std::string override {
+            return "int_payload_source";
+        }
+
+        auto poll_next() -> ppl::poll override {
+            if (val_ == last_) {
+                return ppl::poll::closed;
+            }
+            val_++;
+            return ppl::poll::ready;
+        }
+
+        auto value() const -> const int& override {
+            return val_;
+        }
+    };
+
+    // Publishes `last` different 32 character strings.
+    struct string_payload_source : ppl::source<std::string> {
+        std::string val_ = std::string(32, 'a');
+        int count_ = 0;
+        const int last_;
+
+        string_payload_source(const int last): last_{last} {}
+
+        auto name() const -> std::string override {
+            return "string_payload_source";
+        }
+
+        auto poll_next() -> ppl::poll override {
+            if (count_ == last_) {
+                return ppl::poll::closed;
+            }
+            count_++;
+            val_[static_cast<std::size_t>(count_ % 32)] = static_cast<char>('a' + count_ % 26);
+            return ppl::poll::ready;
+        }
+
+        auto value() const -> const std::string& override {
+            return val_;
+        }
+    };
+
+    // Keeps its own copy of each value, as most real components would.
+    template <typename T>
+    struct copy_component : ppl::component<std::tuple<T>, T> {
+        const ppl::producer<T>* slot0 = nullptr;
+        T val_{};
+
+        auto name() const -> std::string override {
+            return "copy_component";
+        }
+
+        auto connect(const ppl::node* src, int) -> void override {
+            slot0 = static_cast<const ppl::producer<T>*>(src);
+        }
+
+        auto poll_next() -> ppl::poll override {
+            val_ = slot0->value();
+            return ppl::poll::ready;
+        }
+
+        auto value() const -> const T& override {
+            return val_;
+        }
+    };
+
+    template <typename T>
+    struct touching_sink : ppl::sink<T> {
+        const ppl::producer<T>* slot0 = nullptr;
+        volatile std::size_t checksum_ = 0;
+
+        auto name() const -> std::string override {
+            return "touching_sink";
+        }
+
+        auto connect(const ppl::node* src, int) -> void override {
+            slot0 = static_cast<const ppl::producer<T>*>(src);
+        }
+
+        auto poll_next() -> ppl::poll override {
+            if constexpr (std::is_same_v<T, std::string>) {
+                checksum_ = checksum_ + slot0->value().size();
+            } else {
+                checksum_ = checksum_ + static_cast<std::size_t>(slot0->value());
+            }
+            return ppl::poll::ready;
+        }
+    };
+
+    // A lattice of `depth` layers of two nodes, each depending on both nodes in the layer above.
+    // There are 2^depth paths from the source to the sinks.
+    auto diamond_lattice(const int depth) -> ppl::pipeline {
+        auto pipeline = ppl::pipeline{};
+        const auto source = pipeline.create_node<flickering_source>();
+        auto layer = std::pair{source, source};
+        for (auto i = 0; i < depth; ++i) {
+            const auto left = pipeline.create_node<sum_component>();
+            const auto right = pipeline.create_node<sum_component>();
+            for (const auto &node : {left, right}) {
+                pipeline.connect(layer.first, node, 0);
+                pipeline.connect(layer.second, node, 1);
+            }
+            layer = {left, right};
+        }
+        pipeline.connect(layer.first, pipeline.create_node<discard_sink>(), 0);
+        pipeline.connect(layer.second, pipeline.create_node<discard_sink>(), 0);
+        return pipeline;
+    }
+
+    // A source, `length` components and a sink, one after the other.
+    auto chain(ppl::pipeline &pipeline, const int length) -> void {
+        auto previous = pipeline.create_node<flickering_source>();
+        for (auto i = 0; i < length; ++i) {
+            const auto next = pipeline.create_node<forward_component>();
+            pipeline.connect(previous, next, 0);
+            previous = next;
+        }
+        pipeline.connect(previous, pipeline.create_node<discard_sink>(), 0);
+    }
+
+    // One source feeding `width` sinks.
+    auto fan_out(const int width) -> ppl::pipeline {
+        auto pipeline = ppl::pipeline{};
+        const auto source = pipeline.create_node<flickering_source>();
+        for (auto i = 0; i < width; ++i) {
+            pipeline.connect(source, pipeline.create_node<discard_sink>(), 0);
+        }
+        return pipeline;
+    }
+
+    // `width` sources, a power of two, summed pairwise down to a single sink.
+    auto fan_in(const int width) -> ppl::pipeline {
+        auto pipeline = ppl::pipeline{};
+        auto layer = std::vector<ppl::pipeline::node_id>{};
+        for (auto i = 0; i < width; ++i) {
+            layer.push_back(pipeline.create_node<flickering_source>());
+        }
+        while (layer.size() > 1) {
+            auto next = std::vector<ppl::pipeline::node_id>{};
+            for (std::size_t i = 0; i < layer.size(); i += 2) {
+                next.push_back(pipeline.create_node<sum_component>());
+                pipeline.connect(layer[i], next.back(), 0);
+                pipeline.connect(layer[i + 1], next.back(), 1);
+            }
+            layer = std::move(next);
+        }
+        pipeline.connect(layer.front(), pipeline.create_node<discard_sink>(), 0);
+        return pipeline;
+    }
+
+    // A source of `values` values, two copying components and a sink.
+    template <typename T, typename Source>
+    auto payload_chain(const int values) -> ppl::pipeline {
+        auto pipeline = ppl::pipeline{};
+        auto previous = pipeline.create_node<Source>(values);
+        for (auto i = 0; i < 2; ++i) {
+            const auto next = pipeline.create_node<copy_component<T>>();
+            pipeline.connect(previous, next, 0);
+            previous = next;
+        }
+        pipeline.connect(previous, pipeline.create_node<touching_sink<T>>(), 0);
+        return pipeline;
+    }
+
+    auto report(const char* benchmark, const long size, const double value, const char* unit) -> void {
+        std::printf("%s,%ld,%.2f,%s\n", benchmark, size, value, unit);
+    }
+
+    template <typename F>
+    auto time_once(F f) -> double {
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    template <typename Pipeline>
+    auto time_steps(Pipeline &pipeline, const int steps) -> double {
+        pipeline.step();
+        const auto start = std::chrono::steady_clock::now();
+        for (auto i = 0; i < steps; ++i) {
+            pipeline.step();
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double, std::nano>(elapsed).count() / steps;
+    }
+}
+
+int main(int argc, char** argv) {
+    const auto selected = [&](const char* benchmark) {
+        return argc < 2 || std::strstr(benchmark, argv[1]) != nullptr;
+    };
+    std::printf("benchmark,size,value,unit\n");
+
+    // The per-step overhead of each shape. Half of these steps propagate poll::empty from the
+    // sources, and every shape should cost about the same per node.
+    if (selected("step/chain")) {
+        for (const auto length : {1, 4, 16, 64, 256, 1024}) {
+            auto pipeline = ppl::pipeline{};
+            chain(pipeline, length);
+            report("step/chain", length, time_steps(pipeline, 1000000 / length), "ns/step");
+        }
+    }
+    if (selected("step/static_chain")) {
+        auto pipeline = ppl::static_pipeline<flickering_source, forward_component, forward_component,
+            forward_component, forward_component, checksum_sink>{};
+        report("step/static_chain", 4, time_steps(pipeline, 1000000), "ns/step");
+    }
+    if (selected("step/fan_out")) {
+        for (const auto width : {1, 4, 16, 64, 256, 1024}) {
+            auto pipeline = fan_out(width);
+            report("step/fan_out", width, time_steps(pipeline, 1000000 / width), "ns/step");
+        }
+    }
+    if (selected("step/fan_in")) {
+        for (const auto width : {2, 4, 16, 64, 256, 1024}) {
+            auto pipeline = fan_in(width);
+            report("step/fan_in", width, time_steps(pipeline, 1000000 / width), "ns/step");
+        }
+    }
+    // There are 2^depth paths from the source to the sinks, but each node is visited once.
+    if (selected("step/diamond")) {
+        for (const auto depth : {1, 4, 16, 64, 256}) {
+            auto pipeline = diamond_lattice(depth);
+            report("step/diamond", depth, time_steps(pipeline, 1000000 / depth), "ns/step");
+        }
+    }
+
+    // Every graph algorithm is iterative, so none of these should overflow even a small stack
+    // (try `ulimit -s 256`), and the cost per operation should stay flat as the graph grows.
+    for (const auto size : {1000, 10000, 100000, 1000000}) {
+        auto pipeline = ppl::pipeline{};
+        auto ids = std::vector<ppl::pipeline::node_id>{};
+        ids.push_back(pipeline.create_node<flickering_source>());
+        for (auto i = 0; i < size; ++i) {
+            ids.push_back(pipeline.create_node<forward_component>());
+        }
+        ids.push_back(pipeline.create_node<discard_sink>());
+
+        const auto connect = time_once([&] {
+            for (std::size_t i = 0; i + 1 < ids.size(); ++i) {
+                pipeline.connect(ids[i], ids[i + 1], 0);
+            }
+        });
+        if (selected("graph/connect")) {
+            report("graph/connect", size, connect / static_cast<double>(ids.size() - 1), "ns/op");
+        }
+        if (selected("graph/is_valid")) {
+            // Removing an edge forces the connectivity check to start again from scratch.
+            const auto middle = ids.size() / 2;
+            pipeline.disconnect(ids[middle], ids[middle + 1]);
+            pipeline.connect(ids[middle], ids[middle + 1], 0);
+            report("graph/is_valid", size, time_once([&] { pipeline.is_valid(); }), "ns/op");
+            report("graph/is_valid_unchanged", size, time_once([&] { pipeline.is_valid(); }), "ns/op");
+        }
+        if (selected("graph/first_step")) {
+            report("graph/first_step", size, time_once([&] { pipeline.step(); }) / size, "ns/node");
+        }
+        if (selected("graph/erase_node")) {
+            const auto erase = time_once([&] {
+                for (const auto &id : ids) {
+                    pipeline.erase_node(id);
+                }
+            });
+            report("graph/erase_node", size, erase / static_cast<double>(ids.size()), "ns/op");
+        }
+    }
+
+    // Every value is copied by two components before reaching the sink.
+    constexpr auto values = 2000000;
+    if (selected("throughput/int")) {
+        auto pipeline = payload_chain<int, int_payload_source>(values);
+        report("throughput/int", values, values / time_once([&] { pipeline.run(); }) * 1e9, "values/s");
+    }
+    if (selected("throughput/string")) {
+        auto pipeline = payload_chain<std::string, string_payload_source>(values);
+        report("throughput/string", values, values / time_once([&] { pipeline.run(); }) * 1e9, "values/s");
+    }
+    // The same chain of ints while recording a trace of its source, and then replaying that trace
+    // in place of a source with nothing to publish.
+    if (selected("trace/")) {
+        auto trace = std::stringstream{};
+        auto recording = payload_chain<int, int_payload_source>(values);
+        recording.record(trace);
+        const auto record = time_once([&] {
+            recording.run();
+            recording.end_trace();
+        });
+        report("trace/record", values, values / record * 1e9, "values/s");
+        auto replaying = payload_chain<int, int_payload_source>(0);
+        replaying.replay(trace);
+        report("trace/replay", values, values / time_once([&] { replaying.run(); }) * 1e9, "values/s");
+    }
+
+    // The numeric kernels at each instruction set level, with the size column holding the level.
+    // Levels the CPU doesn't support report the fastest one it does.
+    constexpr auto batch = std::size_t{4096};
+    auto in = std::vector<float>(batch + 15, 1.5f);
+    auto out = std::vector<float>(batch);
+    for (const auto level : {ppl::simd_level::scalar, ppl::simd_level::sse2, ppl::simd_level::avx2, ppl::simd_level::avx512}) {
+        const auto &kernels = ppl::internal::kernels_for<float>(level);
+        const auto per_value = [&](auto f) {
+            return time_once([&] {
+                for (auto i = 0; i < 1000; ++i) {
+                    f();
+                }
+            }) / (1000.0 * batch);
+        };
+        if (selected("numeric/affine")) {
+            const auto time = per_value([&] { kernels.affine(in.data(), batch, 2.0f, 1.0f, out.data()); });
+            report("numeric/affine", static_cast<long>(level), time, "ns/value");
+        }
+        if (selected("numeric/combine")) {
+            const auto time = per_value([&] { kernels.combine(ppl::combine_op::add, in.data(), in.data() + 1, batch, out.data()); });
+            report("numeric/combine", static_cast<long>(level), time, "ns/value");
+        }
+        if (selected("numeric/window")) {
+            const auto time = per_value([&] { kernels.window(ppl::window_op::max, in.data(), batch, 16, out.data()); });
+            report("numeric/window", static_cast<long>(level), time, "ns/value");
+        }
+    }
+}
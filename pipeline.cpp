@@ -1,103 +1,1568 @@
 #include "./pipeline.h"
 
-auto ppl::internal::dfs_forwards(std::stack<int> &stack, const int &node, std::map<int, bool> &visited, const std::map<int, std::set<int>> &nodes_to_) -> void {
-    visited.at(node) = true;
-    for (const auto &node : nodes_to_.at(node)) {
-        if (!visited.at(node)) {
-            dfs_forwards(stack, node, visited, nodes_to_);
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <exception>
+#include <map>
+#include <new>
+#include <stdexcept>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+ppl::internal::node_table::node_table(std::pmr::memory_resource* resource)
+: nodes{resource}, generations{resource}, inputs{resource}, outputs{resource}, buffers{resource}, partitions{resource}
+, free_slots_{resource}
+, parents_{resource}, ranks_{resource}, cyclic_edges_{resource}, visited_{resource}, forward_{resource}
+, backward_{resource}, work_{resource}, freed_ranks_{resource} {}
+
+auto ppl::internal::node_table::insert(node_ptr n, const std::size_t slots) -> std::size_t {
+    auto index = std::size_t{0};
+    if (!free_slots_.empty()) {
+        index = free_slots_.back();
+        free_slots_.pop_back();
+        nodes[index] = std::move(n);
+    } else {
+        index = nodes.size();
+        if (index + 1 >= std::size_t{1} << index_bits) {
+            throw std::length_error("too many nodes in pipeline");
         }
+        nodes.push_back(std::move(n));
+        generations.push_back(0);
+        partitions.push_back(0);
+        inputs.emplace_back();
+        outputs.emplace_back();
+        ranks_.push_back(0);
+        visited_.push_back(false);
     }
-    stack.push(node);
+    inputs[index].assign(slots, none);
+    outputs[index].clear();
+    partitions[index] = 0;
+    ranks_[index] = next_rank_++;
+    size++;
+
+    unfilled_slots_ += slots;
+    const auto &added = *nodes[index];
+    sources_ += node_access::is_source(added);
+    sinks_ += node_access::is_sink(added);
+    dangling_ += !node_access::is_sink(added);
+    if (!components_stale_) {
+        parents_.resize(nodes.size());
+        parents_[index] = index;
+        components_++;
+    }
+    return index;
 }
 
-auto ppl::internal::dfs_backwards(const int &node, std::map<int, bool> &visited, const std::map<int, std::map<int, int>> nodes_from_) -> void {
-    visited.at(node) = true;
-    for (const auto &slot : nodes_from_.at(node)) {
-        const auto dst = slot.second;
-        if (!visited.at(dst)) {
-            dfs_backwards(dst, visited, nodes_from_);
+auto ppl::internal::node_table::erase(const std::size_t index) -> void {
+    unfilled_slots_ -= static_cast<std::size_t>(std::count(inputs[index].begin(), inputs[index].end(), none));
+    for (const auto &src : inputs[index]) {
+        if (src == none) {
+            continue;
+        }
+        auto &src_outputs = outputs[src];
+        const auto iter = std::find(src_outputs.begin(), src_outputs.end(), index);
+        if (iter != src_outputs.end()) {
+            src_outputs.erase(iter);
+            unlinked(src);
         }
     }
+    for (const auto &dst : outputs[index]) {
+        if (dst == index) {
+            continue;
+        }
+        for (auto &src : inputs[dst]) {
+            if (src == index) {
+                src = none;
+                unfilled_slots_++;
+            }
+        }
+    }
+
+    const auto &erased = *nodes[index];
+    sources_ -= node_access::is_source(erased);
+    sinks_ -= node_access::is_sink(erased);
+    dangling_ -= !node_access::is_sink(erased) && outputs[index].empty();
+    std::erase_if(cyclic_edges_, [&](const auto &edge) { return edge.first == index || edge.second == index; });
+    std::erase_if(buffers, [&](const auto &buffer) { return buffer.src == index || buffer.dst == index; });
+
+    nodes[index].reset();
+    inputs[index].clear();
+    outputs[index].clear();
+    size--;
+    // A slot whose generation would overflow is retired rather than risk reissuing an old ID.
+    if (generations[index] < max_generation) {
+        generations[index]++;
+        free_slots_.push_back(index);
+    }
+
+    components_stale_ = true;
+    reorder_cyclic_edges();
 }
 
-auto ppl::internal::is_connected(const std::map<int, std::unique_ptr<node>> &nodes_, 
-const std::map<int, std::set<int>> &nodes_to_, const std::map<int, std::map<int, int>> &nodes_from_) -> bool {
-    auto visited_forwards = std::map<int, bool>{};
-    auto visited_backwards = std::map<int, bool>{};
-    for (const auto &node : nodes_) {
-        visited_forwards.emplace(node.first, false);
-        visited_backwards.emplace(node.first, false);
+auto ppl::internal::node_table::link(const std::size_t src, const std::size_t dst, const std::size_t slot) -> void {
+    inputs[dst][slot] = src;
+    unfilled_slots_--;
+    auto &src_outputs = outputs[src];
+    if (std::find(src_outputs.begin(), src_outputs.end(), dst) == src_outputs.end()) {
+        if (src_outputs.empty() && !node_access::is_sink(*nodes[src])) {
+            dangling_--;
+        }
+        if (!order_edge(src, dst)) {
+            cyclic_edges_.emplace_back(src, dst);
+        }
+        src_outputs.push_back(dst);
     }
-    auto stack = std::stack<int>{};
-    internal::dfs_forwards(stack, nodes_.begin()->first, visited_forwards, nodes_to_);
-    internal::dfs_backwards(nodes_.begin()->first, visited_backwards, nodes_from_);
-    for (const auto &node : nodes_) {
-        if (!visited_forwards.at(node.first) && !visited_backwards.at(node.first)) {
-            return false;
+    if (!components_stale_) {
+        unite(src, dst);
+    }
+}
+
+auto ppl::internal::node_table::unlink(const std::size_t src, const std::size_t dst) -> void {
+    auto &src_outputs = outputs[src];
+    src_outputs.erase(std::find(src_outputs.begin(), src_outputs.end(), dst));
+    for (auto &input : inputs[dst]) {
+        if (input == src) {
+            input = none;
+            unfilled_slots_++;
         }
     }
-    return true;
+    unlinked(src);
+    std::erase(cyclic_edges_, std::pair{src, dst});
+    std::erase_if(buffers, [&](const auto &buffer) { return buffer.src == src && buffer.dst == dst; });
+    components_stale_ = true;
+    reorder_cyclic_edges();
 }
 
-auto ppl::internal::check_cycle(const int &node, std::map<int, bool> &visited, std::map<int, bool> &in_stack, const std::map<int, std::set<int>> &nodes_to_) -> bool {
-    if (in_stack.at(node)) {
-        return true;
+auto ppl::internal::node_table::is_valid() const -> bool {
+    if (unfilled_slots_ != 0 || dangling_ != 0 || sources_ == 0 || sinks_ == 0 || !cyclic_edges_.empty()) {
+        return false;
     }
-    if (visited.at(node)) {
+    if (components_stale_) {
+        parents_.resize(nodes.size());
+        for (std::size_t i = 0; i < nodes.size(); ++i) {
+            parents_[i] = i;
+        }
+        components_ = size;
+        components_stale_ = false;
+        for (std::size_t i = 0; i < nodes.size(); ++i) {
+            for (const auto &src : inputs[i]) {
+                if (src != none) {
+                    unite(src, i);
+                }
+            }
+        }
+    }
+    return components_ == 1;
+}
+
+auto ppl::internal::node_table::unlinked(const std::size_t src) -> void {
+    if (outputs[src].empty() && !node_access::is_sink(*nodes[src])) {
+        dangling_++;
+    }
+}
+
+auto ppl::internal::node_table::is_cyclic_edge(const std::size_t src, const std::size_t dst) const -> bool {
+    return !cyclic_edges_.empty() && std::find(cyclic_edges_.begin(), cyclic_edges_.end(), std::pair{src, dst}) != cyclic_edges_.end();
+}
+
+// Adds the edge src -> dst to the topological order, unless it would close a cycle.
+// Only the nodes ranked between dst and src are searched and reordered.
+auto ppl::internal::node_table::order_edge(const std::size_t src, const std::size_t dst) -> bool {
+    if (src == dst) {
         return false;
     }
-    visited.at(node) = true;
-    in_stack.at(node) = true;
-    for (const auto v : nodes_to_.at(node)) {
-        if (check_cycle(v, visited, in_stack, nodes_to_)) {
+    const auto lower = ranks_[dst];
+    const auto upper = ranks_[src];
+    if (lower > upper) {
+        return true;
+    }
+
+    const auto unvisit = [&](const std::pmr::vector<std::size_t> &list) {
+        for (const auto &n : list) {
+            visited_[n] = false;
+        }
+    };
+
+    // Everything reachable from dst that is ranked before src.
+    forward_.clear();
+    work_.assign(1, dst);
+    visited_[dst] = true;
+    while (!work_.empty()) {
+        const auto n = work_.back();
+        work_.pop_back();
+        forward_.push_back(n);
+        for (const auto &m : outputs[n]) {
+            if (is_cyclic_edge(n, m)) {
+                continue;
+            }
+            if (m == src) {
+                unvisit(forward_);
+                unvisit(work_);
+                return false;
+            }
+            if (!visited_[m] && ranks_[m] < upper) {
+                visited_[m] = true;
+                work_.push_back(m);
+            }
+        }
+    }
+
+    // Everything that reaches src that is ranked after dst.
+    backward_.clear();
+    work_.assign(1, src);
+    visited_[src] = true;
+    while (!work_.empty()) {
+        const auto n = work_.back();
+        work_.pop_back();
+        backward_.push_back(n);
+        for (const auto &m : inputs[n]) {
+            if (m != none && !visited_[m] && ranks_[m] > lower && !is_cyclic_edge(m, n)) {
+                visited_[m] = true;
+                work_.push_back(m);
+            }
+        }
+    }
+
+    // Reuse the same ranks, but put everything that reaches src before everything dst reaches.
+    const auto by_rank = [&](const std::size_t a, const std::size_t b) { return ranks_[a] < ranks_[b]; };
+    std::sort(forward_.begin(), forward_.end(), by_rank);
+    std::sort(backward_.begin(), backward_.end(), by_rank);
+    freed_ranks_.clear();
+    for (const auto &list : {std::cref(backward_), std::cref(forward_)}) {
+        for (const auto &n : list.get()) {
+            freed_ranks_.push_back(ranks_[n]);
+        }
+    }
+    std::sort(freed_ranks_.begin(), freed_ranks_.end());
+    auto next = freed_ranks_.begin();
+    for (const auto &list : {std::cref(backward_), std::cref(forward_)}) {
+        for (const auto &n : list.get()) {
+            ranks_[n] = *next++;
+            visited_[n] = false;
+        }
+    }
+    return true;
+}
+
+// Removing an edge may have broken the cycles that the set-aside edges would have closed.
+auto ppl::internal::node_table::reorder_cyclic_edges() -> void {
+    auto i = std::size_t{0};
+    while (i < cyclic_edges_.size()) {
+        const auto edge = cyclic_edges_[i];
+        cyclic_edges_.erase(cyclic_edges_.begin() + static_cast<std::ptrdiff_t>(i));
+        if (!order_edge(edge.first, edge.second)) {
+            cyclic_edges_.insert(cyclic_edges_.begin() + static_cast<std::ptrdiff_t>(i), edge);
+            i++;
+        }
+    }
+}
+
+auto ppl::internal::node_table::find(std::size_t index) const -> std::size_t {
+    while (parents_[index] != index) {
+        parents_[index] = parents_[parents_[index]];
+        index = parents_[index];
+    }
+    return index;
+}
+
+auto ppl::internal::node_table::unite(const std::size_t a, const std::size_t b) const -> void {
+    const auto root_a = find(a);
+    const auto root_b = find(b);
+    if (root_a != root_b) {
+        parents_[root_a] = root_b;
+        components_--;
+    }
+}
+
+auto ppl::internal::dfs_forwards(std::pmr::vector<std::size_t> &order, const std::size_t node, dfs_stack &stack, const node_table &table) -> void {
+    stack.visited[node] = true;
+    stack.frames.emplace_back(node, 0);
+    while (!stack.frames.empty()) {
+        auto &[current, next] = stack.frames.back();
+        const auto &outputs = table.outputs[current];
+        if (next == outputs.size()) {
+            order.push_back(current);
+            stack.frames.pop_back();
+            continue;
+        }
+        const auto dst = outputs[next++];
+        if (!stack.visited[dst]) {
+            stack.visited[dst] = true;
+            stack.frames.emplace_back(dst, 0);
+        }
+    }
+}
+
+auto ppl::internal::topological_sort(const node_table &table, dfs_stack &stack) -> std::pmr::vector<std::size_t> {
+    auto order = std::pmr::vector<std::size_t>(table.resource());
+    order.reserve(table.size);
+    stack.visited.assign(table.nodes.size(), false);
+    for (std::size_t i = 0; i < table.nodes.size(); ++i) {
+        if (table.nodes[i] != nullptr && !stack.visited[i]) {
+            dfs_forwards(order, i, stack, table);
+        }
+    }
+    return order;
+}
+
+auto ppl::internal::step_buffered(execution_plan &plan) -> void {
+    for (std::size_t i = 0; i < plan.nodes.size(); ++i) {
+        // A buffered input is ready while it holds values, even if its producer is not.
+        const auto any = node_access::multirate_of(*plan.nodes[i]);
+        auto status = first_status(any);
+        auto fresh = std::uint64_t{0};
+        for (auto j = plan.upstream_offsets[i]; j < plan.upstream_offsets[i + 1]; ++j) {
+            const auto [src, slot] = plan.upstream[j];
+            const auto buffer = plan.upstream_buffers[j];
+            auto input = plan.polls[src];
+            if (buffer != nullptr) {
+                input = !buffer->channel->empty() ? poll::ready : input == poll::closed ? poll::closed : poll::empty;
+            }
+            status = fold_status(any, status, input);
+            fresh |= input == poll::ready ? std::uint64_t{1} << slot : 0;
+        }
+        status = last_status(any, status);
+
+        const auto outputs = std::span(plan.output_buffers).subspan(plan.output_buffer_offsets[i],
+            plan.output_buffer_offsets[i + 1] - plan.output_buffer_offsets[i]);
+        if (status == poll::ready) {
+            for (const auto &buffer : outputs) {
+                if (buffer->full()) {
+                    buffer->stats.throttled++;
+                    status = poll::empty;
+                }
+            }
+        }
+
+        if (status == poll::ready) {
+            for (auto j = plan.upstream_offsets[i]; j < plan.upstream_offsets[i + 1]; ++j) {
+                const auto buffer = plan.upstream_buffers[j];
+                // Several slots may share a buffer, but they all take the same value.
+                const auto first = std::find(plan.upstream_buffers.begin() + static_cast<std::ptrdiff_t>(plan.upstream_offsets[i]),
+                    plan.upstream_buffers.begin() + static_cast<std::ptrdiff_t>(j), buffer);
+                if (buffer != nullptr && first == plan.upstream_buffers.begin() + static_cast<std::ptrdiff_t>(j)) {
+                    buffer->channel->try_pop();
+                }
+            }
+            if (any != nullptr) {
+                node_access::set_fresh(*any, fresh);
+            }
+            status = poll_node(*plan.nodes[i], plan.batch_sizes[i]);
+            if (status == poll::ready) {
+                for (const auto &buffer : outputs) {
+                    buffer->channel->try_push(plan.nodes[i]);
+                    buffer->stats.pushed++;
+                    buffer->stats.peak = std::max(buffer->stats.peak, buffer->channel->size());
+                }
+            }
+        }
+        plan.polls[i] = status;
+    }
+}
+
+auto ppl::internal::fused_chains(const node_table &table, std::pmr::memory_resource* resource)
+-> std::pmr::vector<std::pmr::vector<std::size_t>> {
+    const auto is_component = [&](const std::size_t index) {
+        return !node_access::is_source(*table.nodes[index]) && !node_access::is_sink(*table.nodes[index]);
+    };
+    // Whether index -> outputs[index][0] can be fused.
+    const auto fuses_forwards = [&](const std::size_t index) {
+        if (!is_component(index) || table.outputs[index].size() != 1) {
+            return false;
+        }
+        const auto next = table.outputs[index].front();
+        // A multirate may be polled when its input isn't ready, so it can only start a chain.
+        return next != index && is_component(next) && table.inputs[next].size() == 1
+            && node_access::multirate_of(*table.nodes[next]) == nullptr;
+    };
+    const auto fuses_backwards = [&](const std::size_t index) {
+        const auto &inputs = table.inputs[index];
+        return inputs.size() == 1 && inputs.front() != node_table::none && fuses_forwards(inputs.front());
+    };
+
+    auto chains = std::pmr::vector<std::pmr::vector<std::size_t>>(resource);
+    for (std::size_t i = 0; i < table.nodes.size(); ++i) {
+        if (table.nodes[i] == nullptr || fuses_backwards(i) || !fuses_forwards(i)) {
+            continue;
+        }
+        auto &chain = chains.emplace_back();
+        chain.push_back(i);
+        while (fuses_forwards(chain.back())) {
+            chain.push_back(table.outputs[chain.back()].front());
+        }
+    }
+    return chains;
+}
+
+auto ppl::internal::compile_plan(node_table &table, const std::size_t batch_size, dfs_stack &stack) -> execution_plan {
+    const auto resource = table.resource();
+    auto plan = execution_plan(resource);
+    auto order = topological_sort(table, stack);
+    std::reverse(order.begin(), order.end());
+
+    // Move the rest of each fused chain up behind its head. Since each of them depends only on
+    // the node before it, the order stays topological.
+    const auto chains = fused_chains(table, resource);
+    auto chain_of = std::pmr::vector<std::size_t>(table.nodes.size(), node_table::none, resource);
+    for (std::size_t c = 0; c < chains.size(); ++c) {
+        for (const auto &member : chains[c]) {
+            chain_of[member] = c;
+        }
+    }
+    auto fused_order = std::pmr::vector<std::size_t>(resource);
+    fused_order.reserve(order.size());
+    plan.unit_offsets.push_back(0);
+    for (const auto &node_index : order) {
+        const auto c = chain_of[node_index];
+        if (c == node_table::none) {
+            fused_order.push_back(node_index);
+        } else if (chains[c].front() == node_index) {
+            fused_order.insert(fused_order.end(), chains[c].begin(), chains[c].end());
+        } else {
+            continue;
+        }
+        plan.unit_offsets.push_back(fused_order.size());
+    }
+    order = std::move(fused_order);
+
+    auto index = std::pmr::vector<std::size_t>(table.nodes.size(), node_table::none, resource);
+    for (std::size_t i = 0; i < order.size(); ++i) {
+        index[order[i]] = i;
+    }
+
+    plan.nodes.reserve(order.size());
+    plan.slots.reserve(order.size());
+    plan.downstream_offsets.reserve(order.size() + 1);
+    plan.downstream_offsets.push_back(0);
+    plan.upstream_offsets.reserve(order.size() + 1);
+    plan.upstream_offsets.push_back(0);
+    const auto buffered = !table.buffers.empty();
+    if (buffered) {
+        plan.output_buffer_offsets.push_back(0);
+    }
+    for (const auto &node_index : order) {
+        const auto &node = table.nodes[node_index];
+        if (node_access::is_sink(*node)) {
+            plan.sinks.push_back(plan.nodes.size());
+        }
+        plan.nodes.push_back(node.get());
+        plan.slots.push_back(node_index);
+        for (const auto &dst : table.outputs[node_index]) {
+            plan.downstream.push_back(index[dst]);
+        }
+        plan.downstream_offsets.push_back(plan.downstream.size());
+        const auto &inputs = table.inputs[node_index];
+        for (std::size_t slot = 0; slot < inputs.size(); ++slot) {
+            if (inputs[slot] != node_table::none) {
+                plan.upstream.emplace_back(index[inputs[slot]], static_cast<int>(slot));
+                if (buffered) {
+                    plan.upstream_buffers.push_back(table.buffer(inputs[slot], node_index));
+                }
+            }
+        }
+        plan.upstream_offsets.push_back(plan.upstream.size());
+        if (buffered) {
+            for (const auto &dst : table.outputs[node_index]) {
+                if (const auto buffer = table.buffer(node_index, dst); buffer != nullptr) {
+                    plan.output_buffers.push_back(buffer);
+                }
+            }
+            plan.output_buffer_offsets.push_back(plan.output_buffers.size());
+        }
+    }
+    plan.polls.assign(plan.nodes.size(), poll::ready);
+
+    // A node polled for one value at a time can only be fed one value at a time, so scalar mode
+    // spreads upstream from every node that can't take batches. It never spreads downstream,
+    // since batch_input reads a scalar producer as a batch of one.
+    auto batched = std::pmr::vector<bool>(resource);
+    for (const auto &node : plan.nodes) {
+        batched.push_back(node_access::is_batched(*node));
+    }
+    // Buffers hold single values, as do the rings between partitions.
+    for (const auto &buffer : table.buffers) {
+        batched[index[buffer.src]] = false;
+    }
+    for (const auto &node_index : order) {
+        for (const auto &dst : table.outputs[node_index]) {
+            if (table.partitions[node_index] != table.partitions[dst]) {
+                batched[index[node_index]] = false;
+            }
+        }
+    }
+    auto scalar = std::pmr::vector<std::size_t>(resource);
+    for (std::size_t i = 0; i < plan.nodes.size(); ++i) {
+        if (!batched[i]) {
+            scalar.push_back(i);
+        }
+    }
+    while (!scalar.empty()) {
+        const auto i = scalar.back();
+        scalar.pop_back();
+        for (auto j = plan.upstream_offsets[i]; j < plan.upstream_offsets[i + 1]; ++j) {
+            const auto src = plan.upstream[j].first;
+            if (batched[src]) {
+                batched[src] = false;
+                scalar.push_back(src);
+            }
+        }
+    }
+    for (const auto is_batched : batched) {
+        plan.batch_sizes.push_back(is_batched ? batch_size : 1);
+    }
+
+    plan.indegrees.assign(plan.nodes.size(), 0);
+    for (const auto &dst : plan.downstream) {
+        plan.indegrees[dst]++;
+    }
+    // A cyclic graph has nodes that no topological order can reach.
+    auto pending = std::pmr::vector<std::size_t>(plan.indegrees, resource);
+    auto ready = std::pmr::vector<std::size_t>(resource);
+    for (std::size_t i = 0; i < plan.nodes.size(); ++i) {
+        if (pending[i] == 0) {
+            ready.push_back(i);
+        }
+    }
+    auto reached = std::size_t{0};
+    while (!ready.empty()) {
+        const auto i = ready.back();
+        ready.pop_back();
+        reached++;
+        for (auto j = plan.downstream_offsets[i]; j < plan.downstream_offsets[i + 1]; ++j) {
+            if (--pending[plan.downstream[j]] == 0) {
+                ready.push_back(plan.downstream[j]);
+            }
+        }
+    }
+    plan.acyclic = reached == plan.nodes.size();
+    return plan;
+}
+
+namespace {
+    // The state of one node while the pipeline runs in parallel.
+    struct parallel_node {
+        std::vector<ppl::internal::edge_channel*> inputs;
+        // The slot each input is connected to.
+        std::vector<int> slots;
+        std::vector<ppl::internal::edge_channel*> outputs;
+        bool done = false;
+    };
+}
+
+auto ppl::internal::run_parallel(execution_plan &plan, const std::size_t threads, const std::size_t channel_capacity) -> void {
+    const auto size = plan.nodes.size();
+    if (plan.sinks.empty()) {
+        return;
+    }
+
+    // Put a channel on every edge, and connect each consumer to its channels instead of its producers.
+    auto channels = std::vector<std::unique_ptr<edge_channel>>{};
+    auto states = std::vector<parallel_node>(size);
+    for (std::size_t dst = 0; dst < size; ++dst) {
+        for (auto i = plan.upstream_offsets[dst]; i < plan.upstream_offsets[dst + 1]; ++i) {
+            const auto [src, slot] = plan.upstream[i];
+            channels.push_back(node_access::make_channel(*plan.nodes[src], channel_capacity));
+            states[src].outputs.push_back(channels.back().get());
+            states[dst].inputs.push_back(channels.back().get());
+            states[dst].slots.push_back(slot);
+            node_access::connect(*plan.nodes[dst], channels.back()->as_node(), slot);
+        }
+    }
+
+    auto stop = std::atomic<bool>{false};
+    auto sinks_done = std::atomic<std::size_t>{0};
+    auto error = std::exception_ptr{};
+    auto error_mutex = std::mutex{};
+
+    const auto finish = [&](const std::size_t i) {
+        states[i].done = true;
+        for (const auto &channel : states[i].outputs) {
+            channel->close();
+        }
+        if (node_access::is_sink(*plan.nodes[i]) && sinks_done.fetch_add(1) + 1 == plan.sinks.size()) {
+            stop.store(true);
+        }
+    };
+
+    // Polls node i if a value is waiting on every input (or any, for a multirate) and there is
+    // room on every output. Returns whether any progress was made.
+    const auto try_fire = [&](const std::size_t i) -> bool {
+        auto &state = states[i];
+        if (state.done) {
+            return false;
+        }
+        const auto any = node_access::multirate_of(*plan.nodes[i]);
+        auto status = first_status(any);
+        auto fresh = std::uint64_t{0};
+        for (std::size_t j = 0; j < state.inputs.size(); ++j) {
+            // The closed flag is published after the last push, so check for a value after it.
+            const auto closed = state.inputs[j]->is_closed();
+            const auto input = !state.inputs[j]->empty() ? poll::ready : closed ? poll::closed : poll::empty;
+            status = fold_status(any, status, input);
+            fresh |= input == poll::ready ? std::uint64_t{1} << state.slots[j] : 0;
+        }
+        status = last_status(any, status);
+        if (status == poll::closed) {
+            finish(i);
             return true;
         }
+        if (status == poll::empty) {
+            return false;
+        }
+        for (const auto &channel : state.outputs) {
+            if (channel->full()) {
+                return false;
+            }
+        }
+        for (std::size_t j = 0; j < state.inputs.size(); ++j) {
+            if ((fresh >> state.slots[j]) & 1) {
+                state.inputs[j]->try_pop();
+            }
+        }
+        if (any != nullptr) {
+            node_access::set_fresh(*any, fresh);
+        }
+        switch (poll_node(*plan.nodes[i], 1)) {
+            case poll::ready:
+                for (const auto &channel : state.outputs) {
+                    channel->try_push(plan.nodes[i]);
+                }
+                return true;
+            case poll::empty:
+                return !state.inputs.empty();
+            case poll::closed:
+                finish(i);
+                return true;
+        }
+        return false;
+    };
+
+    auto count = threads == 0 ? std::max(std::thread::hardware_concurrency(), 1u) : threads;
+    count = std::min(count, size);
+    auto workers = std::vector<std::thread>{};
+    for (std::size_t worker = 0; worker < count; ++worker) {
+        workers.emplace_back([&, worker] {
+            try {
+                while (!stop.load(std::memory_order_relaxed)) {
+                    auto progress = false;
+                    for (auto i = worker; i < size; i += count) {
+                        progress = try_fire(i) || progress;
+                    }
+                    if (!progress) {
+                        std::this_thread::yield();
+                    }
+                }
+            } catch (...) {
+                const auto lock = std::lock_guard{error_mutex};
+                if (!error) {
+                    error = std::current_exception();
+                }
+                stop.store(true);
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    for (std::size_t dst = 0; dst < size; ++dst) {
+        for (auto i = plan.upstream_offsets[dst]; i < plan.upstream_offsets[dst + 1]; ++i) {
+            const auto [src, slot] = plan.upstream[i];
+            const auto buffer = plan.upstream_buffers.empty() ? nullptr : plan.upstream_buffers[i];
+            node_access::connect(*plan.nodes[dst], buffer == nullptr ? plan.nodes[src] : buffer->channel->as_node(), slot);
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+ppl::internal::work_stealing_pool::work_stealing_pool(const std::size_t threads) {
+    for (std::size_t i = 0; i < std::max(threads, std::size_t{1}); ++i) {
+        queues_.push_back(std::make_unique<queue>());
+    }
+    for (std::size_t worker = 1; worker < queues_.size(); ++worker) {
+        workers_.emplace_back([this, worker] {
+            auto seen = std::size_t{0};
+            while (true) {
+                {
+                    auto lock = std::unique_lock{mutex_};
+                    wake_.wait(lock, [&] { return shutdown_ || epoch_ != seen; });
+                    if (shutdown_) {
+                        return;
+                    }
+                    seen = epoch_;
+                }
+                work(worker);
+                busy_.fetch_sub(1, std::memory_order_release);
+            }
+        });
     }
-    in_stack.at(node) = false;
-    return false;
 }
 
-auto ppl::internal::has_cycle(const std::map<int, std::unique_ptr<node>> &nodes_, const std::map<int, std::set<int>> &nodes_to_) -> bool {
-    auto visited = std::map<int, bool>{};
-    auto in_stack = std::map<int, bool>{};
-    for (const auto &node : nodes_) {
-        visited.emplace(node.first, false);
-        in_stack.emplace(node.first, false);
+ppl::internal::work_stealing_pool::~work_stealing_pool() noexcept {
+    {
+        const auto lock = std::lock_guard{mutex_};
+        shutdown_ = true;
+    }
+    wake_.notify_all();
+    for (auto &worker : workers_) {
+        worker.join();
     }
-    for (const auto &node : nodes_) {
-        if (check_cycle(node.first, visited, in_stack, nodes_to_)) {
+}
+
+auto ppl::internal::work_stealing_pool::run_step(execution_plan &plan) -> void {
+    const auto size = plan.nodes.size();
+    if (pending_size_ != size) {
+        pending_ = std::make_unique<std::atomic<std::size_t>[]>(size);
+        pending_size_ = size;
+        for (auto &worker_queue : queues_) {
+            worker_queue->tasks.reserve(size);
+        }
+    }
+    plan_ = &plan;
+    error_ = nullptr;
+    failed_.store(false, std::memory_order_relaxed);
+    remaining_.store(size, std::memory_order_relaxed);
+    auto next = std::size_t{0};
+    for (std::size_t i = 0; i < size; ++i) {
+        pending_[i].store(plan.indegrees[i], std::memory_order_relaxed);
+        if (plan.indegrees[i] == 0) {
+            push(next++ % queues_.size(), i);
+        }
+    }
+
+    {
+        const auto lock = std::lock_guard{mutex_};
+        busy_.store(workers_.size(), std::memory_order_relaxed);
+        epoch_++;
+    }
+    wake_.notify_all();
+    work(0);
+    while (busy_.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+
+    if (error_) {
+        for (auto &worker_queue : queues_) {
+            worker_queue->tasks.clear();
+            worker_queue->head = 0;
+        }
+        std::rethrow_exception(error_);
+    }
+}
+
+auto ppl::internal::work_stealing_pool::work(const std::size_t worker) -> void {
+    auto task = std::size_t{0};
+    while (remaining_.load(std::memory_order_acquire) != 0 && !failed_.load(std::memory_order_relaxed)) {
+        if (pop(worker, task) || steal(worker, task)) {
+            try {
+                execute(worker, task);
+            } catch (...) {
+                const auto lock = std::lock_guard{mutex_};
+                if (!error_) {
+                    error_ = std::current_exception();
+                }
+                failed_.store(true);
+            }
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+auto ppl::internal::work_stealing_pool::execute(const std::size_t worker, const std::size_t task) -> void {
+    auto &plan = *plan_;
+    auto status = input_status(plan, task);
+    if (status == poll::ready) {
+        status = poll_node(*plan.nodes[task], plan.batch_sizes[task]);
+    }
+    plan.polls[task] = status;
+
+    for (auto i = plan.downstream_offsets[task]; i < plan.downstream_offsets[task + 1]; ++i) {
+        const auto dst = plan.downstream[i];
+        if (pending_[dst].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            push(worker, dst);
+        }
+    }
+    remaining_.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+auto ppl::internal::work_stealing_pool::push(const std::size_t worker, const std::size_t task) -> void {
+    const auto lock = std::lock_guard{queues_[worker]->mutex};
+    queues_[worker]->tasks.push_back(task);
+}
+
+auto ppl::internal::work_stealing_pool::pop(const std::size_t worker, std::size_t &task) -> bool {
+    auto &own = *queues_[worker];
+    const auto lock = std::lock_guard{own.mutex};
+    if (own.head == own.tasks.size()) {
+        return false;
+    }
+    task = own.tasks.back();
+    own.tasks.pop_back();
+    if (own.head == own.tasks.size()) {
+        own.tasks.clear();
+        own.head = 0;
+    }
+    return true;
+}
+
+auto ppl::internal::work_stealing_pool::steal(const std::size_t worker, std::size_t &task) -> bool {
+    for (std::size_t i = 1; i < queues_.size(); ++i) {
+        auto &victim = *queues_[(worker + i) % queues_.size()];
+        const auto lock = std::lock_guard{victim.mutex};
+        if (victim.head != victim.tasks.size()) {
+            task = victim.tasks[victim.head++];
+            if (victim.head == victim.tasks.size()) {
+                victim.tasks.clear();
+                victim.head = 0;
+            }
             return true;
         }
     }
     return false;
 }
 
-auto ppl::internal::topological_sort(const std::map<int, std::unique_ptr<node>> &nodes_, const std::map<int, std::set<int>> &nodes_to_) -> std::stack<int> {
-    auto stack = std::stack<int>{};
-    auto visited = std::map<int, bool>{};
+// A checkpoint stream is a sequence of records, each of which is
+//   magic, sequence number, body size, body, hash of body
+// and whose body is
+//   whether the topology follows, [topology], (slot index, state)...
+// A record with a topology holds every node with any state, so reading can start from there.
+namespace {
+    constexpr auto checkpoint_magic = std::uint32_t{0x4b4c5050};
+
+    auto fnv1a(const std::string_view bytes) -> std::uint64_t {
+        auto hash = std::uint64_t{14695981039346656037u};
+        for (const auto c : bytes) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211u;
+        }
+        return hash;
+    }
+
+    auto describe_topology(const ppl::internal::node_table &table, ppl::state_writer &writer) -> void {
+        writer.write(table.nodes.size());
+        for (std::size_t i = 0; i < table.nodes.size(); ++i) {
+            writer.write(table.nodes[i] != nullptr);
+            if (table.nodes[i] != nullptr) {
+                writer.write_string(table.nodes[i]->name());
+                writer.write(table.inputs[i].size());
+                for (const auto &src : table.inputs[i]) {
+                    writer.write(src);
+                }
+            }
+        }
+    }
+
+    // Appends a record to `os`, using `scratch` for its header.
+    auto write_record(std::ostream &os, const std::uint32_t magic, const std::uint64_t key, const std::string_view body,
+        ppl::state_writer &scratch) -> void {
+        scratch.clear();
+        scratch.write(magic);
+        scratch.write(key);
+        scratch.write(static_cast<std::uint64_t>(body.size()));
+        const auto header = scratch.bytes();
+        const auto hash = fnv1a(body);
+        os.write(header.data(), static_cast<std::streamsize>(header.size()));
+        os.write(body.data(), static_cast<std::streamsize>(body.size()));
+        os.write(reinterpret_cast<const char*>(&hash), sizeof(hash));
+    }
+
+    // Reads the next record's body, or returns false if the stream ends before a whole record.
+    // A record with the wrong magic number throws `error`.
+    auto read_record(std::istream &is, const std::uint32_t expected, const ppl::pipeline_error_kind error,
+        std::uint64_t &key, std::string &body) -> bool {
+        auto magic = std::uint32_t{0};
+        auto size = std::uint64_t{0};
+        auto hash = std::uint64_t{0};
+        if (!is.read(reinterpret_cast<char*>(&magic), sizeof(magic))) {
+            return false;
+        }
+        if (magic != expected) {
+            throw ppl::pipeline_error(error);
+        }
+        if (!is.read(reinterpret_cast<char*>(&key), sizeof(key)) || !is.read(reinterpret_cast<char*>(&size), sizeof(size))) {
+            return false;
+        }
+        // Read in pieces, so that a corrupt size can't ask for more memory than the stream holds.
+        body.clear();
+        auto chunk = std::array<char, 4096>{};
+        while (body.size() < size) {
+            const auto want = std::min<std::uint64_t>(chunk.size(), size - body.size());
+            if (!is.read(chunk.data(), static_cast<std::streamsize>(want))) {
+                return false;
+            }
+            body.append(chunk.data(), want);
+        }
+        return is.read(reinterpret_cast<char*>(&hash), sizeof(hash)) && hash == fnv1a(body);
+    }
+}
+
+auto ppl::internal::write_checkpoint(const node_table &table, checkpoint_log &log, std::ostream &os, const bool complete) -> void {
+    auto &body = log.body;
+    body.clear();
+    log.scratch.clear();
+    describe_topology(table, log.scratch);
+    const auto topology_hash = fnv1a(log.scratch.bytes()) | 1;
+    const auto full = complete || topology_hash != log.topology_hash;
+    body.write(full);
+    if (full) {
+        body.write_string(log.scratch.bytes());
+    }
+
+    log.state_hashes.resize(table.nodes.size(), fnv1a({}));
+    for (std::size_t i = 0; i < table.nodes.size(); ++i) {
+        if (table.nodes[i] == nullptr) {
+            continue;
+        }
+        log.scratch.clear();
+        node_access::save_state(*table.nodes[i], log.scratch);
+        const auto hash = fnv1a(log.scratch.bytes());
+        if (full ? !log.scratch.bytes().empty() : hash != log.state_hashes[i]) {
+            body.write(i);
+            body.write_string(log.scratch.bytes());
+        }
+        log.state_hashes[i] = hash;
+    }
 
-    for (const auto &node : nodes_) {
-        visited.emplace(node.first, false);
+    write_record(os, checkpoint_magic, log.sequence + 1, body.bytes(), log.scratch);
+    if (!os) {
+        throw std::ios_base::failure("could not write checkpoint");
     }
+    log.sequence++;
+    log.topology_hash = topology_hash;
+}
 
-    for (const auto &node : nodes_) {
-        if (!visited.at(node.first)) {
-            dfs_forwards(stack, node.first, visited, nodes_to_);
+auto ppl::internal::read_checkpoint(node_table &table, checkpoint_log &log, std::istream &is) -> bool {
+    // Everything is read and checked before any node is touched.
+    auto topology = std::string();
+    auto states = std::map<std::size_t, std::string>();
+    auto sequence = std::uint64_t{0};
+    auto record_sequence = std::uint64_t{0};
+    auto body = std::string();
+    auto found = false;
+    while (read_record(is, checkpoint_magic, pipeline_error_kind::invalid_checkpoint, record_sequence, body)) {
+        sequence = record_sequence;
+        auto reader = state_reader(body);
+        if (reader.read<bool>()) {
+            topology = reader.read_string();
+            states.clear();
+            found = true;
+        } else if (!found) {
+            // The stream starts partway through a run of checkpoints.
+            throw pipeline_error(pipeline_error_kind::invalid_checkpoint);
+        }
+        while (!reader.empty()) {
+            const auto index = reader.read<std::size_t>();
+            states[index] = reader.read_string();
         }
     }
+    if (!found) {
+        return false;
+    }
 
-    return stack;
+    log.scratch.clear();
+    describe_topology(table, log.scratch);
+    if (log.scratch.bytes() != topology) {
+        throw pipeline_error(pipeline_error_kind::invalid_checkpoint);
+    }
+    for (const auto &[index, state] : states) {
+        if (index >= table.nodes.size() || table.nodes[index] == nullptr) {
+            throw pipeline_error(pipeline_error_kind::invalid_checkpoint);
+        }
+    }
+    for (const auto &[index, state] : states) {
+        auto reader = state_reader(state);
+        node_access::restore_state(*table.nodes[index], reader);
+    }
+    log.sequence = sequence;
+    log.topology_hash = 0;
+    return true;
 }
 
-auto ppl::internal::update_poll(const std::set<int> &node_list, const poll status, std::map<int, poll> &node_polls_, const std::map<int, std::set<int>> &nodes_to_) -> void {
-    for (const auto &node : node_list) {
-        if (node_polls_.contains(node)) {
-            if (node_polls_.at(node) != poll::closed) {
-                node_polls_.at(node) = status;
+// A trace is a sequence of records in the same format as a checkpoint's, but keyed by slot
+// index rather than by sequence number. The first record has no slot index, and holds the
+// topology of the pipeline. Each of the rest holds the next few polls of the source in the
+// given slot, as logged by internal::traced_source.
+namespace {
+    constexpr auto trace_magic = std::uint32_t{0x54504c50};
+    // A source's polls are written out once this many bytes of them have built up.
+    constexpr auto trace_flush_bytes = std::size_t{1} << 16;
+
+    // Connects the consumers of the node in `index` to `n`, except through buffered edges.
+    auto connect_consumers(const ppl::internal::node_table &table, const std::size_t index, const ppl::node* n) -> void {
+        for (const auto &dst : table.outputs[index]) {
+            if (table.buffer(index, dst) != nullptr) {
+                continue;
+            }
+            for (std::size_t slot = 0; slot < table.inputs[dst].size(); ++slot) {
+                if (table.inputs[dst][slot] == index) {
+                    ppl::internal::node_access::connect(*table.nodes[dst], n, static_cast<int>(slot));
+                }
+            }
+        }
+    }
+
+    // Swaps the source in `index` for `stand_in`, which is started with `start`, and connects the
+    // source's consumers to it.
+    template <typename Start>
+    auto install(ppl::internal::node_table &table, ppl::internal::trace_log &trace, const std::size_t index,
+        std::unique_ptr<ppl::internal::source_trace> stand_in, const Start &start) -> void {
+        const auto n = stand_in->as_node();
+        ppl::internal::node_access::stand_in(*n, *table.nodes[index]);
+        start(*stand_in, std::move(table.nodes[index]));
+        table.nodes[index] = ppl::internal::node_ptr(n, ppl::internal::node_deleter{nullptr,
+            [](ppl::node* p, std::pmr::memory_resource*) { delete p; }});
+        trace.sources.emplace_back(index, stand_in.release());
+        connect_consumers(table, index, n);
+    }
+
+    // A stand-in for each source in `table`, in slot order.
+    auto make_stand_ins(const ppl::internal::node_table &table)
+        -> std::vector<std::pair<std::size_t, std::unique_ptr<ppl::internal::source_trace>>> {
+        auto stand_ins = std::vector<std::pair<std::size_t, std::unique_ptr<ppl::internal::source_trace>>>();
+        for (std::size_t i = 0; i < table.nodes.size(); ++i) {
+            if (table.nodes[i] != nullptr && ppl::internal::node_access::is_source(*table.nodes[i])) {
+                auto stand_in = ppl::internal::node_access::make_trace(*table.nodes[i]);
+                if (stand_in == nullptr) {
+                    throw ppl::pipeline_error(ppl::pipeline_error_kind::invalid_trace);
+                }
+                stand_ins.emplace_back(i, std::move(stand_in));
+            }
+        }
+        return stand_ins;
+    }
+}
+
+auto ppl::internal::record_trace(node_table &table, trace_log &trace, std::ostream &os) -> void {
+    end_trace(table, trace);
+    auto stand_ins = make_stand_ins(table);
+    trace.scratch.clear();
+    describe_topology(table, trace.scratch);
+    const auto topology = std::string(trace.scratch.bytes());
+    write_record(os, trace_magic, node_table::none, topology, trace.scratch);
+    if (!os) {
+        throw std::ios_base::failure("could not write trace");
+    }
+
+    // The logs have to stay put once the stand-ins point to them.
+    trace.logs.resize(stand_ins.size());
+    trace.os = &os;
+    for (std::size_t i = 0; i < stand_ins.size(); ++i) {
+        install(table, trace, stand_ins[i].first, std::move(stand_ins[i].second), [&](auto &stand_in, node_ptr source) {
+            stand_in.record(std::move(source), trace.logs[i]);
+        });
+    }
+}
+
+auto ppl::internal::write_trace(trace_log &trace, const bool all) -> void {
+    for (std::size_t i = 0; i < trace.sources.size(); ++i) {
+        const auto polls = trace.logs[i].bytes();
+        if (polls.empty() || (!all && polls.size() < trace_flush_bytes)) {
+            continue;
+        }
+        write_record(*trace.os, trace_magic, trace.sources[i].first, polls, trace.scratch);
+        trace.logs[i].clear();
+    }
+    if (!*trace.os) {
+        throw std::ios_base::failure("could not write trace");
+    }
+}
+
+auto ppl::internal::replay_trace(node_table &table, trace_log &trace, std::istream &is) -> void {
+    end_trace(table, trace);
+    auto index = std::uint64_t{0};
+    auto body = std::string();
+    if (!read_record(is, trace_magic, pipeline_error_kind::invalid_trace, index, body) || index != node_table::none) {
+        throw pipeline_error(pipeline_error_kind::invalid_trace);
+    }
+    trace.scratch.clear();
+    describe_topology(table, trace.scratch);
+    if (trace.scratch.bytes() != body) {
+        throw pipeline_error(pipeline_error_kind::invalid_trace);
+    }
+
+    auto stand_ins = make_stand_ins(table);
+    trace.polls.assign(stand_ins.size(), std::string());
+    while (read_record(is, trace_magic, pipeline_error_kind::invalid_trace, index, body)) {
+        const auto source = std::find_if(stand_ins.begin(), stand_ins.end(), [&](const auto &s) { return s.first == index; });
+        if (source == stand_ins.end()) {
+            throw pipeline_error(pipeline_error_kind::invalid_trace);
+        }
+        trace.polls[static_cast<std::size_t>(source - stand_ins.begin())].append(body);
+    }
+
+    for (std::size_t i = 0; i < stand_ins.size(); ++i) {
+        install(table, trace, stand_ins[i].first, std::move(stand_ins[i].second), [&](auto &stand_in, node_ptr source) {
+            stand_in.replay(std::move(source), trace.polls[i]);
+        });
+    }
+}
+
+auto ppl::internal::end_trace(node_table &table, trace_log &trace) -> void {
+    for (const auto &[index, stand_in] : trace.sources) {
+        if (trace.os != nullptr) {
+            stand_in->finish();
+        }
+        auto source = stand_in->release();
+        node_access::stand_in(*source, *table.nodes[index]);
+        const auto n = source.get();
+        // Destroys the stand-in, but its log is kept in `trace`.
+        table.nodes[index] = std::move(source);
+        connect_consumers(table, index, n);
+    }
+    const auto clear = [&] {
+        trace.sources.clear();
+        trace.os = nullptr;
+        trace.logs.clear();
+        trace.polls.clear();
+    };
+    if (trace.os != nullptr) {
+        try {
+            write_trace(trace, true);
+        } catch (...) {
+            clear();
+            throw;
+        }
+    }
+    clear();
+}
+
+auto ppl::internal::balance_partitions(node_table &table, const execution_plan &plan, const std::size_t count) -> void {
+    auto costs = std::vector<double>();
+    auto total = 0.0;
+    for (const auto &n : plan.nodes) {
+#ifdef PPL_PROFILING
+        costs.push_back(static_cast<double>(node_access::profile(*n).total_time.count()) + 1.0);
+#else
+        static_cast<void>(n);
+        costs.push_back(1.0);
+#endif
+        total += costs.back();
+    }
+    // Each node goes to the partition whose share of the total its midpoint falls in.
+    auto before = 0.0;
+    for (std::size_t i = 0; i < plan.nodes.size(); ++i) {
+        const auto share = (before + costs[i] / 2) / total * static_cast<double>(count);
+        table.partitions[plan.slots[i]] = std::min(static_cast<std::size_t>(share), count - 1);
+        before += costs[i];
+    }
+}
+
+namespace {
+    // A queue of messages in memory shared between two processes, one pushing and one popping.
+    // Each message is stored as its size followed by its bytes, wrapping around the end.
+    struct shm_ring {
+        std::atomic<std::uint64_t> head = 0;
+        std::atomic<std::uint64_t> tail = 0;
+        // Set once nothing more will be pushed.
+        std::atomic<bool> closed = false;
+        // Set once nothing more will be popped.
+        std::atomic<bool> abandoned = false;
+        std::uint64_t capacity;
+
+        explicit shm_ring(const std::uint64_t bytes): capacity{bytes} {}
+
+        auto try_push(const std::string_view message) -> bool {
+            const auto needed = sizeof(std::uint64_t) + message.size();
+            if (needed > capacity) {
+                throw std::length_error("value too large for the ring between partitions");
+            }
+            const auto end = tail.load(std::memory_order_relaxed);
+            if (capacity - (end - head.load(std::memory_order_acquire)) < needed) {
+                return false;
+            }
+            const auto size = static_cast<std::uint64_t>(message.size());
+            copy_in(end, &size, sizeof(size));
+            copy_in(end + sizeof(size), message.data(), message.size());
+            tail.store(end + needed, std::memory_order_release);
+            return true;
+        }
+
+        auto try_pop(std::string &message) -> bool {
+            const auto start = head.load(std::memory_order_relaxed);
+            if (start == tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+            auto size = std::uint64_t{0};
+            copy_out(start, &size, sizeof(size));
+            message.resize(size);
+            copy_out(start + sizeof(size), message.data(), size);
+            head.store(start + sizeof(size) + size, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        auto data() -> char* {
+            return reinterpret_cast<char*>(this + 1);
+        }
+
+        auto copy_in(const std::uint64_t position, const void* src, const std::size_t size) -> void {
+            const auto offset = position % capacity;
+            const auto first = std::min<std::uint64_t>(size, capacity - offset);
+            std::memcpy(data() + offset, src, first);
+            std::memcpy(data(), static_cast<const char*>(src) + first, size - first);
+        }
+
+        auto copy_out(const std::uint64_t position, void* dst, const std::size_t size) -> void {
+            const auto offset = position % capacity;
+            const auto first = std::min<std::uint64_t>(size, capacity - offset);
+            std::memcpy(dst, data() + offset, first);
+            std::memcpy(static_cast<char*>(dst) + first, data(), size - first);
+        }
+    };
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "rings must work across processes");
+
+    // One anonymous shared mapping holding every ring, which forked children inherit.
+    class shared_rings {
+    public:
+        shared_rings(const std::size_t count, const std::size_t ring_bytes)
+        : stride_{(sizeof(shm_ring) + ring_bytes + 63) / 64 * 64}, size_{std::max(count * stride_, std::size_t{1})} {
+            const auto memory = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) {
+                throw std::system_error(errno, std::system_category(), "mmap");
+            }
+            memory_ = static_cast<char*>(memory);
+            for (std::size_t i = 0; i < count; ++i) {
+                new (memory_ + i * stride_) shm_ring(ring_bytes);
+            }
+        }
+        shared_rings(const shared_rings &) = delete;
+        auto operator=(const shared_rings &) -> shared_rings& = delete;
+        ~shared_rings() noexcept {
+            ::munmap(memory_, size_);
+        }
+
+        auto operator[](const std::size_t i) -> shm_ring& {
+            return *std::launder(reinterpret_cast<shm_ring*>(memory_ + i * stride_));
+        }
+
+    private:
+        std::size_t stride_;
+        std::size_t size_;
+        char* memory_ = nullptr;
+    };
+
+    // An edge between two partitions, between nodes of the plan.
+    struct cut_edge {
+        std::size_t src;
+        std::size_t dst;
+        shm_ring* ring = nullptr;
+        std::unique_ptr<ppl::internal::remote_endpoint> endpoint;
+    };
+
+    // Steps the nodes of one partition until every sink and every edge out of it has closed,
+    // calling `supervise` whenever it has to wait for another partition.
+    template <typename Supervise>
+    auto run_partition(ppl::internal::execution_plan &plan, const std::vector<std::size_t> &partition_of,
+        const std::size_t partition, std::vector<cut_edge> &edges, Supervise supervise) -> void {
+        using ppl::internal::node_access;
+        const auto size = plan.nodes.size();
+        auto in_edges = std::vector<std::vector<std::size_t>>(size);
+        auto out_edges = std::vector<std::vector<std::size_t>>(size);
+        for (std::size_t e = 0; e < edges.size(); ++e) {
+            if (partition_of[edges[e].dst] == partition) {
+                in_edges[edges[e].dst].push_back(e);
+            }
+            if (partition_of[edges[e].src] == partition) {
+                out_edges[edges[e].src].push_back(e);
+            }
+        }
+        const auto edge_into = [&](const std::size_t src, const std::size_t dst) {
+            for (const auto &e : in_edges[dst]) {
+                if (edges[e].src == src) {
+                    return e;
+                }
+            }
+            return edges.size();
+        };
+
+        // Edges within the partition skip any buffers, as in run_parallel().
+        for (std::size_t dst = 0; dst < size; ++dst) {
+            if (partition_of[dst] != partition) {
+                continue;
+            }
+            for (auto i = plan.upstream_offsets[dst]; i < plan.upstream_offsets[dst + 1]; ++i) {
+                const auto [src, slot] = plan.upstream[i];
+                const auto e = edge_into(src, dst);
+                node_access::connect(*plan.nodes[dst], e == edges.size() ? plan.nodes[src] : edges[e].endpoint->as_node(), slot);
+            }
+        }
+
+        auto terminals = std::vector<std::size_t>();
+        for (std::size_t i = 0; i < size; ++i) {
+            if (partition_of[i] == partition && (node_access::is_sink(*plan.nodes[i]) || !out_edges[i].empty())) {
+                terminals.push_back(i);
+            }
+        }
+
+        auto edge_polls = std::vector<ppl::poll>(edges.size(), ppl::poll::empty);
+        auto message = std::string();
+        auto writer = ppl::state_writer();
+        auto waker = ppl::waker();
+        const auto wait = ppl::backoff();
+        auto idle_steps = std::size_t{0};
+        // A node only feeding other partitions is also finished once they have all stopped listening.
+        const auto finished = [&](const std::size_t i) {
+            return plan.polls[i] == ppl::poll::closed || (!node_access::is_sink(*plan.nodes[i])
+                && std::all_of(out_edges[i].begin(), out_edges[i].end(), [&](const auto e) {
+                    return edges[e].ring->abandoned.load(std::memory_order_acquire);
+                }));
+        };
+        const auto done = [&] {
+            return std::all_of(terminals.begin(), terminals.end(), finished);
+        };
+        std::fill(plan.polls.begin(), plan.polls.end(), ppl::poll::ready);
+        while (!done()) {
+            auto progress = false;
+            for (std::size_t e = 0; e < edges.size(); ++e) {
+                auto &ring = *edges[e].ring;
+                // As with a buffered edge, a value is held until its consumer has been polled with it.
+                if (partition_of[edges[e].dst] != partition || edge_polls[e] == ppl::poll::ready) {
+                    continue;
+                }
+                // Check for anything pushed just before the ring closed.
+                const auto closed = ring.closed.load(std::memory_order_acquire);
+                if (ring.try_pop(message)) {
+                    edges[e].endpoint->decode(message);
+                    edge_polls[e] = ppl::poll::ready;
+                    progress = true;
+                } else {
+                    edge_polls[e] = closed ? ppl::poll::closed : ppl::poll::empty;
+                }
+            }
+
+            for (std::size_t i = 0; i < size; ++i) {
+                if (partition_of[i] != partition) {
+                    continue;
+                }
+                const auto any = node_access::multirate_of(*plan.nodes[i]);
+                auto status = ppl::internal::first_status(any);
+                auto fresh = std::uint64_t{0};
+                for (auto j = plan.upstream_offsets[i]; j < plan.upstream_offsets[i + 1]; ++j) {
+                    const auto [src, slot] = plan.upstream[j];
+                    const auto input = partition_of[src] == partition ? plan.polls[src] : edge_polls[edge_into(src, i)];
+                    status = ppl::internal::fold_status(any, status, input);
+                    fresh |= input == ppl::poll::ready ? std::uint64_t{1} << slot : 0;
+                }
+                status = ppl::internal::last_status(any, status);
+                if (any != nullptr) {
+                    node_access::set_fresh(*any, fresh);
+                }
+                if (status == ppl::poll::ready) {
+                    for (const auto &e : in_edges[i]) {
+                        if (edge_polls[e] == ppl::poll::ready) {
+                            edge_polls[e] = ppl::poll::empty;
+                        }
+                    }
+                    status = ppl::internal::poll_node(*plan.nodes[i], plan.batch_sizes[i]);
+                    // Publishing without being given anything, as a source or a backlog does.
+                    progress = progress || (status == ppl::poll::ready && fresh == 0);
+                }
+                plan.polls[i] = status;
+
+                for (const auto &e : out_edges[i]) {
+                    auto &ring = *edges[e].ring;
+                    if (status == ppl::poll::closed) {
+                        ring.closed.store(true, std::memory_order_release);
+                    }
+                    if (status != ppl::poll::ready) {
+                        continue;
+                    }
+                    writer.clear();
+                    edges[e].endpoint->encode(plan.nodes[i], writer);
+                    for (auto waits = std::size_t{1}; !ring.abandoned.load(std::memory_order_acquire) && !ring.try_push(writer.bytes()); ++waits) {
+                        supervise();
+                        wait.wait(waits, waker);
+                    }
+                }
+            }
+
+            if (progress) {
+                idle_steps = 0;
+            } else {
+                supervise();
+                wait.wait(++idle_steps, waker);
+            }
+        }
+
+        for (std::size_t e = 0; e < edges.size(); ++e) {
+            if (partition_of[edges[e].src] == partition) {
+                edges[e].ring->closed.store(true, std::memory_order_release);
+            }
+            if (partition_of[edges[e].dst] == partition) {
+                edges[e].ring->abandoned.store(true, std::memory_order_release);
+            }
+        }
+        for (std::size_t dst = 0; dst < size; ++dst) {
+            if (partition_of[dst] != partition) {
+                continue;
+            }
+            for (auto i = plan.upstream_offsets[dst]; i < plan.upstream_offsets[dst + 1]; ++i) {
+                const auto [src, slot] = plan.upstream[i];
+                const auto buffer = plan.upstream_buffers.empty() ? nullptr : plan.upstream_buffers[i];
+                node_access::connect(*plan.nodes[dst], buffer == nullptr ? plan.nodes[src] : buffer->channel->as_node(), slot);
+            }
+        }
+    }
+}
+
+auto ppl::internal::run_partitioned(node_table &table, execution_plan &plan, const std::size_t ring_bytes)
+-> std::vector<partition_outcome> {
+    const auto size = plan.nodes.size();
+    auto partition_of = std::vector<std::size_t>();
+    auto count = std::size_t{1};
+    for (const auto &slot : plan.slots) {
+        partition_of.push_back(table.partitions[slot]);
+        count = std::max(count, table.partitions[slot] + 1);
+    }
+
+    // Every edge between partitions must be able to carry its values, and the partitions must
+    // not depend on each other in a cycle, or two of them could wait on each other forever.
+    auto edges = std::vector<cut_edge>();
+    auto depends = std::vector<std::set<std::size_t>>(count);
+    for (std::size_t src = 0; src < size; ++src) {
+        for (auto j = plan.downstream_offsets[src]; j < plan.downstream_offsets[src + 1]; ++j) {
+            const auto dst = plan.downstream[j];
+            if (partition_of[src] == partition_of[dst]) {
+                continue;
+            }
+            auto endpoint = node_access::make_endpoint(*plan.nodes[src]);
+            if (endpoint == nullptr) {
+                throw pipeline_error(pipeline_error_kind::invalid_partition);
+            }
+            edges.push_back(cut_edge{src, dst, nullptr, std::move(endpoint)});
+            depends[partition_of[dst]].insert(partition_of[src]);
+        }
+    }
+    auto remaining = std::vector<std::size_t>(count);
+    auto ready = std::vector<std::size_t>();
+    for (std::size_t p = 0; p < count; ++p) {
+        remaining[p] = depends[p].size();
+        if (remaining[p] == 0) {
+            ready.push_back(p);
+        }
+    }
+    auto ordered = std::size_t{0};
+    while (!ready.empty()) {
+        const auto p = ready.back();
+        ready.pop_back();
+        ordered++;
+        for (std::size_t q = 0; q < count; ++q) {
+            if (depends[q].contains(p) && --remaining[q] == 0) {
+                ready.push_back(q);
             }
-        } else {
-            node_polls_.emplace(node, status);
         }
-        update_poll(nodes_to_.at(node), status, node_polls_, nodes_to_);
     }
-}
\ No newline at end of file
+    if (ordered != count) {
+        throw pipeline_error(pipeline_error_kind::invalid_partition);
+    }
+
+    auto rings = shared_rings(edges.size(), ring_bytes);
+    for (std::size_t e = 0; e < edges.size(); ++e) {
+        edges[e].ring = &rings[e];
+    }
+
+    auto outcomes = std::vector<partition_outcome>(count);
+    auto children = std::vector<std::pair<pid_t, std::size_t>>();
+    const auto finished = [&](const std::size_t p, const int status) {
+        outcomes[p].completed = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        outcomes[p].signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+        // Whatever the partition was doing, it isn't any more.
+        for (auto &edge : edges) {
+            if (partition_of[edge.src] == p) {
+                edge.ring->closed.store(true, std::memory_order_release);
+            }
+            if (partition_of[edge.dst] == p) {
+                edge.ring->abandoned.store(true, std::memory_order_release);
+            }
+        }
+    };
+    const auto reap = [&](const int options) {
+        std::erase_if(children, [&](const auto &child) {
+            auto status = 0;
+            if (::waitpid(child.first, &status, options) != child.first) {
+                return false;
+            }
+            finished(child.second, status);
+            return true;
+        });
+    };
+    const auto kill_children = [&] {
+        for (const auto &child : children) {
+            ::kill(child.first, SIGKILL);
+        }
+        reap(0);
+    };
+
+    const auto parent = ::getpid();
+    for (std::size_t p = 1; p < count; ++p) {
+        if (std::find(partition_of.begin(), partition_of.end(), p) == partition_of.end()) {
+            continue;
+        }
+        std::fflush(nullptr);
+        const auto pid = ::fork();
+        if (pid < 0) {
+            const auto error = errno;
+            kill_children();
+            throw std::system_error(error, std::system_category(), "fork");
+        }
+        if (pid == 0) {
+            // Don't outlive the parent, who is the only one watching for crashes.
+            ::prctl(PR_SET_PDEATHSIG, SIGKILL);
+            if (::getppid() != parent) {
+                ::_exit(1);
+            }
+            try {
+                run_partition(plan, partition_of, p, edges, [] {});
+                // Let the partition's nodes clean up, for instance by flushing files, but leave the
+                // rest of the parent's state alone.
+                for (std::size_t i = 0; i < size; ++i) {
+                    if (partition_of[i] == p) {
+                        table.nodes[plan.slots[i]].reset();
+                    }
+                }
+                std::cout.flush();
+                std::fflush(nullptr);
+                ::_exit(0);
+            } catch (const std::exception &e) {
+                std::fprintf(stderr, "partition %zu failed: %s\n", p, e.what());
+            } catch (...) {
+                std::fprintf(stderr, "partition %zu failed\n", p);
+            }
+            std::fflush(nullptr);
+            ::_exit(1);
+        }
+        children.emplace_back(pid, p);
+    }
+
+    try {
+        run_partition(plan, partition_of, 0, edges, [&] { reap(WNOHANG); });
+    } catch (...) {
+        kill_children();
+        throw;
+    }
+    while (!children.empty()) {
+        // Sleep until any child exits, rather than waiting on each in turn, so that a crash is
+        // still seen, and its edges closed, while the children it would strand run on. The
+        // child is left for reap() in case it isn't one of these.
+        auto info = siginfo_t{};
+        const auto waiting = children.size();
+        if (::waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) < 0 && errno != EINTR) {
+            reap(0);
+            break;
+        }
+        reap(WNOHANG);
+        if (children.size() == waiting) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    return outcomes;
+}
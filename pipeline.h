@@ -1,17 +1,33 @@
 #ifndef COMP6771_PIPELINE_H
 #define COMP6771_PIPELINE_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <type_traits>
 #include <cassert>
+#include <chrono>
 #include <map>
 #include <concepts>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <random>
 #include <set>
+#include <span>
 #include <stack>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <tuple>
 #include <typeinfo>
 #include <typeindex>
@@ -29,6 +45,16 @@ namespace ppl {
         slot_already_used,
         // The output type and input types for a connection don't match.
         connection_type_mismatch,
+        // Attempting to configure an edge that doesn't exist.
+        no_such_edge,
+        // A checkpoint is unreadable, or was taken from a pipeline of a different shape.
+        invalid_checkpoint,
+        // Partitions depend on each other in a cycle, or an edge between two partitions carries
+        // a type that has no ppl::wire.
+        invalid_partition,
+        // A trace is unreadable or was recorded from a pipeline of a different shape, or a source
+        // being recorded publishes a type that has no ppl::wire.
+        invalid_trace,
     };
 
     struct pipeline_error : std::exception {
@@ -46,6 +72,14 @@ namespace ppl {
                     return "slot already used";
                 case pipeline_error_kind::connection_type_mismatch:
                     return "connection type mismatch";
+                case pipeline_error_kind::no_such_edge:
+                    return "no such edge";
+                case pipeline_error_kind::invalid_checkpoint:
+                    return "invalid checkpoint";
+                case pipeline_error_kind::invalid_partition:
+                    return "invalid partition";
+                case pipeline_error_kind::invalid_trace:
+                    return "invalid trace";
                 break;
 			}
             return "";
@@ -65,77 +99,1251 @@ namespace ppl {
         closed,
     };
 
+    class node;
+    class multirate;
+
+    // How full the buffer on an edge is, and how it has been used.
+    struct buffer_stats {
+        std::size_t capacity = 0;
+        // The number of values waiting for the consumer.
+        std::size_t size = 0;
+        // The most values that have ever been waiting at once.
+        std::size_t peak = 0;
+        std::uint64_t pushed = 0;
+        // The number of steps in which the producer was held back because the buffer was full.
+        std::uint64_t throttled = 0;
+    };
+
+    // Lets sources and other threads tell a pipeline waiting for input that there is some.
+    class waker {
+    public:
+        // Safe to call from any thread.
+        auto wake() -> void {
+            woken_.store(true, std::memory_order_release);
+            {
+                const auto lock = std::lock_guard{mutex_};
+            }
+            wakeup_.notify_all();
+        }
+
+        // Whether wake() has been called since the last take() or wait_for().
+        auto take() -> bool {
+            return woken_.exchange(false, std::memory_order_acq_rel);
+        }
+
+        // Sleeps until wake() is called or `timeout` passes, returning the same as take().
+        auto wait_for(const std::chrono::nanoseconds timeout) -> bool {
+            auto lock = std::unique_lock{mutex_};
+            wakeup_.wait_for(lock, timeout, [&] { return woken_.load(std::memory_order_acquire); });
+            return take();
+        }
+
+    private:
+        std::atomic<bool> woken_ = false;
+        std::mutex mutex_;
+        std::condition_variable wakeup_;
+    };
+
+    // Collects the state a node saves in a checkpoint. Values are stored as raw bytes, in the
+    // machine's own byte order, so checkpoints are only meant to be read back on the same platform.
+    class state_writer {
+    public:
+        template <typename T>
+        requires std::is_trivially_copyable_v<T> and (!std::is_pointer_v<T>)
+        auto write(const T &value) -> void {
+            bytes_.append(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        auto write_string(const std::string_view value) -> void {
+            write(value.size());
+            bytes_.append(value);
+        }
+
+        template <typename T>
+        requires std::is_trivially_copyable_v<T> and (!std::is_pointer_v<T>)
+        auto write_values(const std::span<const T> values) -> void {
+            write(values.size());
+            bytes_.append(reinterpret_cast<const char*>(values.data()), values.size_bytes());
+        }
+
+        auto bytes() const noexcept -> std::string_view {
+            return bytes_;
+        }
+
+        auto clear() noexcept -> void {
+            bytes_.clear();
+        }
+
+    private:
+        std::string bytes_;
+    };
+
+    // Reads back what a state_writer wrote, in the same order. Reading past the end throws
+    // pipeline_error_kind::invalid_checkpoint.
+    class state_reader {
+    public:
+        explicit state_reader(const std::string_view bytes): bytes_{bytes} {}
+
+        template <typename T>
+        requires std::is_trivially_copyable_v<T> and (!std::is_pointer_v<T>)
+        auto read() -> T {
+            auto value = T{};
+            std::memcpy(&value, take(sizeof(T)).data(), sizeof(T));
+            return value;
+        }
+
+        auto read_string() -> std::string {
+            return std::string(read_view());
+        }
+
+        // Like read_string(), but only valid for as long as the bytes being read.
+        auto read_view() -> std::string_view {
+            return take(read<std::size_t>());
+        }
+
+        template <typename T>
+        requires std::is_trivially_copyable_v<T> and (!std::is_pointer_v<T>)
+        auto read_values() -> std::vector<T> {
+            const auto size = read<std::size_t>();
+            if (size > bytes_.size() / std::max(sizeof(T), std::size_t{1})) {
+                throw pipeline_error(pipeline_error_kind::invalid_checkpoint);
+            }
+            auto values = std::vector<T>(size);
+            std::memcpy(values.data(), take(size * sizeof(T)).data(), size * sizeof(T));
+            return values;
+        }
+
+        auto empty() const noexcept -> bool {
+            return bytes_.empty();
+        }
+
+    private:
+        std::string_view bytes_;
+
+        auto take(const std::size_t size) -> std::string_view {
+            if (bytes_.size() < size) {
+                throw pipeline_error(pipeline_error_kind::invalid_checkpoint);
+            }
+            const auto taken = bytes_.substr(0, size);
+            bytes_.remove_prefix(size);
+            return taken;
+        }
+    };
+
+    // How values are sent between processes when a pipeline runs partitioned, and how they are
+    // stored in traces. Specialise this with the same two functions for any other type that
+    // needs to cross between partitions or be recorded. Values must be written by content: a
+    // view is read back as a view of the bytes being read, which whatever reads it keeps for as
+    // long as the value is in use.
+    template <typename T>
+    struct wire {};
+
+    // Set this for a trivially copyable type holding no pointers or views, so that its bytes can
+    // be sent as they are.
+    template <typename T>
+    constexpr bool wire_by_bytes = std::is_arithmetic_v<T> or std::is_enum_v<T>;
+
+    template <typename T>
+    requires wire_by_bytes<T>
+    struct wire<T> {
+        static_assert(std::is_trivially_copyable_v<T> and !std::is_pointer_v<T>, "only plain values can be sent as bytes");
+
+        static auto write(state_writer &writer, const T &value) -> void {
+            writer.write(value);
+        }
+        static auto read(state_reader &reader) -> T {
+            return reader.read<T>();
+        }
+    };
+
+    template <>
+    struct wire<std::string> {
+        static auto write(state_writer &writer, const std::string &value) -> void {
+            writer.write_string(value);
+        }
+        static auto read(state_reader &reader) -> std::string {
+            return reader.read_string();
+        }
+    };
+
+    template <>
+    struct wire<std::string_view> {
+        static auto write(state_writer &writer, const std::string_view value) -> void {
+            writer.write_string(value);
+        }
+        static auto read(state_reader &reader) -> std::string_view {
+            return reader.read_view();
+        }
+    };
+
+    template <>
+    struct wire<std::span<const std::byte>> {
+        static auto write(state_writer &writer, const std::span<const std::byte> value) -> void {
+            writer.write_string(std::string_view(reinterpret_cast<const char*>(value.data()), value.size()));
+        }
+        static auto read(state_reader &reader) -> std::span<const std::byte> {
+            const auto bytes = reader.read_view();
+            return {reinterpret_cast<const std::byte*>(bytes.data()), bytes.size()};
+        }
+    };
+
+    template <typename T>
+    concept wire_type = requires(state_writer &writer, state_reader &reader, const T &value) {
+        wire<T>::write(writer, value);
+        { wire<T>::read(reader) } -> std::same_as<T>;
+    };
+
+    template <wire_type A, wire_type B>
+    struct wire<std::pair<A, B>> {
+        static auto write(state_writer &writer, const std::pair<A, B> &value) -> void {
+            wire<A>::write(writer, value.first);
+            wire<B>::write(writer, value.second);
+        }
+        static auto read(state_reader &reader) -> std::pair<A, B> {
+            auto first = wire<A>::read(reader);
+            return {std::move(first), wire<B>::read(reader)};
+        }
+    };
+
+    // How the process running one partition of a pipeline finished.
+    struct partition_outcome {
+        // Whether every node in the partition ran until it closed.
+        bool completed = true;
+        // The signal that killed the process, if any.
+        int signal = 0;
+    };
+
+#ifdef PPL_PROFILING
+    // What a node has been doing since it was created or the pipeline's profiles were last
+    // reset. Profiling is only compiled in when PPL_PROFILING is defined, and then it must be
+    // defined for every translation unit that includes this header.
+    struct node_profile {
+        std::uint64_t polls = 0;
+        std::uint64_t ready = 0;
+        std::uint64_t empty = 0;
+        std::uint64_t closed = 0;
+        // The number of values published by ready polls. Batch polls count every value.
+        std::uint64_t values = 0;
+        std::chrono::nanoseconds total_time{0};
+        // histogram[b] counts the polls that took at least 2^(b - 1) but under 2^b nanoseconds.
+        std::array<std::uint64_t, 64> histogram{};
+
+        auto record(const poll status, const std::chrono::nanoseconds time, const std::size_t published) -> void {
+            polls++;
+            (status == poll::ready ? ready : status == poll::empty ? empty : closed)++;
+            values += status == poll::ready ? published : 0;
+            total_time += time;
+            histogram[static_cast<std::size_t>(std::bit_width(static_cast<std::uint64_t>(std::max(time.count(), std::int64_t{0}))))]++;
+        }
+
+        // An upper bound on the time taken by the fastest `fraction` of polls, to within a
+        // factor of two.
+        auto percentile(const double fraction) const -> std::chrono::nanoseconds {
+            const auto rank = static_cast<std::uint64_t>(fraction * static_cast<double>(polls));
+            auto seen = std::uint64_t{0};
+            for (std::size_t b = 0; b < histogram.size(); ++b) {
+                seen += histogram[b];
+                if (seen > rank || seen == polls) {
+                    return std::chrono::nanoseconds(b == 0 ? 0 : (std::int64_t{1} << b) - 1);
+                }
+            }
+            return std::chrono::nanoseconds(0);
+        }
+    };
+#endif
+
+    namespace internal {
+        struct node_access;
+        struct source_trace;
+
+        // A bounded queue carrying copies of one producer's values to one consumer slot.
+        // At most one thread may push and at most one other thread may pop.
+        struct edge_channel {
+            virtual ~edge_channel() noexcept = default;
+            // Connected to the consumer in place of the real producer.
+            auto virtual as_node() const -> const node* = 0;
+            // Queues a copy of `src`'s current value, unless the channel is full.
+            auto virtual try_push(const node* src) -> bool = 0;
+            // Makes the oldest queued value current, unless the channel is empty.
+            auto virtual try_pop() -> bool = 0;
+            auto virtual full() const -> bool = 0;
+            auto virtual empty() const -> bool = 0;
+            auto virtual size() const -> std::size_t = 0;
+
+            // Once closed, no more values will be pushed.
+            auto close() -> void {
+                closed_.store(true, std::memory_order_release);
+            }
+            auto is_closed() const -> bool {
+                return closed_.load(std::memory_order_acquire);
+            }
+
+        private:
+            std::atomic<bool> closed_ = false;
+        };
+
+        // Stands in for a producer in another process. Values are encoded from the real producer
+        // on one side, and decoded into the stand-in, which is connected to the consumer, on the other.
+        struct remote_endpoint {
+            virtual ~remote_endpoint() noexcept = default;
+            auto virtual as_node() const -> const node* = 0;
+            auto virtual encode(const node* src, state_writer &writer) const -> void = 0;
+            auto virtual decode(const std::string_view message) -> void = 0;
+        };
+    }
+
     class node {
     public:
         auto virtual name() const -> std::string = 0;
         virtual ~node() noexcept = default;
 
-    private:
-        std::vector<std::type_index> input_types_;
-        std::type_index output_type_ = std::type_index(typeid(void));
-        bool is_source;
-        bool is_sink;
+    private:
+        std::vector<std::type_index> input_types_;
+        std::type_index output_type_ = std::type_index(typeid(void));
+        bool is_source = false;
+        bool is_sink = false;
+        bool is_batched = false;
+        // Set when the node is also a multirate.
+        multirate* multirate_ = nullptr;
+
+        auto virtual poll_next() -> poll = 0;
+        // Nodes that cannot produce batches are polled for a single value.
+        auto virtual poll_next_batch(const std::size_t) -> poll {
+            return poll_next();
+        }
+        auto virtual connect(const node* src, const int slot) -> void = 0;
+        auto virtual make_channel(const std::size_t) const -> std::unique_ptr<internal::edge_channel> {
+            return nullptr;
+        }
+        // Null unless the node's output type has a ppl::wire.
+        auto virtual make_endpoint() const -> std::unique_ptr<internal::remote_endpoint> {
+            return nullptr;
+        }
+        // Null unless the node's output type has a ppl::wire.
+        auto virtual make_trace() const -> std::unique_ptr<internal::source_trace> {
+            return nullptr;
+        }
+        // Whether the node is waiting for something outside the pipeline, such as I/O, that will
+        // wake it up. Polling it again before then is pointless.
+        auto virtual parked() const -> bool {
+            return false;
+        }
+        // Nodes whose state should survive a restart save it here, and are handed the same bytes
+        // back in restore_state(). Nodes that save nothing are recreated from scratch.
+        auto virtual save_state(state_writer &) const -> void {}
+        auto virtual restore_state(state_reader &) -> void {}
+#ifdef PPL_PROFILING
+        node_profile profile_;
+
+        // The number of values published by the last ready poll.
+        auto virtual published() const -> std::size_t {
+            return 1;
+        }
+#endif
+        friend class pipeline;
+        friend struct internal::node_access;
+    };
+
+    template <typename Output>
+    struct producer : public node {
+    public:
+        using output_type = Output;
+        auto virtual value() const -> const output_type& = 0;
+
+    private:
+        auto make_channel(const std::size_t capacity) const -> std::unique_ptr<internal::edge_channel> override;
+        auto make_endpoint() const -> std::unique_ptr<internal::remote_endpoint> override;
+        auto make_trace() const -> std::unique_ptr<internal::source_trace> override;
+    };
+
+    template <>
+    struct producer<void> : public node {
+    public:
+        using output_type = void;
+    };
+
+    template <typename Input, typename Output>
+    struct component : public producer<Output> {
+    public:
+        using input_type = Input;
+        using output_type = Output;
+    };
+
+    template <typename Input>
+    struct sink : public component<std::tuple<Input>, void> {};
+
+    template <typename Output>
+    struct source : public component<std::tuple<>, Output> {
+    private:
+        auto connect(const node*, const int) -> void override final {};
+    };
+
+    // The values published by the most recent successful poll of a batch node.
+    template <typename Output>
+    struct batch_output {
+        auto virtual values() const -> std::span<const Output> = 0;
+        virtual ~batch_output() noexcept = default;
+    };
+
+    // A component that may publish up to `max` values per poll.
+    // When every neighbour of a batch component can also handle batches, the pipeline polls it
+    // with `poll_next_batch(max)`. Otherwise it falls back to `poll_next_batch(1)`.
+    // On `poll::ready`, `values()` must hold at least one value.
+    template <typename Input, typename Output>
+    struct batch_component : public component<Input, Output>, public batch_output<Output> {
+    public:
+        auto poll_next_batch(const std::size_t max) -> poll override = 0;
+
+        auto value() const -> const Output& override {
+            return this->values().back();
+        }
+
+    private:
+        auto poll_next() -> poll override final {
+            return poll_next_batch(1);
+        }
+#ifdef PPL_PROFILING
+        auto published() const -> std::size_t override {
+            return this->values().size();
+        }
+#endif
+    };
+
+    template <typename Input>
+    struct batch_component<Input, void> : public component<Input, void> {
+    public:
+        auto poll_next_batch(const std::size_t max) -> poll override = 0;
+
+    private:
+        auto poll_next() -> poll override final {
+            return poll_next_batch(1);
+        }
+    };
+
+    template <typename Input>
+    struct batch_sink : public batch_component<std::tuple<Input>, void> {};
+
+    template <typename Output>
+    struct batch_source : public batch_component<std::tuple<>, Output> {
+    private:
+        auto connect(const node*, const int) -> void override final {};
+    };
+
+    // Mixed into a component with several inputs to have it polled whenever any of its inputs
+    // has published a value, rather than only once all of them have, so that each input runs at
+    // its own rate. During a poll, fresh(slot) says which inputs have published a value for it;
+    // the others still hold whatever they published last, and may not hold anything yet.
+    //
+    // The component is also polled once more when all of its inputs have closed, with none of
+    // them fresh, and for as long as it has a backlog. It is closed once its inputs are and it
+    // has no backlog.
+    class multirate {
+    public:
+        virtual ~multirate() noexcept = default;
+
+    protected:
+        auto fresh(const int slot) const noexcept -> bool {
+            return (fresh_ >> slot) & 1;
+        }
+
+        auto inputs_closed() const noexcept -> bool {
+            return inputs_closed_;
+        }
+
+        // Whether there is more to publish than fit in the last poll.
+        auto set_backlog(const bool backlog) noexcept -> void {
+            backlog_ = backlog;
+        }
+
+    private:
+        std::uint64_t fresh_ = ~std::uint64_t{0};
+        bool inputs_closed_ = false;
+        bool backlog_ = false;
+
+        friend struct internal::node_access;
+    };
+
+    // Reads an input slot as a span, whether or not the producer connected to it produces batches.
+    template <typename Input>
+    class batch_input {
+    public:
+        auto connect(const node* src) -> void {
+            scalar_ = static_cast<const producer<Input>*>(src);
+            batched_ = dynamic_cast<const batch_output<Input>*>(src);
+        }
+
+        auto values() const -> std::span<const Input> {
+            if (batched_ != nullptr) {
+                return batched_->values();
+            }
+            return std::span<const Input>(&scalar_->value(), 1);
+        }
+
+    private:
+        const producer<Input>* scalar_ = nullptr;
+        const batch_output<Input>* batched_ = nullptr;
+    };
+
+    namespace internal {
+        template <typename T>
+        class spsc_channel final : public producer<T>, public edge_channel {
+        public:
+            explicit spsc_channel(const std::size_t capacity)
+            : slots_(std::bit_ceil(std::max(capacity, std::size_t{1}))), mask_{slots_.size() - 1} {}
+
+            auto name() const -> std::string override {
+                return "channel";
+            }
+
+            auto value() const -> const T& override {
+                return current_;
+            }
+
+            auto as_node() const -> const node* override {
+                return this;
+            }
+
+            auto try_push(const node* src) -> bool override {
+                const auto tail = tail_.load(std::memory_order_relaxed);
+                if (tail - head_.load(std::memory_order_acquire) == slots_.size()) {
+                    return false;
+                }
+                slots_[tail & mask_] = static_cast<const producer<T>*>(src)->value();
+                tail_.store(tail + 1, std::memory_order_release);
+                return true;
+            }
+
+            auto try_pop() -> bool override {
+                const auto head = head_.load(std::memory_order_relaxed);
+                if (head == tail_.load(std::memory_order_acquire)) {
+                    return false;
+                }
+                current_ = std::move(slots_[head & mask_]);
+                head_.store(head + 1, std::memory_order_release);
+                return true;
+            }
+
+            auto full() const -> bool override {
+                return tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire) == slots_.size();
+            }
+
+            auto empty() const -> bool override {
+                return head_.load(std::memory_order_relaxed) == tail_.load(std::memory_order_acquire);
+            }
+
+            auto size() const -> std::size_t override {
+                return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+            }
+
+        private:
+            std::vector<T> slots_;
+            std::size_t mask_;
+            T current_{};
+            alignas(64) std::atomic<std::size_t> head_ = 0;
+            alignas(64) std::atomic<std::size_t> tail_ = 0;
+
+            auto poll_next() -> poll override {
+                return poll::ready;
+            }
+            auto connect(const node*, const int) -> void override {}
+        };
+
+        template <wire_type T>
+        class remote_proxy final : public producer<T>, public remote_endpoint {
+        public:
+            auto name() const -> std::string override {
+                return "remote_proxy";
+            }
+
+            auto value() const -> const T& override {
+                return current_;
+            }
+
+            auto as_node() const -> const node* override {
+                return this;
+            }
+
+            auto encode(const node* src, state_writer &writer) const -> void override {
+                wire<T>::write(writer, static_cast<const producer<T>*>(src)->value());
+            }
+
+            auto decode(const std::string_view message) -> void override {
+                // Views read from the message point into the copy kept here.
+                message_.assign(message);
+                auto reader = state_reader(message_);
+                current_ = wire<T>::read(reader);
+            }
+
+        private:
+            std::string message_;
+            T current_{};
+
+            auto poll_next() -> poll override {
+                return poll::ready;
+            }
+            auto connect(const node*, const int) -> void override {}
+        };
+    }
+
+    template <typename Output>
+    auto producer<Output>::make_channel(const std::size_t capacity) const -> std::unique_ptr<internal::edge_channel> {
+        return std::make_unique<internal::spsc_channel<Output>>(capacity);
+    }
+
+    template <typename Output>
+    auto producer<Output>::make_endpoint() const -> std::unique_ptr<internal::remote_endpoint> {
+        if constexpr (wire_type<Output>) {
+            return std::make_unique<internal::remote_proxy<Output>>();
+        } else {
+            return nullptr;
+        }
+    }
+
+    namespace internal {
+        template <typename T>
+        struct is_a_tuple: std::false_type {};
+        template <typename ...Ts>
+        struct is_a_tuple<std::tuple<Ts...>>: std::true_type {};
+        template <typename T>
+        constexpr bool is_a_tuple_v = is_a_tuple<T>::value;
+
+        // Gives the graph algorithms below access to the private parts of `node`.
+        struct node_access {
+            static auto is_source(const node &n) -> bool {
+                return n.is_source;
+            }
+            static auto is_sink(const node &n) -> bool {
+                return n.is_sink;
+            }
+            static auto is_batched(const node &n) -> bool {
+                return n.is_batched;
+            }
+            static auto multirate_of(const node &n) -> multirate* {
+                return n.multirate_;
+            }
+            static auto backlog(const multirate &m) -> bool {
+                return m.backlog_;
+            }
+            // Returns whether this is the first time.
+            static auto close_inputs(multirate &m) -> bool {
+                return !std::exchange(m.inputs_closed_, true);
+            }
+            static auto set_fresh(multirate &m, const std::uint64_t slots) -> void {
+                m.fresh_ = slots;
+            }
+            static auto poll_next_batch(node &n, const std::size_t max) -> poll {
+                return n.poll_next_batch(max);
+            }
+            static auto connect(node &n, const node* src, const int slot) -> void {
+                n.connect(src, slot);
+            }
+            static auto make_channel(const node &n, const std::size_t capacity) -> std::unique_ptr<edge_channel> {
+                return n.make_channel(capacity);
+            }
+            static auto make_endpoint(const node &n) -> std::unique_ptr<remote_endpoint> {
+                return n.make_endpoint();
+            }
+            static auto make_trace(const node &n) -> std::unique_ptr<source_trace> {
+                return n.make_trace();
+            }
+            // Makes `stand_in` look like `n` to the pipeline, and swaps their profiles.
+            static auto stand_in(node &stand_in, node &n) -> void {
+                stand_in.input_types_ = n.input_types_;
+                stand_in.output_type_ = n.output_type_;
+                stand_in.is_source = n.is_source;
+                stand_in.is_sink = n.is_sink;
+                stand_in.is_batched = n.is_batched;
+#ifdef PPL_PROFILING
+                std::swap(stand_in.profile_, n.profile_);
+#endif
+            }
+            static auto parked(const node &n) -> bool {
+                return n.parked();
+            }
+            static auto save_state(const node &n, state_writer &writer) -> void {
+                n.save_state(writer);
+            }
+            static auto restore_state(node &n, state_reader &reader) -> void {
+                n.restore_state(reader);
+            }
+#ifdef PPL_PROFILING
+            static auto profile(node &n) -> node_profile& {
+                return n.profile_;
+            }
+            static auto published(const node &n) -> std::size_t {
+                return n.published();
+            }
+#endif
+        };
+
+        // Polls `n` for up to `max` values, recording how it went when profiling.
+        inline auto poll_node(node &n, const std::size_t max) -> poll {
+#ifdef PPL_PROFILING
+            const auto start = std::chrono::steady_clock::now();
+            const auto status = node_access::poll_next_batch(n, max);
+            const auto time = std::chrono::steady_clock::now() - start;
+            node_access::profile(n).record(status, time, status == poll::ready ? node_access::published(n) : 0);
+            return status;
+#else
+            return node_access::poll_next_batch(n, max);
+#endif
+        }
+
+        template <int I = 0, typename... Ts>
+        auto fill_types(std::vector<std::type_index> &input_types, const std::tuple<Ts...> &tup) -> void {
+            if constexpr(I == sizeof...(Ts)){
+                return;
+            } else {
+                input_types.push_back(std::type_index(typeid(std::get<I>(tup))));
+                fill_types<I + 1>(input_types, tup);
+            }
+        }
+
+        // Passes allocations through to another resource, counting them on the way.
+        class counting_resource : public std::pmr::memory_resource {
+        public:
+            explicit counting_resource(std::pmr::memory_resource* upstream): upstream_{upstream} {}
+
+            auto upstream() const noexcept -> std::pmr::memory_resource* {
+                return upstream_;
+            }
+
+            auto allocations() const noexcept -> std::size_t {
+                return allocations_;
+            }
+
+            auto bytes() const noexcept -> std::size_t {
+                return bytes_;
+            }
+
+        private:
+            std::pmr::memory_resource* upstream_;
+            std::size_t allocations_ = 0;
+            std::size_t bytes_ = 0;
+
+            auto do_allocate(const std::size_t bytes, const std::size_t alignment) -> void* override {
+                allocations_++;
+                bytes_ += bytes;
+                return upstream_->allocate(bytes, alignment);
+            }
+
+            auto do_deallocate(void* p, const std::size_t bytes, const std::size_t alignment) -> void override {
+                bytes_ -= bytes;
+                upstream_->deallocate(p, bytes, alignment);
+            }
+
+            auto do_is_equal(const std::pmr::memory_resource &other) const noexcept -> bool override {
+                return this == &other;
+            }
+        };
+
+        // Destroys a node allocated from a memory resource, given only a pointer to its base.
+        struct node_deleter {
+            std::pmr::memory_resource* resource = nullptr;
+            auto (*destroy)(node*, std::pmr::memory_resource*) -> void = nullptr;
+
+            auto operator()(node* n) const -> void {
+                destroy(n, resource);
+            }
+        };
+
+        using node_ptr = std::unique_ptr<node, node_deleter>;
+
+        // Takes the place of a source in the node table while the pipeline records or replays a
+        // trace, with the source's consumers connected to it instead.
+        struct source_trace {
+            virtual ~source_trace() noexcept = default;
+            auto virtual as_node() -> node* = 0;
+            // Polls `source` on its behalf, appending each poll to `log`.
+            auto virtual record(node_ptr source, state_writer &log) -> void = 0;
+            // Publishes what `source` did according to `polls`, written by record(), rather than
+            // polling it. Once the polls run out, the stand-in is closed.
+            auto virtual replay(node_ptr source, const std::string_view polls) -> void = 0;
+            // Appends anything record() is holding back to the log.
+            auto virtual finish() -> void = 0;
+            auto virtual source() const -> node* = 0;
+            // Hands the source back.
+            auto virtual release() -> node_ptr = 0;
+        };
+
+        // Each poll is logged as its status, followed by the number of values and the values if
+        // it was ready. A run of empty polls is logged once, followed by its length.
+        template <wire_type T>
+        class traced_source final : public producer<T>, public batch_output<T>, public source_trace {
+        public:
+            auto name() const -> std::string override {
+                return source_->name();
+            }
+
+            auto value() const -> const T& override {
+                return values().back();
+            }
+
+            auto values() const -> std::span<const T> override {
+                if (log_ == nullptr) {
+                    return values_;
+                }
+                if (batched_ != nullptr) {
+                    return batched_->values();
+                }
+                return std::span<const T>(&static_cast<const producer<T>&>(*source_).value(), 1);
+            }
+
+            auto as_node() -> node* override {
+                return this;
+            }
+
+            auto record(node_ptr source, state_writer &log) -> void override {
+                source_ = std::move(source);
+                batched_ = dynamic_cast<const batch_output<T>*>(source_.get());
+                log_ = &log;
+            }
+
+            auto replay(node_ptr source, const std::string_view polls) -> void override {
+                source_ = std::move(source);
+                polls_ = state_reader(polls);
+            }
+
+            auto finish() -> void override {
+                if (empties_ != 0) {
+                    log_->write(static_cast<std::uint8_t>(poll::empty));
+                    log_->write(std::exchange(empties_, 0));
+                }
+            }
+
+            auto source() const -> node* override {
+                return source_.get();
+            }
+
+            auto release() -> node_ptr override {
+                return std::move(source_);
+            }
+
+        private:
+            node_ptr source_;
+            const batch_output<T>* batched_ = nullptr;
+            state_writer* log_ = nullptr;
+            state_reader polls_{std::string_view()};
+            std::vector<T> values_;
+            std::uint32_t empties_ = 0;
+
+            auto poll_next() -> poll override {
+                return poll_next_batch(1);
+            }
+
+            auto poll_next_batch(const std::size_t max) -> poll override {
+                return log_ != nullptr ? record_poll(max) : replay_poll();
+            }
+
+            auto record_poll(const std::size_t max) -> poll {
+                const auto status = node_access::poll_next_batch(*source_, max);
+                if (status == poll::empty) {
+                    if (++empties_ == std::numeric_limits<std::uint32_t>::max()) {
+                        finish();
+                    }
+                    return status;
+                }
+                finish();
+                log_->write(static_cast<std::uint8_t>(status));
+                if (status == poll::ready) {
+                    const auto published = values();
+                    log_->write(published.size());
+                    for (const auto &value : published) {
+                        wire<T>::write(*log_, value);
+                    }
+                }
+                return status;
+            }
+
+            auto replay_poll() -> poll {
+                if (empties_ != 0) {
+                    empties_--;
+                    return poll::empty;
+                }
+                if (polls_.empty()) {
+                    return poll::closed;
+                }
+                const auto status = static_cast<poll>(polls_.read<std::uint8_t>());
+                if (status == poll::empty) {
+                    empties_ = polls_.read<std::uint32_t>() - 1;
+                } else if (status == poll::ready) {
+                    values_.clear();
+                    const auto count = polls_.read<std::size_t>();
+                    for (std::size_t i = 0; i < count; ++i) {
+                        values_.push_back(wire<T>::read(polls_));
+                    }
+                }
+                return status;
+            }
+
+            auto connect(const node*, const int) -> void override {}
+
+            auto parked() const -> bool override {
+                return log_ != nullptr && node_access::parked(*source_);
+            }
+
+            auto save_state(state_writer &writer) const -> void override {
+                node_access::save_state(*source_, writer);
+            }
+
+            auto restore_state(state_reader &reader) -> void override {
+                node_access::restore_state(*source_, reader);
+            }
+#ifdef PPL_PROFILING
+            auto published() const -> std::size_t override {
+                return values().size();
+            }
+#endif
+        };
+    }
+
+    template <typename Output>
+    auto producer<Output>::make_trace() const -> std::unique_ptr<internal::source_trace> {
+        if constexpr (wire_type<Output>) {
+            return std::make_unique<internal::traced_source<Output>>();
+        } else {
+            return nullptr;
+        }
+    }
+
+    namespace internal {
+
+        // A queue on the edge src -> dst, which step() fills from src and drains into dst. dst is
+        // connected to `channel` in place of src.
+        struct edge_buffer {
+            std::size_t src;
+            std::size_t dst;
+            std::unique_ptr<edge_channel> channel;
+            buffer_stats stats;
+
+            auto full() const -> bool {
+                return channel->size() >= stats.capacity;
+            }
+        };
+
+        // The nodes of a pipeline and the edges between them, stored densely by slot index.
+        // A node ID combines its slot's index with the slot's generation, which changes whenever
+        // the slot is freed. So an ID expires with its node, even though the slot gets reused.
+        class node_table {
+        public:
+            static constexpr std::size_t none = static_cast<std::size_t>(-1);
+            static constexpr int index_bits = 24;
+            static constexpr std::uint8_t max_generation = 127;
+
+            explicit node_table(std::pmr::memory_resource* resource);
+
+            // nodes[i] is null while slot i is free.
+            std::pmr::vector<node_ptr> nodes;
+            std::pmr::vector<std::uint8_t> generations;
+            // inputs[i][slot] is the index of the node filling that input slot, or `none`.
+            std::pmr::vector<std::pmr::vector<std::size_t>> inputs;
+            // outputs[i] are the distinct indices of nodes with an input slot filled by nodes[i].
+            std::pmr::vector<std::pmr::vector<std::size_t>> outputs;
+            std::pmr::vector<edge_buffer> buffers;
+            // The partition each node runs in when the pipeline runs partitioned.
+            std::pmr::vector<std::size_t> partitions;
+            std::size_t size = 0;
+
+            // The index of the node with the given ID, or `none` if it has expired.
+            auto index_of(const int id) const -> std::size_t {
+                const auto index = static_cast<std::size_t>(id & ((1 << index_bits) - 1)) - 1;
+                if (id <= 0 || index >= nodes.size() || nodes[index] == nullptr
+                    || generations[index] != static_cast<std::uint8_t>(id >> index_bits)) {
+                    return none;
+                }
+                return index;
+            }
+
+            auto buffer(const std::size_t src, const std::size_t dst) const -> const edge_buffer* {
+                const auto iter = std::find_if(buffers.begin(), buffers.end(), [&](const auto &b) {
+                    return b.src == src && b.dst == dst;
+                });
+                return iter == buffers.end() ? nullptr : &*iter;
+            }
 
-        auto virtual poll_next() -> poll = 0;
-        auto virtual connect(const node* src, const int slot) -> void = 0;
-        friend class pipeline;
-    };
+            auto buffer(const std::size_t src, const std::size_t dst) -> edge_buffer* {
+                return const_cast<edge_buffer*>(std::as_const(*this).buffer(src, dst));
+            }
 
-    template <typename Output>
-    struct producer : public node {
-    public:
-        using output_type = Output;
-        auto virtual value() const -> const output_type& = 0;
-    };
+            auto resource() const -> std::pmr::memory_resource* {
+                return nodes.get_allocator().resource();
+            }
 
-    template <>
-    struct producer<void> : public node {
-    public:
-        using output_type = void;
-    };
+            auto id_of(const std::size_t index) const -> int {
+                return static_cast<int>(generations[index]) << index_bits | static_cast<int>(index + 1);
+            }
 
-    template <typename Input, typename Output>
-    struct component : public producer<Output> {
-    public:
-        using input_type = Input;
-        using output_type = Output;
-    };
+            auto insert(node_ptr n, const std::size_t slots) -> std::size_t;
+            auto erase(const std::size_t index) -> void;
+            // Fills an unused input slot of dst with src.
+            auto link(const std::size_t src, const std::size_t dst, const std::size_t slot) -> void;
+            // Clears every input slot of dst filled by src.
+            auto unlink(const std::size_t src, const std::size_t dst) -> void;
 
-    template <typename Input>
-    struct sink : public component<std::tuple<Input>, void> {};
+            // Whether the table describes a valid pipeline. This is kept up to date as the table is
+            // edited, so it only costs more than O(1) if edges have been removed since the last call.
+            auto is_valid() const -> bool;
 
-    template <typename Output>
-    struct source : public component<std::tuple<>, Output> {
-    private:
-        auto connect(const node*, const int) -> void override final {};
-    };
+        private:
+            std::pmr::vector<std::size_t> free_slots_;
 
-    namespace internal {
-        template <typename T>
-        struct is_a_tuple: std::false_type {};
-        template <typename ...Ts>
-        struct is_a_tuple<std::tuple<Ts...>>: std::true_type {};
-        template <typename T>
-        constexpr bool is_a_tuple_v = is_a_tuple<T>::value;
+            std::size_t unfilled_slots_ = 0;
+            // Non-sink nodes with no dependents.
+            std::size_t dangling_ = 0;
+            std::size_t sources_ = 0;
+            std::size_t sinks_ = 0;
 
-        template <int I = 0, typename... Ts>
-        auto fill_types(std::vector<std::type_index> &input_types, const std::tuple<Ts...> &tup) -> void {
-            if constexpr(I == sizeof...(Ts)){
-                return;
-            } else {
-                input_types.push_back(std::type_index(typeid(std::get<I>(tup))));
-                fill_types<I + 1>(input_types, tup);
+            // Weakly connected components, as a union-find forest. Removing an edge can split a
+            // component, so the forest is rebuilt lazily after any removal.
+            mutable std::pmr::vector<std::size_t> parents_;
+            mutable std::size_t components_ = 0;
+            mutable bool components_stale_ = false;
+
+            // A topological order of the graph without cyclic_edges_, kept up to date with the
+            // Pearce-Kelly algorithm. Edges that would close a cycle are set aside in cyclic_edges_
+            // until some other edge is removed.
+            std::pmr::vector<std::uint64_t> ranks_;
+            std::uint64_t next_rank_ = 0;
+            std::pmr::vector<std::pair<std::size_t, std::size_t>> cyclic_edges_;
+            std::pmr::vector<char> visited_;
+            std::pmr::vector<std::size_t> forward_;
+            std::pmr::vector<std::size_t> backward_;
+            std::pmr::vector<std::size_t> work_;
+            std::pmr::vector<std::uint64_t> freed_ranks_;
+
+            auto unlinked(const std::size_t src) -> void;
+            auto is_cyclic_edge(const std::size_t src, const std::size_t dst) const -> bool;
+            auto order_edge(const std::size_t src, const std::size_t dst) -> bool;
+            auto reorder_cyclic_edges() -> void;
+            auto find(std::size_t index) const -> std::size_t;
+            auto unite(const std::size_t a, const std::size_t b) const -> void;
+        };
+
+        // Working space for depth-first searches. The searches keep their own stack of frames
+        // rather than recursing, so they cannot overflow the thread's stack on long chains.
+        // Keeping one of these around between searches avoids reallocating it each time.
+        struct dfs_stack {
+            explicit dfs_stack(std::pmr::memory_resource* resource): frames{resource}, visited{resource} {}
+
+            // The node being searched, and the position of the next of its outputs to visit.
+            std::pmr::vector<std::pair<std::size_t, std::size_t>> frames;
+            std::pmr::vector<char> visited;
+        };
+
+        // Appends every node reachable from `node` that hasn't been visited yet to `order`, in postorder.
+        auto dfs_forwards(std::pmr::vector<std::size_t> &order, const std::size_t node, dfs_stack &stack, const node_table &table) -> void;
+        // The indices of the live nodes of `table`, in reverse topological order.
+        auto topological_sort(const node_table &table, dfs_stack &stack) -> std::pmr::vector<std::size_t>;
+
+        // The maximal chains of at least two components in which each link is the only output of
+        // one component and the only input of the next, in order from the head of each chain.
+        auto fused_chains(const node_table &table, std::pmr::memory_resource* resource)
+            -> std::pmr::vector<std::pmr::vector<std::size_t>>;
+
+        // The pipeline compiled into topological order. Nodes are referred to by their
+        // position in `nodes`, and the dependents of nodes[i] are
+        // downstream[downstream_offsets[i]] to downstream[downstream_offsets[i + 1]].
+        // Likewise, upstream[upstream_offsets[i]] onwards are the (producer, slot) pairs feeding nodes[i].
+        // nodes[i] is polled for up to batch_sizes[i] values at a time.
+        // Fused chains are laid out contiguously, and step() schedules nodes[unit_offsets[u]] to
+        // nodes[unit_offsets[u + 1]] as a unit; every other node is a unit of its own.
+        // When an edge is buffered, upstream_buffers holds its buffer alongside its entry in
+        // upstream, and the buffer is also listed in output_buffers for the producer.
+        // nodes[i] is in slot slots[i] of the node table.
+        struct execution_plan {
+            explicit execution_plan(std::pmr::memory_resource* resource)
+            : nodes{resource}, slots{resource}, batch_sizes{resource}, downstream_offsets{resource}, downstream{resource}
+            , upstream_offsets{resource}, upstream{resource}, unit_offsets{resource}, upstream_buffers{resource}
+            , output_buffer_offsets{resource}, output_buffers{resource}, sinks{resource}, polls{resource}
+            , indegrees{resource} {}
+
+            std::pmr::vector<node*> nodes;
+            std::pmr::vector<std::size_t> slots;
+            std::pmr::vector<std::size_t> batch_sizes;
+            std::pmr::vector<std::size_t> downstream_offsets;
+            std::pmr::vector<std::size_t> downstream;
+            std::pmr::vector<std::size_t> upstream_offsets;
+            std::pmr::vector<std::pair<std::size_t, int>> upstream;
+            std::pmr::vector<std::size_t> unit_offsets;
+            std::pmr::vector<edge_buffer*> upstream_buffers;
+            std::pmr::vector<std::size_t> output_buffer_offsets;
+            std::pmr::vector<edge_buffer*> output_buffers;
+            std::pmr::vector<std::size_t> sinks;
+            std::pmr::vector<poll> polls;
+            // The number of distinct nodes each node depends on.
+            std::pmr::vector<std::size_t> indegrees;
+            bool acyclic = true;
+        };
+
+        auto compile_plan(node_table &table, const std::size_t batch_size, dfs_stack &stack) -> execution_plan;
+        // Polls every node of the plan once, moving values through its edge buffers.
+        auto step_buffered(execution_plan &plan) -> void;
+        auto run_parallel(execution_plan &plan, const std::size_t threads, const std::size_t channel_capacity) -> void;
+        // Spreads the nodes of `plan` across `count` partitions in topological order, so that each
+        // partition has roughly the same total cost.
+        auto balance_partitions(node_table &table, const execution_plan &plan, const std::size_t count) -> void;
+        // Runs each partition of `table` in a process of its own, the first in this one.
+        auto run_partitioned(node_table &table, execution_plan &plan, const std::size_t ring_bytes)
+            -> std::vector<partition_outcome>;
+
+        // Runs the nodes of a plan across a fixed set of threads. A node is queued as soon as
+        // every node it depends on has run, and idle threads steal queued nodes from busy ones.
+        class work_stealing_pool {
+        public:
+            explicit work_stealing_pool(const std::size_t threads);
+            work_stealing_pool(const work_stealing_pool &) = delete;
+            auto operator=(const work_stealing_pool &) -> work_stealing_pool& = delete;
+            ~work_stealing_pool() noexcept;
+
+            auto threads() const noexcept -> std::size_t {
+                return queues_.size();
+            }
+
+            // Polls every node of an acyclic plan once, as step() would.
+            auto run_step(execution_plan &plan) -> void;
+
+        private:
+            // Owners push and pop at the back, and thieves take from `head`. The storage is only
+            // cleared once the queue is empty, so it stops growing after the first few steps.
+            struct queue {
+                std::mutex mutex;
+                std::vector<std::size_t> tasks;
+                std::size_t head = 0;
+            };
+
+            auto work(const std::size_t worker) -> void;
+            auto execute(const std::size_t worker, const std::size_t task) -> void;
+            auto push(const std::size_t worker, const std::size_t task) -> void;
+            auto pop(const std::size_t worker, std::size_t &task) -> bool;
+            auto steal(const std::size_t worker, std::size_t &task) -> bool;
+
+            // Queue 0 belongs to the thread calling run_step(); the rest belong to workers_.
+            std::vector<std::unique_ptr<queue>> queues_;
+            std::vector<std::thread> workers_;
+            std::mutex mutex_;
+            std::condition_variable wake_;
+            std::size_t epoch_ = 0;
+            bool shutdown_ = false;
+
+            execution_plan* plan_ = nullptr;
+            std::unique_ptr<std::atomic<std::size_t>[]> pending_;
+            std::size_t pending_size_ = 0;
+            std::atomic<std::size_t> remaining_ = 0;
+            std::atomic<std::size_t> busy_ = 0;
+            std::atomic<bool> failed_ = false;
+            std::exception_ptr error_;
+        };
+
+        // What the last checkpoint written by a pipeline contained, so that the next one can leave
+        // out whatever hasn't changed since.
+        struct checkpoint_log {
+            explicit checkpoint_log(std::pmr::memory_resource* resource): state_hashes{resource} {}
+
+            std::uint64_t sequence = 0;
+            // Zero until a complete checkpoint has been written.
+            std::uint64_t topology_hash = 0;
+            // The hash of each node's saved state, by slot index.
+            std::pmr::vector<std::uint64_t> state_hashes;
+            // Kept between checkpoints to save reallocating them.
+            state_writer body;
+            state_writer scratch;
+        };
+
+        // Appends a checkpoint of every node in `table` to `os`. Unless `complete`, nodes whose
+        // state hasn't changed since the last checkpoint in `log` are left out, as is the graph's
+        // topology if that hasn't changed either.
+        auto write_checkpoint(const node_table &table, checkpoint_log &log, std::ostream &os, const bool complete) -> void;
+        // Restores the nodes of `table` from the checkpoints in `is`, returning false if there are
+        // none. The next checkpoint written to `log` will be complete.
+        auto read_checkpoint(node_table &table, checkpoint_log &log, std::istream &is) -> bool;
+
+        // The sources of a pipeline that is recording or replaying a trace. Until the trace ends,
+        // each one's place in the node table is taken by a stand-in.
+        struct trace_log {
+            explicit trace_log(std::pmr::memory_resource* resource): sources{resource} {}
+
+            // The slot index of each source, and its stand-in.
+            std::pmr::vector<std::pair<std::size_t, source_trace*>> sources;
+            // While recording, the polls of sources[i] that haven't been written to `os` yet.
+            std::ostream* os = nullptr;
+            std::vector<state_writer> logs;
+            // While replaying, the polls of sources[i].
+            std::vector<std::string> polls;
+            state_writer scratch;
+
+            // The node in slot `index`, given the one in the node table, which may be a stand-in.
+            auto real_node(const std::size_t index, node* n) const -> node* {
+                for (const auto &[i, stand_in] : sources) {
+                    if (i == index) {
+                        return stand_in->source();
+                    }
+                }
+                return n;
+            }
+        };
+
+        // Ends any trace, then starts recording every source in `table` to `os`.
+        auto record_trace(node_table &table, trace_log &trace, std::ostream &os) -> void;
+        // Writes out the logs that have grown large, or all of them if `all`.
+        auto write_trace(trace_log &trace, const bool all) -> void;
+        // Ends any trace, then starts replaying the trace in `is` in place of every source in `table`.
+        auto replay_trace(node_table &table, trace_log &trace, std::istream &is) -> void;
+        // Finishes writing any trace being recorded, and puts the real sources back.
+        auto end_trace(node_table &table, trace_log &trace) -> void;
+
+        // Everything a pipeline allocates, along with the arena it is allocated from. It is kept
+        // behind a pointer so that moving a pipeline never moves memory between arenas.
+        struct pipeline_storage {
+            explicit pipeline_storage(std::pmr::memory_resource* upstream)
+            : counter{upstream}, arena{&counter}, nodes{&arena}, plan{&arena}, search{&arena}, checkpoints{&arena}
+            , trace{&arena} {}
+
+            counting_resource counter;
+            std::pmr::unsynchronized_pool_resource arena;
+            node_table nodes;
+            execution_plan plan;
+            dfs_stack search;
+            checkpoint_log checkpoints;
+            trace_log trace;
+            ppl::waker waker;
+        };
+
+        // Folds the status of one more input into the status of the node it feeds, starting from
+        // first_status(). Most nodes take the worst status of their inputs, but a multirate takes the best.
+        inline auto first_status(const multirate* any) -> poll {
+            return any == nullptr ? poll::ready : poll::closed;
+        }
+        inline auto fold_status(const multirate* any, const poll status, const poll input) -> poll {
+            return any == nullptr ? std::max(status, input) : std::min(status, input);
+        }
+        // Finishes folding, for a multirate that still has something to publish.
+        inline auto last_status(multirate* any, const poll status) -> poll {
+            if (any == nullptr || status == poll::ready) {
+                return status;
+            }
+            if (status == poll::closed && node_access::close_inputs(*any)) {
+                return poll::ready;
             }
+            return node_access::backlog(*any) ? poll::ready : status;
         }
 
-        auto dfs_forwards(std::stack<int> &stack, const int &node, std::map<int, bool> &visited, const std::map<int, std::set<int>> &nodes_to_) -> void;
-        auto dfs_backwards(const int &node, std::map<int, bool> &visited, const std::map<int, std::map<int, int>> nodes_from_) -> void;
-        auto is_connected(const std::map<int, std::unique_ptr<node>> &nodes_, const std::map<int, std::set<int>> &nodes_to_, 
-        const std::map<int, std::map<int, int>> &nodes_from_) -> bool;
-        auto check_cycle(const int &node, std::map<int, bool> &visited, std::map<int, bool> &in_stack, const std::map<int, std::set<int>> &nodes_to_) -> bool;
-        auto has_cycle(const std::map<int, std::unique_ptr<node>> &nodes_, const std::map<int, std::set<int>> &nodes_to_) -> bool;
-        auto topological_sort(const std::map<int, std::unique_ptr<node>> &nodes_, const std::map<int, std::set<int>> &nodes_to_) -> std::stack<int>;
-        auto update_poll(const std::set<int> &node_list, const poll status, std::map<int, poll> &node_polls_, const std::map<int, std::set<int>> &nodes_to_) -> void;
+        // The status of the nodes feeding nodes[index], telling a multirate which of them are ready.
+        // Since dependents of an empty or closed node are skipped with its status, this is
+        // poll::ready exactly when nodes[index] should be polled.
+        inline auto input_status(const execution_plan &plan, const std::size_t index) -> poll {
+            const auto any = node_access::multirate_of(*plan.nodes[index]);
+            auto status = first_status(any);
+            auto fresh = std::uint64_t{0};
+            for (auto i = plan.upstream_offsets[index]; i < plan.upstream_offsets[index + 1]; ++i) {
+                const auto [src, slot] = plan.upstream[i];
+                status = fold_status(any, status, plan.polls[src]);
+                fresh |= plan.polls[src] == poll::ready ? std::uint64_t{1} << slot : 0;
+            }
+            if (any != nullptr) {
+                node_access::set_fresh(*any, fresh);
+            }
+            return last_status(any, status);
+        }
     }
 
     template <typename N>
@@ -147,125 +1355,231 @@ namespace ppl {
         requires internal::is_a_tuple_v<typename N::input_type>;
     };
 
+    template <typename N>
+    concept batched_node = concrete_node<N>
+        and std::derived_from<N, batch_component<typename N::input_type, typename N::output_type>>;
+
+    // Decides how run() waits after steps that got nothing from any source. `wait()` is called
+    // after each such step, with the number of them in a row so far, and should return whether
+    // it was woken by `waker`.
+    template <typename S>
+    concept wait_strategy = requires(S strategy, const std::size_t idle_steps, waker &waker) {
+        { strategy.wait(idle_steps, waker) } -> std::same_as<bool>;
+    };
+
+    // Steps again straight away at first, then yields the thread between steps, and then sleeps
+    // for exponentially longer between steps, up to a limit, until woken.
+    class backoff {
+    public:
+        backoff() = default;
+
+        backoff(const std::size_t spins, const std::size_t yields, const std::chrono::nanoseconds min_sleep,
+            const std::chrono::nanoseconds max_sleep)
+        : spins_{spins}, yields_{yields}, min_sleep_{min_sleep}, max_sleep_{max_sleep} {}
+
+        auto wait(const std::size_t idle_steps, waker &waker) const -> bool {
+            if (idle_steps <= spins_) {
+                return waker.take();
+            }
+            if (idle_steps <= spins_ + yields_) {
+                std::this_thread::yield();
+                return waker.take();
+            }
+            auto sleep = min_sleep_;
+            for (auto i = spins_ + yields_ + 1; i < idle_steps && sleep < max_sleep_; ++i) {
+                sleep *= 2;
+            }
+            return waker.wait_for(std::min(sleep, max_sleep_));
+        }
+
+    private:
+        std::size_t spins_ = 64;
+        std::size_t yields_ = 64;
+        std::chrono::nanoseconds min_sleep_ = std::chrono::microseconds(50);
+        std::chrono::nanoseconds max_sleep_ = std::chrono::milliseconds(10);
+    };
+
     class pipeline {
     public:
         using node_id = int;
-        pipeline() = default;
+        pipeline(): pipeline(std::pmr::new_delete_resource()) {}
+        // Nodes, edges and scheduling state are all allocated from an arena owned by the pipeline,
+        // which gets its memory from `upstream`.
+        explicit pipeline(std::pmr::memory_resource* upstream)
+        : storage_{std::make_unique<internal::pipeline_storage>(upstream)} {}
         pipeline(const pipeline &) = delete;
-        pipeline(pipeline &&other) = default;
+        // A moved-from pipeline is left empty, with a new arena on the same upstream resource.
+        pipeline(pipeline &&other)
+        : storage_{std::make_unique<internal::pipeline_storage>(other.storage_->counter.upstream())} {
+            swap(other);
+        }
         auto operator=(const pipeline &) -> pipeline& = delete;
-        auto operator=(pipeline &&) -> pipeline& = default;
+        auto operator=(pipeline &&other) -> pipeline& {
+            if (this != &other) {
+                auto moved = pipeline(std::move(other));
+                swap(moved);
+            }
+            return *this;
+        }
         ~pipeline() noexcept = default;
 
         template <typename N, typename... Args>
         requires concrete_node<N> and std::constructible_from<N, Args...>
         auto create_node(Args&& ...args) -> node_id {
-            latest_id_++;
-            nodes_.emplace(latest_id_, std::make_unique<N>(std::forward<Args>(args)...));
-            nodes_from_.emplace(latest_id_, std::map<int, node_id>{});
-            nodes_to_.emplace(latest_id_, std::set<node_id>{});
+            plan_valid_ = false;
+            auto allocator = std::pmr::polymorphic_allocator<N>(&storage_->arena);
+            const auto destroy = [](node* n, std::pmr::memory_resource* resource) {
+                std::pmr::polymorphic_allocator<N>(resource).delete_object(static_cast<N*>(n));
+            };
+            auto new_node = internal::node_ptr(allocator.template new_object<N>(std::forward<Args>(args)...),
+                internal::node_deleter{&storage_->arena, destroy});
             const auto inputs = typename N::input_type{};
-            internal::fill_types(nodes_.at(latest_id_)->input_types_, inputs);
+            internal::fill_types(new_node->input_types_, inputs);
             if constexpr (!std::derived_from<N, producer<void>>) {
-                nodes_.at(latest_id_)->output_type_ = std::type_index(typeid(typename N::output_type{}));
-            }
-
-            if (std::derived_from<N, component<std::tuple<>,typename N::output_type>>) {
-                nodes_.at(latest_id_)->is_source = true;
-            } else {
-                nodes_.at(latest_id_)->is_source = false;
+                new_node->output_type_ = std::type_index(typeid(typename N::output_type{}));
             }
-
-            if (std::derived_from<N, producer<void>>) {
-                nodes_.at(latest_id_)->is_sink = true;
-            } else {
-                nodes_.at(latest_id_)->is_sink = false;
+            new_node->is_source = std::derived_from<N, component<std::tuple<>,typename N::output_type>>;
+            new_node->is_sink = std::derived_from<N, producer<void>>;
+            new_node->is_batched = batched_node<N>;
+            if constexpr (std::derived_from<N, multirate>) {
+                static_assert(std::tuple_size_v<typename N::input_type> > 0 and std::tuple_size_v<typename N::input_type> <= 64,
+                    "a multirate has between 1 and 64 inputs");
+                new_node->multirate_ = static_cast<N*>(new_node.get());
             }
 
-            return latest_id_;
+            const auto slots = new_node->input_types_.size();
+            return storage_->nodes.id_of(storage_->nodes.insert(std::move(new_node), slots));
         }
 
         auto erase_node(const node_id &n_id) -> void {
-            if (!nodes_.contains(n_id)) {
+            const auto index = storage_->nodes.index_of(n_id);
+            if (index == internal::node_table::none) {
                 throw pipeline_error(pipeline_error_kind::invalid_node_id);
             }
-
-            auto disconnected_nodes_from = std::vector<node_id>{};
-            for (const auto &slot : nodes_from_.at(n_id)) {
-                disconnected_nodes_from.push_back(slot.second);
-            }
-            for (const auto &node_from : disconnected_nodes_from) {
-                disconnect(node_from, n_id);
-            }
-
-            auto disconnected_nodes_to = std::vector<node_id>{};
-            for (const auto &node_to : nodes_to_.at(n_id)) {
-                disconnected_nodes_to.push_back(node_to);
-            }
-            for (const auto &node_to : disconnected_nodes_to) {
-                disconnect(n_id, node_to);
+            plan_valid_ = false;
+            const auto &traced = storage_->trace.sources;
+            if (std::find_if(traced.begin(), traced.end(), [&](const auto &s) { return s.first == index; }) != traced.end()) {
+                internal::end_trace(storage_->nodes, storage_->trace);
             }
-
-            nodes_.erase(n_id);
-            nodes_to_.erase(n_id);
-            nodes_from_.erase(n_id);
+            storage_->nodes.erase(index);
         }
 
         auto get_node(const node_id &n_id) const -> const node* {
-            return nodes_.contains(n_id) ? nodes_.at(n_id).get() : nullptr;
+            const auto index = storage_->nodes.index_of(n_id);
+            return index == internal::node_table::none ? nullptr
+                : storage_->trace.real_node(index, storage_->nodes.nodes[index].get());
         }
 
         auto get_node(const node_id &n_id) -> node* {
-            return nodes_.contains(n_id) ? nodes_.at(n_id).get() : nullptr;
+            const auto index = storage_->nodes.index_of(n_id);
+            return index == internal::node_table::none ? nullptr
+                : storage_->trace.real_node(index, storage_->nodes.nodes[index].get());
         }
 
         auto connect(const node_id &src, const node_id &dst, const int &slot) -> void {
-            if (!nodes_.contains(src) || !nodes_.contains(dst)) {
+            const auto src_index = storage_->nodes.index_of(src);
+            const auto dst_index = storage_->nodes.index_of(dst);
+            if (src_index == internal::node_table::none || dst_index == internal::node_table::none) {
                 throw pipeline_error(pipeline_error_kind::invalid_node_id);
             }
-            const auto input_types = nodes_.at(dst).get()->input_types_;
-            if (nodes_from_.at(dst).contains(slot)) {
-                throw pipeline_error(pipeline_error_kind::slot_already_used);
-            }
-            if (input_types.size() <= static_cast<std::size_t>(slot) || slot < 0) {
+            auto &inputs = storage_->nodes.inputs[dst_index];
+            if (inputs.size() <= static_cast<std::size_t>(slot) || slot < 0) {
                 throw pipeline_error(pipeline_error_kind::no_such_slot);
             }
-            if (input_types.at(static_cast<std::size_t>(slot)) != nodes_.at(src).get()->output_type_) {
+            if (inputs[static_cast<std::size_t>(slot)] != internal::node_table::none) {
+                throw pipeline_error(pipeline_error_kind::slot_already_used);
+            }
+            const auto &src_node = storage_->nodes.nodes[src_index];
+            const auto &dst_node = storage_->nodes.nodes[dst_index];
+            if (dst_node->input_types_[static_cast<std::size_t>(slot)] != src_node->output_type_) {
                 throw pipeline_error(pipeline_error_kind::connection_type_mismatch);
             }
-            nodes_.at(dst).get()->connect(nodes_.at(src).get(), slot);
-            nodes_from_.at(dst).emplace(slot, src);
-            nodes_to_.at(src).insert(dst);
+            plan_valid_ = false;
+            const auto buffer = storage_->nodes.buffer(src_index, dst_index);
+            dst_node->connect(buffer == nullptr ? src_node.get() : buffer->channel->as_node(), slot);
+            storage_->nodes.link(src_index, dst_index, static_cast<std::size_t>(slot));
         }
 
         auto disconnect(const node_id &src, const node_id &dst) -> void {
-            if (!nodes_.contains(src) || !nodes_.contains(dst)) {
+            const auto src_index = storage_->nodes.index_of(src);
+            const auto dst_index = storage_->nodes.index_of(dst);
+            if (src_index == internal::node_table::none || dst_index == internal::node_table::none) {
                 throw pipeline_error(pipeline_error_kind::invalid_node_id);
             }
-            auto iter = std::find(nodes_to_.at(src).begin(), nodes_to_.at(src).end(), dst);
-            if (iter != nodes_to_.at(src).end()) {
-                nodes_to_.at(src).erase(iter);
-                auto removed_slots = std::vector<int>{};
-                for (const auto &slot : nodes_from_.at(dst)) {
-                    if (slot.second == src) {
-                        removed_slots.push_back(slot.first);
-                    }
-                }
-                for (const auto &slot : removed_slots) {
-                    nodes_from_.at(dst).erase(slot);
+            const auto &outputs = storage_->nodes.outputs[src_index];
+            if (std::find(outputs.begin(), outputs.end(), dst_index) != outputs.end()) {
+                plan_valid_ = false;
+                storage_->nodes.unlink(src_index, dst_index);
+            }
+        }
+
+        // Lets src run up to `capacity` values ahead of dst. Once the buffer is full, src is not
+        // polled again until dst has taken a value, and until then src is treated as empty by
+        // everything else that depends on it. Meanwhile dst takes one value from the buffer
+        // whenever it is polled, even in steps where src has nothing new. A capacity of 0 removes
+        // the buffer, discarding anything still in it.
+        // The buffers are only used by step() and run() on a single thread.
+        auto set_buffer(const node_id &src, const node_id &dst, const std::size_t capacity) -> void {
+            const auto src_index = storage_->nodes.index_of(src);
+            const auto dst_index = storage_->nodes.index_of(dst);
+            if (src_index == internal::node_table::none || dst_index == internal::node_table::none) {
+                throw pipeline_error(pipeline_error_kind::invalid_node_id);
+            }
+            auto &table = storage_->nodes;
+            const auto &outputs = table.outputs[src_index];
+            if (std::find(outputs.begin(), outputs.end(), dst_index) == outputs.end()) {
+                throw pipeline_error(pipeline_error_kind::no_such_edge);
+            }
+            plan_valid_ = false;
+
+            auto buffer = table.buffer(src_index, dst_index);
+            if (capacity == 0) {
+                if (buffer != nullptr) {
+                    table.buffers.erase(table.buffers.begin() + (buffer - table.buffers.data()));
                 }
+                reconnect(src_index, dst_index, table.nodes[src_index].get());
+                return;
             }
+            if (buffer == nullptr) {
+                buffer = &table.buffers.emplace_back(internal::edge_buffer{src_index, dst_index, nullptr, {}});
+            }
+            // Queued values are carried over to the new channel, as far as they fit.
+            auto channel = internal::node_access::make_channel(*table.nodes[src_index], capacity);
+            while (buffer->channel != nullptr && channel->size() < capacity && buffer->channel->try_pop()) {
+                channel->try_push(buffer->channel->as_node());
+            }
+            buffer->channel = std::move(channel);
+            buffer->stats.capacity = capacity;
+            reconnect(src_index, dst_index, buffer->channel->as_node());
+        }
+
+        // Throws pipeline_error_kind::no_such_edge if src -> dst is not buffered.
+        auto get_buffer_stats(const node_id &src, const node_id &dst) const -> buffer_stats {
+            const auto src_index = storage_->nodes.index_of(src);
+            const auto dst_index = storage_->nodes.index_of(dst);
+            if (src_index == internal::node_table::none || dst_index == internal::node_table::none) {
+                throw pipeline_error(pipeline_error_kind::invalid_node_id);
+            }
+            const auto buffer = storage_->nodes.buffer(src_index, dst_index);
+            if (buffer == nullptr) {
+                throw pipeline_error(pipeline_error_kind::no_such_edge);
+            }
+            auto stats = buffer->stats;
+            stats.size = buffer->channel->size();
+            return stats;
         }
 
         auto get_dependencies(const node_id &src) const -> std::vector<std::pair<node_id, int>> {
-            if (!nodes_.contains(src)) {
+            const auto src_index = storage_->nodes.index_of(src);
+            if (src_index == internal::node_table::none) {
                 throw pipeline_error(pipeline_error_kind::invalid_node_id);
             }
             auto dependencies = std::vector<std::pair<node_id, int>>{};
-            for (const auto &dst_node : nodes_to_.at(src)) {
-                for (const auto &slot : nodes_from_.at(dst_node)) {
-                    if (slot.second == src) {
-                        dependencies.push_back(std::make_pair(dst_node, slot.first));
+            for (const auto &dst : storage_->nodes.outputs[src_index]) {
+                const auto &inputs = storage_->nodes.inputs[dst];
+                for (std::size_t slot = 0; slot < inputs.size(); ++slot) {
+                    if (inputs[slot] == src_index) {
+                        dependencies.push_back(std::make_pair(storage_->nodes.id_of(dst), static_cast<int>(slot)));
                     }
                 }
             }
@@ -273,75 +1587,258 @@ namespace ppl {
         }
 
         auto is_valid() const -> bool {
-            bool contains_source = false;
-            bool contains_sink = false;
-            for (const auto &node : nodes_) {
-                // All source slots for all nodes must be filled.
-                if (node.second->input_types_.size() != nodes_from_.at(node.first).size()) {
-                    return false;
-                }
-                // All non-sink nodes must have at least one dependent.
-                if (!node.second->is_sink && nodes_to_.at(node.first).size() == 0) {
-                    return false;
-                }
-                if (node.second->is_source) {
-                    contains_source = true;
-                }
-                if (node.second->is_sink) {
-                    contains_sink = true;
-                }
-            }
-            return true && contains_source && contains_sink && internal::is_connected(nodes_, nodes_to_, nodes_from_)
-             && !internal::has_cycle(nodes_, nodes_to_);
+            return storage_->nodes.is_valid();
         }
 
         auto step() -> bool {
-            auto stack = internal::topological_sort(nodes_, nodes_to_);
-            node_polls_.clear();
-            while (!stack.empty()) {
-                const auto node = stack.top();
-                if (!(node_polls_.contains(node) && (node_polls_.at(node) == poll::closed || node_polls_.at(node) == poll::empty))) {
-                    const auto result = nodes_.at(node)->poll_next();
-                    if (node_polls_.contains(node)) {
-                        node_polls_.at(node) = result;
-                    } else {
-                        node_polls_.emplace(node, result);
-                    }
-                    if (result == poll::ready || result == poll::empty) {
-                        if (result == poll::empty) {
-                            // Make all dependent nodes empty
-                            internal::update_poll(nodes_to_.at(node), result, node_polls_, nodes_to_);
-                        }
-                    } else {
-                        // Make all dependent nodes closed
-                        internal::update_poll(nodes_to_.at(node), result, node_polls_, nodes_to_);
+            compile();
+            if (storage_->trace.os != nullptr) {
+                internal::write_trace(storage_->trace, false);
+            }
+            if (!storage_->nodes.buffers.empty()) {
+                internal::step_buffered(storage_->plan);
+                return sinks_closed();
+            }
+            if (pool_ != nullptr && storage_->plan.acyclic) {
+                pool_->run_step(storage_->plan);
+                return sinks_closed();
+            }
+            auto &plan = storage_->plan;
+            std::fill(plan.polls.begin(), plan.polls.end(), poll::ready);
+            for (std::size_t u = 0; u + 1 < plan.unit_offsets.size(); ++u) {
+                // Within a fused chain, each node's only input is the node before it.
+                auto status = internal::input_status(plan, plan.unit_offsets[u]);
+                for (auto i = plan.unit_offsets[u]; i < plan.unit_offsets[u + 1]; ++i) {
+                    if (status == poll::ready) {
+                        status = internal::poll_node(*plan.nodes[i], plan.batch_sizes[i]);
                     }
+                    plan.polls[i] = status;
                 }
-                stack.pop();
             }
 
-            for (const auto &node : nodes_) {
-                if (node.second->is_sink && !(node_polls_.contains(node.first) && node_polls_.at(node.first) == poll::closed)) {
-                    return false;
-                }
-            }
-            return true;
+            return sinks_closed();
+        }
+
+        // The most values a batch node may publish per step.
+        auto batch_size() const noexcept -> std::size_t {
+            return batch_size_;
+        }
+
+        auto set_batch_size(const std::size_t size) -> void {
+            assert(size > 0);
+            batch_size_ = size;
+            plan_valid_ = false;
+        }
+
+        // The number of threads step() polls nodes on. With a single thread (the default), nodes
+        // are polled one at a time in a fixed topological order.
+        auto threads() const noexcept -> std::size_t {
+            return pool_ == nullptr ? 1 : pool_->threads();
+        }
+
+        auto set_threads(const std::size_t threads) -> void {
+            pool_ = threads > 1 ? std::make_unique<internal::work_stealing_pool>(threads) : nullptr;
+        }
+
+        // Whether stepping again is pointless until something outside the pipeline happens: after
+        // the last step, every source was either closed or parked, and no buffer held a value.
+        auto idle() const -> bool {
+            return stalled(true);
+        }
+
+        // The number of times the pipeline has asked its upstream memory resource for memory.
+        // Once the graph stops changing, step() should leave this alone.
+        auto allocations() const noexcept -> std::size_t {
+            return storage_->counter.allocations();
         }
 
         void run() {
             while (!step()) {}
         }
 
+        // Runs the pipeline to completion like run(), but waits according to `strategy` while
+        // every source keeps coming up empty, rather than spinning.
+        template <wait_strategy Strategy>
+        auto run(Strategy strategy) -> void {
+            auto idle_steps = std::size_t{0};
+            while (!step()) {
+                if (!stalled()) {
+                    idle_steps = 0;
+                } else if (strategy.wait(++idle_steps, storage_->waker)) {
+                    idle_steps = 0;
+                }
+            }
+        }
+
+        // Interrupts run(strategy) if it is waiting. Safe to call from any thread.
+        auto wake() -> void {
+            storage_->waker.wake();
+        }
+
+        // For sources that know when they have new data, so that they can call wake() themselves.
+        auto get_waker() -> waker& {
+            return storage_->waker;
+        }
+
+        // Runs the pipeline to completion with its nodes spread across `threads` worker threads
+        // (by default, one per core). Rather than moving in lockstep, each edge carries copies of
+        // its producer's values through a queue holding up to `channel_capacity` of them.
+        auto run_parallel(const std::size_t threads = 0, const std::size_t channel_capacity = 64) -> void {
+            compile();
+            internal::run_parallel(storage_->plan, threads, channel_capacity);
+        }
+
+        // Puts a node in a partition. Every node starts in partition 0.
+        auto set_partition(const node_id &n_id, const std::size_t partition) -> void {
+            const auto index = storage_->nodes.index_of(n_id);
+            if (index == internal::node_table::none) {
+                throw pipeline_error(pipeline_error_kind::invalid_node_id);
+            }
+            plan_valid_ = false;
+            storage_->nodes.partitions[index] = partition;
+        }
+
+        auto get_partition(const node_id &n_id) const -> std::size_t {
+            const auto index = storage_->nodes.index_of(n_id);
+            if (index == internal::node_table::none) {
+                throw pipeline_error(pipeline_error_kind::invalid_node_id);
+            }
+            return storage_->nodes.partitions[index];
+        }
+
+        // Splits the nodes into `count` partitions of roughly equal cost, each one a run of nodes
+        // in topological order. With PPL_PROFILING, a node's cost is the time spent polling it so
+        // far, so step the pipeline for a while first; otherwise every node costs the same.
+        auto partition(const std::size_t count) -> void {
+            compile();
+            internal::balance_partitions(storage_->nodes, storage_->plan, std::max(count, std::size_t{1}));
+            plan_valid_ = false;
+        }
+
+        // Runs the pipeline to completion like run(), but with each partition in a process of its
+        // own. Partition 0 runs in this process, and the rest in child processes forked from it,
+        // so after this returns only the nodes in partition 0 have moved on.
+        // Each edge between partitions carries single values through a ring buffer of
+        // `ring_bytes` bytes in shared memory, so its type needs a ppl::wire. Such edges behave
+        // like buffered edges (see set_buffer()), except that a producer whose ring is full waits
+        // for it to drain. Partitions may not depend on each other in a cycle.
+        // Each value must fit in the ring whole: its ppl::wire encoding, plus 16 bytes of
+        // framing, may take at most `ring_bytes`. A larger value fails the partition that
+        // produced it with std::length_error, which is thrown from here for partition 0.
+        // If a partition's process dies, the edges out of it close, and the rest of the pipeline
+        // runs on without it. The outcome of each partition is returned.
+        auto run_partitioned(const std::size_t ring_bytes = std::size_t{1} << 20) -> std::vector<partition_outcome> {
+            compile();
+            return internal::run_partitioned(storage_->nodes, storage_->plan, ring_bytes);
+        }
+
+        // Appends a checkpoint of the pipeline to `os`, which should only be called between steps.
+        // Checkpoints are incremental: each one only holds the nodes whose saved state has changed
+        // since the previous one written by this pipeline, so they should all go to the same
+        // stream, and restore() reads them back in order. A `complete` checkpoint holds every
+        // node, and can start a new stream.
+        // Values waiting in edge buffers are not saved.
+        auto checkpoint(std::ostream &os, const bool complete = false) -> void {
+            internal::write_checkpoint(storage_->nodes, storage_->checkpoints, os, complete);
+        }
+
+        // Restores every node's state from the checkpoints in `is`, which must have been taken
+        // from a pipeline of the same shape, built in the same order. Returns false, leaving the
+        // pipeline alone, if there are no checkpoints. A checkpoint cut short at the end of the
+        // stream, say by a crash, is ignored in favour of the one before it.
+        // The next checkpoint is complete, so it can start a new stream.
+        auto restore(std::istream &is) -> bool {
+            return internal::read_checkpoint(storage_->nodes, storage_->checkpoints, is);
+        }
+
+        // Records every poll of every source, along with the values it published, to `os`. The
+        // trace is written a piece at a time as the pipeline steps, and finished by end_trace().
+        // Every source's output type needs a ppl::wire.
+        auto record(std::ostream &os) -> void {
+            plan_valid_ = false;
+            internal::record_trace(storage_->nodes, storage_->trace, os);
+        }
+
+        // Swaps every source for a stand-in that replays what it did in a trace recorded by
+        // record(), from a pipeline of the same shape, built in the same order. The stand-ins
+        // never wait for anything, so the rest of the pipeline runs as fast as it can, taking
+        // exactly the steps it took while being recorded. Each stand-in closes once it has
+        // replayed all of its polls. The whole trace is read in up front.
+        auto replay(std::istream &is) -> void {
+            plan_valid_ = false;
+            internal::replay_trace(storage_->nodes, storage_->trace, is);
+        }
+
+        // Finishes the trace being recorded, or stops replaying one, and puts the real sources
+        // back. Erasing a source ends the trace too.
+        auto end_trace() -> void {
+            plan_valid_ = false;
+            internal::end_trace(storage_->nodes, storage_->trace);
+        }
+
+#ifdef PPL_PROFILING
+        auto profile(const node_id &n_id) const -> const node_profile& {
+            const auto index = storage_->nodes.index_of(n_id);
+            if (index == internal::node_table::none) {
+                throw pipeline_error(pipeline_error_kind::invalid_node_id);
+            }
+            return storage_->nodes.nodes[index]->profile_;
+        }
+
+        auto reset_profiles() -> void {
+            for (auto &n : storage_->nodes.nodes) {
+                if (n != nullptr) {
+                    n->profile_ = node_profile{};
+                }
+            }
+        }
+
+        // Writes a CSV table of every node's profile, with the nodes that took longest first.
+        auto dump_profiles(std::ostream &os) const -> void {
+            const auto &table = storage_->nodes;
+            auto indices = std::vector<std::size_t>{};
+            for (std::size_t i = 0; i < table.nodes.size(); ++i) {
+                if (table.nodes[i] != nullptr) {
+                    indices.push_back(i);
+                }
+            }
+            std::sort(indices.begin(), indices.end(), [&](const auto a, const auto b) {
+                const auto &pa = table.nodes[a]->profile_;
+                const auto &pb = table.nodes[b]->profile_;
+                return pa.total_time != pb.total_time ? pa.total_time > pb.total_time : table.id_of(a) < table.id_of(b);
+            });
+
+            os << "id,name,polls,ready,empty,closed,values,total_ns,p50_ns,p99_ns\n";
+            for (const auto &index : indices) {
+                const auto &p = table.nodes[index]->profile_;
+                os << table.id_of(index) << ',' << table.nodes[index]->name() << ',' << p.polls << ',' << p.ready
+                    << ',' << p.empty << ',' << p.closed << ',' << p.values << ',' << p.total_time.count()
+                    << ',' << p.percentile(0.5).count() << ',' << p.percentile(0.99).count() << '\n';
+            }
+        }
+#endif
+
         friend std::ostream &operator<<(std::ostream &os, const pipeline &pipe) {
+            const auto &table = pipe.storage_->nodes;
+            auto ids = std::vector<std::pair<node_id, std::size_t>>{};
+            for (std::size_t i = 0; i < table.nodes.size(); ++i) {
+                if (table.nodes[i] != nullptr) {
+                    ids.emplace_back(table.id_of(i), i);
+                }
+            }
+            std::sort(ids.begin(), ids.end());
+
             os << "digraph G {\n";
-            for (const auto &node : pipe.nodes_) {
-                os << "  \"" + std::to_string(node.first) + " " + node.second->name() + "\"\n";
+            for (const auto &[id, index] : ids) {
+                os << "  \"" + std::to_string(id) + " " + table.nodes[index]->name() + "\"\n";
             }
             auto edges_list = std::vector<std::pair<int, int>>{};
 
-            for (const auto &nodes_from : pipe.nodes_from_) {
-                for (const auto &node : nodes_from.second) {
-                    edges_list.push_back({node.second, nodes_from.first});
+            for (const auto &[id, index] : ids) {
+                for (const auto &src : table.inputs[index]) {
+                    if (src != internal::node_table::none) {
+                        edges_list.push_back({table.id_of(src), id});
+                    }
                 }
             }
 
@@ -355,8 +1852,56 @@ namespace ppl {
 
             os << '\n';
             for (const auto &edge : edges_list) {
-                os << "  \"" + std::to_string(edge.first) + " " + pipe.nodes_.at(edge.first)->name()
-                    + "\" -> \"" + std::to_string(edge.second) + " " + pipe.nodes_.at(edge.second)->name() + "\"\n";
+                os << "  \"" + std::to_string(edge.first) + " " + pipe.get_node(edge.first)->name()
+                    + "\" -> \"" + std::to_string(edge.second) + " " + pipe.get_node(edge.second)->name() + "\"\n";
+            }
+
+            auto chains = internal::fused_chains(table, std::pmr::get_default_resource());
+            std::sort(chains.begin(), chains.end(), [&](const auto &a, const auto &b) {
+                return table.id_of(a.front()) < table.id_of(b.front());
+            });
+            const auto label = [&](const std::size_t index) {
+                return "\"" + std::to_string(table.id_of(index)) + " " + table.nodes[index]->name() + "\"\n";
+            };
+            auto partitions = std::set<std::size_t>{};
+            for (const auto &[id, index] : ids) {
+                partitions.insert(table.partitions[index]);
+            }
+            if (partitions.empty() || *partitions.rbegin() == 0) {
+                for (std::size_t c = 0; c < chains.size(); ++c) {
+                    os << "\n  subgraph \"cluster_fused_" + std::to_string(c) + "\" {\n    label=\"fused\"\n";
+                    for (const auto &index : chains[c]) {
+                        os << "    " + label(index);
+                    }
+                    os << "  }\n";
+                }
+            } else {
+                // Each partition holds the parts of the fused chains that run in it.
+                auto fused = std::size_t{0};
+                for (const auto &p : partitions) {
+                    os << "\n  subgraph \"cluster_partition_" + std::to_string(p) + "\" {\n    label=\"partition "
+                        + std::to_string(p) + "\"\n";
+                    for (const auto &[id, index] : ids) {
+                        if (table.partitions[index] == p) {
+                            os << "    " + label(index);
+                        }
+                    }
+                    for (const auto &chain : chains) {
+                        auto members = std::vector<std::size_t>{};
+                        std::copy_if(chain.begin(), chain.end(), std::back_inserter(members), [&](const auto index) {
+                            return table.partitions[index] == p;
+                        });
+                        if (members.size() < 2) {
+                            continue;
+                        }
+                        os << "    subgraph \"cluster_fused_" + std::to_string(fused++) + "\" {\n      label=\"fused\"\n";
+                        for (const auto &index : members) {
+                            os << "      " + label(index);
+                        }
+                        os << "    }\n";
+                    }
+                    os << "  }\n";
+                }
             }
 
             os << "}\n";
@@ -364,11 +1909,73 @@ namespace ppl {
         }
 
     private:
-        std::map<node_id, std::unique_ptr<node>> nodes_;
-        node_id latest_id_;
-        std::map<node_id, poll> node_polls_;
-        std::map<node_id, std::set<node_id>> nodes_to_;
-        std::map<node_id, std::map<int, node_id>> nodes_from_;
+        // Whether the last step got nothing from any source and left nothing in any buffer or
+        // backlog, so that stepping again only helps once a source has something new. If `parked`, every
+        // empty source must also be parked.
+        auto stalled(const bool parked = false) const -> bool {
+            if (!plan_valid_) {
+                return false;
+            }
+            const auto &plan = storage_->plan;
+            for (std::size_t i = 0; i < plan.nodes.size(); ++i) {
+                if (plan.upstream_offsets[i] != plan.upstream_offsets[i + 1] || !plan.nodes[i]->is_source) {
+                    continue;
+                }
+                if (plan.polls[i] == poll::ready || (parked && plan.polls[i] == poll::empty && !plan.nodes[i]->parked())) {
+                    return false;
+                }
+            }
+            for (const auto &n : plan.nodes) {
+                if (const auto any = internal::node_access::multirate_of(*n); any != nullptr && internal::node_access::backlog(*any)) {
+                    return false;
+                }
+            }
+            for (const auto &buffer : storage_->nodes.buffers) {
+                if (!buffer.channel->empty()) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Connects every slot of dst fed by src to `producer` instead.
+        auto reconnect(const std::size_t src, const std::size_t dst, const node* producer) -> void {
+            const auto &inputs = storage_->nodes.inputs[dst];
+            for (std::size_t slot = 0; slot < inputs.size(); ++slot) {
+                if (inputs[slot] == src) {
+                    storage_->nodes.nodes[dst]->connect(producer, static_cast<int>(slot));
+                }
+            }
+        }
+
+        auto sinks_closed() const -> bool {
+            for (const auto sink : storage_->plan.sinks) {
+                if (storage_->plan.polls[sink] != poll::closed) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        auto compile() -> void {
+            if (!plan_valid_) {
+                storage_->plan = internal::compile_plan(storage_->nodes, batch_size_, storage_->search);
+                plan_valid_ = true;
+            }
+        }
+
+        auto swap(pipeline &other) noexcept -> void {
+            std::swap(storage_, other.storage_);
+            std::swap(plan_valid_, other.plan_valid_);
+            std::swap(batch_size_, other.batch_size_);
+            std::swap(pool_, other.pool_);
+        }
+
+        std::unique_ptr<internal::pipeline_storage> storage_;
+        // Rebuilt lazily by step() whenever the graph has changed shape.
+        bool plan_valid_ = false;
+        std::size_t batch_size_ = 256;
+        std::unique_ptr<internal::work_stealing_pool> pool_;
     };
 }
 
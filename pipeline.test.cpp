@@ -1,13 +1,27 @@
 #include "./pipeline.h"
+#include <atomic>
+#include <chrono>
+#include <csignal>
 #include <cstddef>
 #include <fstream>
 #include <iostream>
+#include <memory_resource>
+#include <new>
+#include <optional>
 #include <ostream>
 #include <string>
+#include <thread>
 #include <tuple>
 #include <vector>
+#include <set>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <utility>
+
+#include <sys/types.h>
+#include <unistd.h>
 
 #include <catch2/catch.hpp>
 
@@ -96,6 +110,22 @@ TEST_CASE("Testing get_node") {
     CHECK(pipeline.get_node(source) == nullptr);
 }
 
+TEST_CASE("Testing that node IDs expire even when their storage is reused") {
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<simplest_source<int>>();
+    auto seen = std::set<ppl::pipeline::node_id>{source};
+    auto previous = source;
+    for (auto i = 0; i < 300; ++i) {
+        pipeline.erase_node(previous);
+        const auto next = pipeline.create_node<simplest_sink<int>>();
+        CHECK(pipeline.get_node(previous) == nullptr);
+        CHECK_THROWS_AS(pipeline.connect(previous, next, 0), ppl::pipeline_error);
+        CHECK(pipeline.get_node(next) != nullptr);
+        CHECK(seen.insert(next).second);
+        previous = next;
+    }
+}
+
 TEST_CASE("Testing connection type match and mismatch") {
 	auto pipeline = ppl::pipeline{};
     const auto source1 = pipeline.create_node<simplest_source<int>>();
@@ -404,6 +434,51 @@ TEST_CASE("Testing is_valid for 'There are no cycles.' when a node is connected
     CHECK(!pipeline.is_valid());
 }
 
+TEST_CASE("Testing is_valid with several sources feeding one node") {
+    auto pipeline = ppl::pipeline{};
+    const auto source1 = pipeline.create_node<simplest_source<int>>();
+    const auto source2 = pipeline.create_node<simplest_source<int>>();
+    const auto c1 = pipeline.create_node<simplest_component<std::tuple<int, int>, int>>();
+    const auto sink = pipeline.create_node<simplest_sink<int>>();
+    pipeline.connect(source1, c1, 0);
+    pipeline.connect(source2, c1, 1);
+    pipeline.connect(c1, sink, 0);
+    CHECK(pipeline.is_valid());
+}
+
+TEST_CASE("Testing is_valid once a cycle is broken away from the edge that closed it") {
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<simplest_source<int>>();
+    const auto c1 = pipeline.create_node<simplest_component<std::tuple<int, int>, int>>();
+    const auto c2 = pipeline.create_node<simplest_component<std::tuple<int>, int>>();
+    const auto c3 = pipeline.create_node<simplest_component<std::tuple<int>, int>>();
+    const auto sink = pipeline.create_node<simplest_sink<int>>();
+
+    // c3 -> c1 closes the cycle amongst c1, c2, c3
+    pipeline.connect(source, c1, 0);
+    pipeline.connect(c1, c2, 0);
+    pipeline.connect(c2, c3, 0);
+    pipeline.connect(c3, c1, 1);
+    pipeline.connect(c3, sink, 0);
+    CHECK(!pipeline.is_valid());
+
+    // Break the cycle between c1 and c2 instead
+    pipeline.disconnect(c1, c2);
+    pipeline.connect(source, c2, 0);
+    const auto sink2 = pipeline.create_node<simplest_sink<int>>();
+    pipeline.connect(c1, sink2, 0);
+    CHECK(pipeline.is_valid());
+
+    // Close it again, then break it by erasing a node
+    pipeline.disconnect(source, c2);
+    pipeline.connect(c1, c2, 0);
+    CHECK(!pipeline.is_valid());
+    pipeline.erase_node(c2);
+    const auto source2 = pipeline.create_node<simplest_source<int>>();
+    pipeline.connect(source2, c3, 0);
+    CHECK(pipeline.is_valid());
+}
+
 TEST_CASE("Testing visual representation: simple") {
     auto pipeline = ppl::pipeline{};
     const auto hello = pipeline.create_node<simplest_component<std::tuple<int, int>, int>>("hello");
@@ -820,4 +895,1294 @@ TEST_CASE("Testing that dependent nodes can be reopened if closed source was rep
     std::sort(polled.begin(), polled.end());
     CHECK(polled == std::vector<std::string>{"c", "new_source", "sink"});
     polled.clear();
-}
\ No newline at end of file
+}
+TEST_CASE("Testing that step picks up graph changes made between steps") {
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<int_source>(0, "source");
+    const auto sink = pipeline.create_node<simple_sink<int>>("sink");
+    pipeline.connect(source, sink, 0);
+
+    CHECK(!pipeline.step());
+    std::sort(polled.begin(), polled.end());
+    CHECK(polled == std::vector<std::string>{"sink", "source"});
+    polled.clear();
+    CHECK(static_cast<simple_sink<int>*>(pipeline.get_node(sink))->outcome() == 1);
+
+    // Insert a component between the source and the sink
+    pipeline.disconnect(source, sink);
+    const auto c = pipeline.create_node<int_component>("c");
+    pipeline.connect(source, c, 0);
+    pipeline.connect(c, sink, 0);
+    CHECK(!pipeline.step());
+    std::sort(polled.begin(), polled.end());
+    CHECK(polled == std::vector<std::string>{"c", "sink", "source"});
+    polled.clear();
+    CHECK(static_cast<simple_sink<int>*>(pipeline.get_node(sink))->outcome() == 2);
+}
+
+struct counting_batch_source : ppl::batch_source<int> {
+    int next_ = 1;
+    const int last_;
+    std::vector<int> vals_;
+
+    counting_batch_source(const int &last): last_{last} {}
+
+    auto name() const -> std::string override {
+        return "counting_batch_source";
+    }
+
+    auto poll_next_batch(const std::size_t max) -> ppl::poll override {
+        vals_.clear();
+        while (vals_.size() < max && next_ <= last_) {
+            vals_.push_back(next_++);
+        }
+        return vals_.empty() ? ppl::poll::closed : ppl::poll::ready;
+    }
+
+    auto values() const -> std::span<const int> override {
+        return vals_;
+    }
+};
+
+struct doubling_batch_component : ppl::batch_component<std::tuple<int>, int> {
+    ppl::batch_input<int> in_;
+    std::vector<int> vals_;
+
+    auto name() const -> std::string override {
+        return "doubling_batch_component";
+    }
+
+    auto connect(const ppl::node* src, int) -> void override {
+        in_.connect(src);
+    }
+
+    auto poll_next_batch(const std::size_t) -> ppl::poll override {
+        vals_.clear();
+        for (const auto &val : in_.values()) {
+            vals_.push_back(val * 2);
+        }
+        return ppl::poll::ready;
+    }
+
+    auto values() const -> std::span<const int> override {
+        return vals_;
+    }
+};
+
+struct summing_batch_sink : ppl::batch_sink<int> {
+    ppl::batch_input<int> in_;
+    int sum_ = 0;
+    int polls_ = 0;
+    std::size_t max_ = 0;
+
+    auto name() const -> std::string override {
+        return "summing_batch_sink";
+    }
+
+    auto connect(const ppl::node* src, int) -> void override {
+        in_.connect(src);
+    }
+
+    auto poll_next_batch(const std::size_t max) -> ppl::poll override {
+        polls_++;
+        max_ = max;
+        for (const auto &val : in_.values()) {
+            sum_ += val;
+        }
+        return ppl::poll::ready;
+    }
+};
+
+TEST_CASE("Testing step drives batch nodes with whole batches") {
+    auto pipeline = ppl::pipeline{};
+    pipeline.set_batch_size(4);
+    const auto source = pipeline.create_node<counting_batch_source>(10);
+    const auto c = pipeline.create_node<doubling_batch_component>();
+    const auto sink = pipeline.create_node<summing_batch_sink>();
+    pipeline.connect(source, c, 0);
+    pipeline.connect(c, sink, 0);
+    pipeline.run();
+
+    const auto result = static_cast<summing_batch_sink*>(pipeline.get_node(sink));
+    CHECK(result->sum_ == 110);
+    // Batches of 4, 4 and 2 values
+    CHECK(result->polls_ == 3);
+}
+
+TEST_CASE("Testing batch nodes fall back to single values next to scalar nodes") {
+    auto pipeline = ppl::pipeline{};
+    pipeline.set_batch_size(4);
+    const auto source = pipeline.create_node<counting_batch_source>(10);
+    const auto c = pipeline.create_node<doubling_batch_component>();
+    const auto sink = pipeline.create_node<simple_sink<int>>("sink");
+    const auto batch_sink = pipeline.create_node<summing_batch_sink>();
+    pipeline.connect(source, c, 0);
+    pipeline.connect(c, sink, 0);
+    pipeline.connect(c, batch_sink, 0);
+
+    CHECK(!pipeline.step());
+    CHECK(static_cast<simple_sink<int>*>(pipeline.get_node(sink))->outcome() == 2);
+    CHECK(!pipeline.step());
+    CHECK(static_cast<simple_sink<int>*>(pipeline.get_node(sink))->outcome() == 4);
+    polled.clear();
+
+    pipeline.erase_node(sink);
+    pipeline.run();
+    const auto result = static_cast<summing_batch_sink*>(pipeline.get_node(batch_sink));
+    CHECK(result->sum_ == 110);
+    // 2 single values, then two batches of 4 values
+    CHECK(result->polls_ == 4);
+}
+
+struct range_source : ppl::source<int> {
+    int val_ = 0;
+    const int last_;
+
+    range_source(const int &last): last_{last} {}
+
+    auto name() const -> std::string override {
+        return "range_source";
+    }
+
+    auto poll_next() -> ppl::poll override {
+        if (val_ >= last_) {
+            return ppl::poll::closed;
+        }
+        val_++;
+        return ppl::poll::ready;
+    }
+
+    auto value() const -> const int& override {
+        return val_;
+    }
+};
+
+TEST_CASE("Testing batch nodes downstream of scalar nodes keep running in batch mode") {
+    auto pipeline = ppl::pipeline{};
+    pipeline.set_batch_size(4);
+    const auto source = pipeline.create_node<range_source>(10);
+    const auto c = pipeline.create_node<doubling_batch_component>();
+    const auto sink = pipeline.create_node<summing_batch_sink>();
+    pipeline.connect(source, c, 0);
+    pipeline.connect(c, sink, 0);
+    pipeline.run();
+
+    const auto result = static_cast<summing_batch_sink*>(pipeline.get_node(sink));
+    CHECK(result->sum_ == 110);
+    // Only what feeds a scalar node has to be polled for single values.
+    CHECK(result->max_ == 4);
+}
+
+struct adding_component : ppl::component<std::tuple<int, int>, int> {
+    int val_ = 0;
+    const ppl::producer<int>* slot0 = nullptr;
+    const ppl::producer<int>* slot1 = nullptr;
+
+    auto name() const -> std::string override {
+        return "adding_component";
+    }
+
+    auto connect(const ppl::node* src, int slot) -> void override {
+        if (slot == 0) {
+            slot0 = static_cast<const ppl::producer<int>*>(src);
+        } else {
+            slot1 = static_cast<const ppl::producer<int>*>(src);
+        }
+    }
+
+    auto poll_next() -> ppl::poll override {
+        val_ = slot0->value() + slot1->value();
+        return ppl::poll::ready;
+    }
+
+    auto value() const -> const int& override {
+        return val_;
+    }
+};
+
+struct collecting_sink : ppl::sink<int> {
+    std::vector<int> vals_;
+    const ppl::producer<int>* slot0 = nullptr;
+
+    auto name() const -> std::string override {
+        return "collecting_sink";
+    }
+
+    auto connect(const ppl::node* src, int) -> void override {
+        slot0 = static_cast<const ppl::producer<int>*>(src);
+    }
+
+    auto poll_next() -> ppl::poll override {
+        vals_.push_back(slot0->value());
+        return ppl::poll::ready;
+    }
+};
+
+TEST_CASE("Testing a moved-from pipeline is empty but still works") {
+    auto pipeline = ppl::pipeline{};
+    pipeline.set_batch_size(8);
+    const auto source = pipeline.create_node<range_source>(3);
+    const auto sink = pipeline.create_node<collecting_sink>();
+    pipeline.connect(source, sink, 0);
+
+    auto moved = std::move(pipeline);
+    CHECK(moved.batch_size() == 8);
+    CHECK(pipeline.get_node(source) == nullptr);
+    CHECK_THROWS_AS(pipeline.erase_node(source), ppl::pipeline_error);
+    CHECK_THROWS_AS(pipeline.connect(source, sink, 0), ppl::pipeline_error);
+    CHECK(pipeline.step());
+
+    // It takes new nodes, and can be moved into another pipeline in turn.
+    const auto again = pipeline.create_node<collecting_sink>();
+    pipeline.connect(pipeline.create_node<range_source>(2), again, 0);
+    moved = std::move(pipeline);
+    CHECK(pipeline.get_node(again) == nullptr);
+    moved.run();
+    CHECK(static_cast<collecting_sink*>(moved.get_node(again))->vals_ == std::vector<int>{1, 2});
+    pipeline.connect(pipeline.create_node<range_source>(1), pipeline.create_node<collecting_sink>(), 0);
+    pipeline.run();
+}
+
+TEST_CASE("Testing run_parallel delivers every value in order") {
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<range_source>(1000);
+    const auto c = pipeline.create_node<adding_component>();
+    const auto sink1 = pipeline.create_node<collecting_sink>();
+    const auto sink2 = pipeline.create_node<collecting_sink>();
+    pipeline.connect(source, c, 0);
+    pipeline.connect(source, c, 1);
+    pipeline.connect(c, sink1, 0);
+    pipeline.connect(source, sink2, 0);
+    pipeline.run_parallel(4, 2);
+
+    auto expected1 = std::vector<int>{};
+    auto expected2 = std::vector<int>{};
+    for (auto i = 1; i <= 1000; ++i) {
+        expected1.push_back(2 * i);
+        expected2.push_back(i);
+    }
+    CHECK(static_cast<collecting_sink*>(pipeline.get_node(sink1))->vals_ == expected1);
+    CHECK(static_cast<collecting_sink*>(pipeline.get_node(sink2))->vals_ == expected2);
+}
+
+TEST_CASE("Testing run_parallel closes dependents of a closed node") {
+    auto pipeline = ppl::pipeline{};
+    const auto source1 = pipeline.create_node<range_source>(3);
+    const auto source2 = pipeline.create_node<range_source>(1000000);
+    const auto c = pipeline.create_node<adding_component>();
+    const auto sink = pipeline.create_node<collecting_sink>();
+    pipeline.connect(source1, c, 0);
+    pipeline.connect(source2, c, 1);
+    pipeline.connect(c, sink, 0);
+    pipeline.run_parallel(2);
+    CHECK(static_cast<collecting_sink*>(pipeline.get_node(sink))->vals_ == std::vector<int>{2, 4, 6});
+
+    // Consumers are reconnected to their producers afterwards
+    CHECK(pipeline.step());
+}
+
+TEST_CASE("Testing step with several threads matches a single thread") {
+    const auto build = [](ppl::pipeline &pipeline, std::vector<ppl::pipeline::node_id> &sinks) {
+        const auto source1 = pipeline.create_node<range_source>(100);
+        const auto source2 = pipeline.create_node<range_source>(50);
+        for (auto i = 0; i < 16; ++i) {
+            const auto c = pipeline.create_node<adding_component>();
+            pipeline.connect(source1, c, 0);
+            pipeline.connect(i % 2 == 0 ? source1 : source2, c, 1);
+            sinks.push_back(pipeline.create_node<collecting_sink>());
+            pipeline.connect(c, sinks.back(), 0);
+        }
+    };
+
+    auto sequential = ppl::pipeline{};
+    auto sequential_sinks = std::vector<ppl::pipeline::node_id>{};
+    build(sequential, sequential_sinks);
+    sequential.run();
+
+    auto parallel = ppl::pipeline{};
+    auto parallel_sinks = std::vector<ppl::pipeline::node_id>{};
+    build(parallel, parallel_sinks);
+    parallel.set_threads(4);
+    CHECK(parallel.threads() == 4);
+    parallel.run();
+
+    for (std::size_t i = 0; i < sequential_sinks.size(); ++i) {
+        const auto expected = static_cast<collecting_sink*>(sequential.get_node(sequential_sinks[i]))->vals_;
+        CHECK(expected.size() == (i % 2 == 0 ? 100 : 50));
+        CHECK(static_cast<collecting_sink*>(parallel.get_node(parallel_sinks[i]))->vals_ == expected);
+    }
+}
+
+TEST_CASE("Testing an empty source in a deep diamond lattice skips its dependents in one pass") {
+    polled.clear();
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<int_source>(-1, "source");
+    auto layer = std::pair{source, source};
+    // Every node depends on both nodes in the layer above it, so there are 2^30 paths to the sink
+    for (auto i = 0; i < 30; ++i) {
+        const auto left = pipeline.create_node<adding_component>();
+        const auto right = pipeline.create_node<adding_component>();
+        for (const auto &node : {left, right}) {
+            pipeline.connect(layer.first, node, 0);
+            pipeline.connect(layer.second, node, 1);
+        }
+        layer = {left, right};
+    }
+    const auto sink1 = pipeline.create_node<collecting_sink>();
+    const auto sink2 = pipeline.create_node<collecting_sink>();
+    pipeline.connect(layer.first, sink1, 0);
+    pipeline.connect(layer.second, sink2, 0);
+
+    CHECK(!pipeline.step());
+    CHECK(static_cast<collecting_sink*>(pipeline.get_node(sink1))->vals_.empty());
+    CHECK(!pipeline.step());
+    CHECK(static_cast<collecting_sink*>(pipeline.get_node(sink1))->vals_ == std::vector<int>{1 << 30});
+    polled.clear();
+}
+
+TEST_CASE("Testing a very long chain of nodes does not overflow the stack") {
+    auto pipeline = ppl::pipeline{};
+    auto previous = pipeline.create_node<simplest_source<int>>();
+    for (auto i = 0; i < 200000; ++i) {
+        const auto next = pipeline.create_node<simplest_component<std::tuple<int>, int>>();
+        pipeline.connect(previous, next, 0);
+        previous = next;
+    }
+    pipeline.connect(previous, pipeline.create_node<simplest_sink<int>>(), 0);
+    CHECK(pipeline.is_valid());
+    CHECK(!pipeline.step());
+}
+
+TEST_CASE("Testing nodes and scheduling state come from the pipeline's memory resource") {
+    SECTION("Steps allocate nothing once the plan is built") {
+        auto pipeline = ppl::pipeline{std::pmr::new_delete_resource()};
+        const auto source = pipeline.create_node<simplest_source<int>>();
+        const auto component = pipeline.create_node<simplest_component<std::tuple<int, int>, int>>();
+        pipeline.connect(source, component, 0);
+        pipeline.connect(source, component, 1);
+        pipeline.connect(component, pipeline.create_node<simplest_sink<int>>(), 0);
+        pipeline.connect(source, pipeline.create_node<simplest_sink<int>>(), 0);
+        CHECK(pipeline.allocations() > 0);
+
+        CHECK(!pipeline.step());
+        const auto allocations = pipeline.allocations();
+        for (auto i = 0; i < 1000; ++i) {
+            pipeline.step();
+        }
+        CHECK(pipeline.allocations() == allocations);
+    }
+
+    SECTION("Everything allocated from the resource is given back") {
+        struct tracking_resource : std::pmr::memory_resource {
+            std::size_t allocations = 0;
+            std::size_t outstanding = 0;
+
+            auto do_allocate(std::size_t bytes, std::size_t alignment) -> void* override {
+                allocations++;
+                outstanding += bytes;
+                return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+            }
+
+            auto do_deallocate(void* p, std::size_t bytes, std::size_t alignment) -> void override {
+                outstanding -= bytes;
+                std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+            }
+
+            auto do_is_equal(const std::pmr::memory_resource &other) const noexcept -> bool override {
+                return this == &other;
+            }
+        };
+
+        auto upstream = tracking_resource{};
+        {
+            auto pipeline = ppl::pipeline{&upstream};
+            const auto source = pipeline.create_node<simplest_source<int>>();
+            for (auto i = 0; i < 100; ++i) {
+                pipeline.connect(source, pipeline.create_node<simplest_sink<int>>(), 0);
+            }
+            pipeline.step();
+            CHECK(pipeline.allocations() == upstream.allocations);
+            CHECK(upstream.outstanding > 100 * sizeof(simplest_sink<int>));
+        }
+        CHECK(upstream.outstanding == 0);
+    }
+}
+
+TEST_CASE("Testing linear chains of components are fused into one scheduling unit") {
+    polled.clear();
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<int_source>(-1, "source");
+    const auto a = pipeline.create_node<int_component>("a");
+    const auto b = pipeline.create_node<int_component>("b");
+    const auto c = pipeline.create_node<int_component>("c");
+    const auto d = pipeline.create_node<int_component>("d");
+    const auto sink1 = pipeline.create_node<simple_sink<int>>("sink1");
+    const auto sink2 = pipeline.create_node<simple_sink<int>>("sink2");
+    pipeline.connect(source, a, 0);
+    pipeline.connect(a, b, 0);
+    pipeline.connect(b, c, 0);
+    // c has two dependents, so the chain ends there, and d is on its own
+    pipeline.connect(c, sink1, 0);
+    pipeline.connect(c, d, 0);
+    pipeline.connect(d, sink2, 0);
+
+    std::stringstream ss;
+    ss << pipeline;
+    CHECK(ss.str() == "digraph G {\n  \"1 source\"\n  \"2 a\"\n  \"3 b\"\n  \"4 c\"\n  \"5 d\"\n  \"6 sink1\"\n"
+    "  \"7 sink2\"\n\n  \"1 source\" -> \"2 a\"\n  \"2 a\" -> \"3 b\"\n  \"3 b\" -> \"4 c\"\n  \"4 c\" -> \"5 d\"\n"
+    "  \"4 c\" -> \"6 sink1\"\n  \"5 d\" -> \"7 sink2\"\n\n  subgraph \"cluster_fused_0\" {\n    label=\"fused\"\n"
+    "    \"2 a\"\n    \"3 b\"\n    \"4 c\"\n  }\n}\n");
+
+    // The source is empty at first, so the whole chain is skipped with it
+    CHECK(!pipeline.step());
+    CHECK(polled == std::vector<std::string>{"source"});
+    polled.clear();
+    CHECK(!pipeline.step());
+    const auto first = std::find(polled.begin(), polled.end(), "a");
+    REQUIRE(std::distance(first, polled.end()) >= 3);
+    CHECK(std::vector<std::string>(first, first + 3) == std::vector<std::string>{"a", "b", "c"});
+    CHECK(polled.size() == 7);
+    CHECK(static_cast<simple_sink<int>*>(pipeline.get_node(sink2))->outcome() == 1);
+
+    // Splitting the chain leaves only b and c fused
+    pipeline.disconnect(a, b);
+    ss.str("");
+    ss << pipeline;
+    CHECK(ss.str().ends_with("  subgraph \"cluster_fused_0\" {\n    label=\"fused\"\n    \"3 b\"\n    \"4 c\"\n  }\n}\n"));
+    polled.clear();
+}
+
+#ifdef PPL_PROFILING
+TEST_CASE("Testing profiles count every poll of every node") {
+    polled.clear();
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<int_source>(-1, "source");
+    const auto c = pipeline.create_node<int_component>("c");
+    const auto sink = pipeline.create_node<simple_sink<int>>("sink");
+    pipeline.connect(source, c, 0);
+    pipeline.connect(c, sink, 0);
+    pipeline.run();
+
+    // Empty once, ready 4 times, then closed
+    const auto &p = pipeline.profile(source);
+    CHECK(p.polls == 6);
+    CHECK(p.ready == 4);
+    CHECK(p.empty == 1);
+    CHECK(p.closed == 1);
+    CHECK(p.values == 4);
+    CHECK(p.percentile(0.5) <= p.percentile(0.99));
+    CHECK(p.percentile(0.99) <= p.total_time * 2);
+    // Its dependents are only polled when it is ready
+    CHECK(pipeline.profile(c).polls == 4);
+    CHECK(pipeline.profile(sink).ready == 4);
+
+    std::stringstream ss;
+    pipeline.dump_profiles(ss);
+    auto line = std::string{};
+    std::getline(ss, line);
+    CHECK(line == "id,name,polls,ready,empty,closed,values,total_ns,p50_ns,p99_ns");
+    auto lines = 0;
+    while (std::getline(ss, line)) {
+        lines++;
+    }
+    CHECK(lines == 3);
+
+    pipeline.reset_profiles();
+    CHECK(pipeline.profile(source).polls == 0);
+    CHECK_THROWS_AS(pipeline.profile(-1), ppl::pipeline_error);
+    polled.clear();
+}
+
+TEST_CASE("Testing profiles count every value in a batch") {
+    auto pipeline = ppl::pipeline{};
+    pipeline.set_batch_size(4);
+    const auto source = pipeline.create_node<counting_batch_source>(10);
+    const auto c = pipeline.create_node<doubling_batch_component>();
+    pipeline.connect(source, c, 0);
+    pipeline.connect(c, pipeline.create_node<summing_batch_sink>(), 0);
+    pipeline.run();
+
+    CHECK(pipeline.profile(source).ready == 3);
+    CHECK(pipeline.profile(source).values == 10);
+    CHECK(pipeline.profile(c).values == 10);
+}
+#endif
+
+// Counts up to `last`, but only has a value on the polls where `pattern` is set.
+struct patterned_source : ppl::source<int> {
+    int val_ = 0;
+    int polls_ = 0;
+    const int last_;
+    const std::vector<bool> pattern_;
+
+    patterned_source(const int &last, const std::vector<bool> &pattern): last_{last}, pattern_{pattern} {}
+
+    auto name() const -> std::string override {
+        return "patterned_source";
+    }
+
+    auto poll_next() -> ppl::poll override {
+        if (val_ >= last_) {
+            return ppl::poll::closed;
+        }
+        if (!pattern_[static_cast<std::size_t>(polls_++) % pattern_.size()]) {
+            return ppl::poll::empty;
+        }
+        val_++;
+        return ppl::poll::ready;
+    }
+
+    auto value() const -> const int& override {
+        return val_;
+    }
+};
+
+TEST_CASE("Testing edge buffers let producers that are out of step feed one consumer") {
+    auto pipeline = ppl::pipeline{};
+    const auto evens = pipeline.create_node<patterned_source>(10, std::vector<bool>{true, false});
+    const auto odds = pipeline.create_node<patterned_source>(10, std::vector<bool>{false, true});
+    const auto c = pipeline.create_node<adding_component>();
+    const auto sink = pipeline.create_node<collecting_sink>();
+    pipeline.connect(evens, c, 0);
+    pipeline.connect(odds, c, 1);
+    pipeline.connect(c, sink, 0);
+
+    // The sources are never ready in the same step, so nothing gets through
+    for (auto i = 0; i < 4; ++i) {
+        pipeline.step();
+    }
+    CHECK(static_cast<collecting_sink*>(pipeline.get_node(sink))->vals_.empty());
+
+    CHECK_THROWS_AS(pipeline.set_buffer(evens, sink, 2), ppl::pipeline_error);
+    CHECK_THROWS_AS(pipeline.get_buffer_stats(evens, c), ppl::pipeline_error);
+    pipeline.set_buffer(evens, c, 2);
+    pipeline.set_buffer(odds, c, 2);
+    CHECK(pipeline.get_buffer_stats(evens, c).capacity == 2);
+    pipeline.run();
+
+    // Values 3 to 10 of each source, paired up in order
+    CHECK(static_cast<collecting_sink*>(pipeline.get_node(sink))->vals_ == std::vector<int>{6, 8, 10, 12, 14, 16, 18, 20});
+    const auto stats = pipeline.get_buffer_stats(evens, c);
+    CHECK(stats.pushed == 8);
+    CHECK(stats.size == 0);
+    CHECK(stats.peak == 1);
+    CHECK(stats.throttled == 0);
+}
+
+TEST_CASE("Testing a full edge buffer holds its producer back") {
+    auto pipeline = ppl::pipeline{};
+    const auto fast = pipeline.create_node<range_source>(12);
+    const auto slow = pipeline.create_node<patterned_source>(4, std::vector<bool>{true, false, false});
+    const auto c = pipeline.create_node<adding_component>();
+    const auto sink = pipeline.create_node<collecting_sink>();
+    pipeline.connect(fast, c, 0);
+    pipeline.connect(slow, c, 1);
+    pipeline.connect(c, sink, 0);
+    pipeline.set_buffer(fast, c, 3);
+    pipeline.run();
+
+    // Every value of the fast source arrives, even though it has to wait for the slow one
+    CHECK(static_cast<collecting_sink*>(pipeline.get_node(sink))->vals_ == std::vector<int>{2, 4, 6, 8});
+    const auto stats = pipeline.get_buffer_stats(fast, c);
+    CHECK(stats.peak == 3);
+    CHECK(stats.throttled > 0);
+    CHECK(stats.size == 3);
+
+    // Removing the buffer, or the edge, connects the consumer straight to its producer again
+    pipeline.set_buffer(fast, c, 0);
+    CHECK_THROWS_AS(pipeline.get_buffer_stats(fast, c), ppl::pipeline_error);
+    pipeline.set_buffer(fast, c, 1);
+    pipeline.disconnect(fast, c);
+    CHECK_THROWS_AS(pipeline.get_buffer_stats(fast, c), ppl::pipeline_error);
+}
+
+// Receives values from another thread, one at a time.
+struct mailbox_source : ppl::source<int> {
+    std::atomic<int> mail_ = 0;
+    std::atomic<bool> closed_ = false;
+    int val_ = 0;
+    int polls_ = 0;
+
+    auto name() const -> std::string override {
+        return "mailbox_source";
+    }
+
+    auto poll_next() -> ppl::poll override {
+        polls_++;
+        if (const auto mail = mail_.exchange(0); mail != 0) {
+            val_ = mail;
+            return ppl::poll::ready;
+        }
+        return closed_ ? ppl::poll::closed : ppl::poll::empty;
+    }
+
+    auto value() const -> const int& override {
+        return val_;
+    }
+};
+
+TEST_CASE("Testing run backs off while sources are empty") {
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<mailbox_source>();
+    const auto sink = pipeline.create_node<collecting_sink>();
+    pipeline.connect(source, sink, 0);
+    auto &mailbox = *static_cast<mailbox_source*>(pipeline.get_node(source));
+
+    auto sender = std::thread([&] {
+        for (auto i = 1; i <= 3; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            mailbox.mail_ = i;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        mailbox.closed_ = true;
+    });
+    pipeline.run(ppl::backoff(8, 8, std::chrono::microseconds(100), std::chrono::milliseconds(5)));
+    sender.join();
+
+    CHECK(static_cast<collecting_sink*>(pipeline.get_node(sink))->vals_ == std::vector<int>{1, 2, 3});
+    // Spinning for 200ms would take millions of polls
+    CHECK(mailbox.polls_ < 400);
+}
+
+TEST_CASE("Testing wake interrupts a waiting run") {
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<mailbox_source>();
+    pipeline.connect(source, pipeline.create_node<collecting_sink>(), 0);
+    auto &mailbox = *static_cast<mailbox_source*>(pipeline.get_node(source));
+
+    auto sender = std::thread([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        mailbox.closed_ = true;
+        pipeline.wake();
+    });
+    const auto start = std::chrono::steady_clock::now();
+    // Without the wake-up, this would sleep for a minute
+    pipeline.run(ppl::backoff(0, 0, std::chrono::minutes(1), std::chrono::minutes(1)));
+    sender.join();
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(30));
+}
+
+struct counting_strategy {
+    std::size_t* waits;
+
+    auto wait(const std::size_t idle_steps, ppl::waker &waker) const -> bool {
+        CHECK(idle_steps == ++*waits);
+        return waker.take();
+    }
+};
+
+TEST_CASE("Testing run accepts any wait strategy") {
+    STATIC_REQUIRE(ppl::wait_strategy<ppl::backoff>);
+    STATIC_REQUIRE(ppl::wait_strategy<counting_strategy>);
+    STATIC_REQUIRE(!ppl::wait_strategy<int>);
+
+    polled.clear();
+    auto pipeline = ppl::pipeline{};
+    // Empty for 5 polls, then 4 values
+    const auto source = pipeline.create_node<int_source>(-5, "source");
+    pipeline.connect(source, pipeline.create_node<simple_sink<int>>("sink"), 0);
+    auto waits = std::size_t{0};
+    pipeline.run(counting_strategy{&waits});
+    CHECK(waits == 5);
+    polled.clear();
+}
+
+// Counts up to `last`, and can resume counting after a restart.
+struct resumable_source : ppl::source<int> {
+    int val_ = 0;
+    const int last_;
+
+    resumable_source(const int &last): last_{last} {}
+
+    auto name() const -> std::string override {
+        return "resumable_source";
+    }
+
+    auto poll_next() -> ppl::poll override {
+        if (val_ >= last_) {
+            return ppl::poll::closed;
+        }
+        val_++;
+        return ppl::poll::ready;
+    }
+
+    auto value() const -> const int& override {
+        return val_;
+    }
+
+    auto save_state(ppl::state_writer &writer) const -> void override {
+        writer.write(val_);
+    }
+
+    auto restore_state(ppl::state_reader &reader) -> void override {
+        val_ = reader.read<int>();
+    }
+};
+
+// Keeps a running total, and only saves it every `period` values.
+struct totalling_sink : ppl::sink<int> {
+    const ppl::producer<int>* slot0 = nullptr;
+    long total_ = 0;
+    long saved_ = 0;
+    int period_;
+    int count_ = 0;
+
+    totalling_sink(const int &period = 1): period_{period} {}
+
+    auto name() const -> std::string override {
+        return "totalling_sink";
+    }
+
+    auto connect(const ppl::node* src, int) -> void override {
+        slot0 = static_cast<const ppl::producer<int>*>(src);
+    }
+
+    auto poll_next() -> ppl::poll override {
+        total_ += slot0->value();
+        if (++count_ % period_ == 0) {
+            saved_ = total_;
+        }
+        return ppl::poll::ready;
+    }
+
+    auto save_state(ppl::state_writer &writer) const -> void override {
+        writer.write(saved_);
+        writer.write_string("total");
+    }
+
+    auto restore_state(ppl::state_reader &reader) -> void override {
+        total_ = saved_ = reader.read<long>();
+        CHECK(reader.read_string() == "total");
+    }
+};
+
+// A source doubled by a stateless component into a totalling sink.
+auto checkpointed_pipeline(const int last) -> std::pair<ppl::pipeline, ppl::pipeline::node_id> {
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<resumable_source>(last);
+    const auto c = pipeline.create_node<adding_component>();
+    const auto sink = pipeline.create_node<totalling_sink>();
+    pipeline.connect(source, c, 0);
+    pipeline.connect(source, c, 1);
+    pipeline.connect(c, sink, 0);
+    return {std::move(pipeline), sink};
+}
+
+TEST_CASE("Testing a restored pipeline carries on where the checkpoint left off") {
+    auto log = std::stringstream();
+    {
+        auto [pipeline, sink] = checkpointed_pipeline(100);
+        for (auto i = 0; i < 30; ++i) {
+            pipeline.step();
+            if (i % 10 == 9) {
+                pipeline.checkpoint(log);
+            }
+        }
+        // Progress since the last checkpoint is lost.
+        for (auto i = 0; i < 5; ++i) {
+            pipeline.step();
+        }
+    }
+
+    auto [pipeline, sink] = checkpointed_pipeline(100);
+    CHECK(pipeline.restore(log));
+    CHECK(static_cast<totalling_sink*>(pipeline.get_node(sink))->total_ == 30 * 31);
+    pipeline.run();
+    CHECK(static_cast<totalling_sink*>(pipeline.get_node(sink))->total_ == 100 * 101);
+}
+
+TEST_CASE("Testing checkpoints only hold what has changed") {
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<resumable_source>(100);
+    const auto sink = pipeline.create_node<totalling_sink>(4);
+    pipeline.connect(source, sink, 0);
+
+    auto log = std::stringstream();
+    pipeline.checkpoint(log);
+    const auto first = log.str().size();
+    // Neither node has changed.
+    pipeline.checkpoint(log);
+    const auto unchanged = log.str().size() - first;
+    pipeline.step();
+    // Only the source has changed.
+    pipeline.checkpoint(log);
+    const auto source_only = log.str().size() - first - unchanged;
+    for (auto i = 0; i < 3; ++i) {
+        pipeline.step();
+    }
+    // Both have.
+    pipeline.checkpoint(log);
+    const auto both = log.str().size() - first - unchanged - source_only;
+
+    CHECK(unchanged < source_only);
+    CHECK(source_only < both);
+    CHECK(both < first);
+    CHECK(source_only - unchanged == sizeof(std::size_t) * 2 + sizeof(int));
+
+    // A complete checkpoint repeats everything.
+    const auto before = log.str().size();
+    pipeline.checkpoint(log, true);
+    CHECK(log.str().size() - before == first);
+
+    auto restored = ppl::pipeline{};
+    const auto restored_source = restored.create_node<resumable_source>(100);
+    restored.connect(restored_source, restored.create_node<totalling_sink>(4), 0);
+    CHECK(restored.restore(log));
+    CHECK(static_cast<resumable_source*>(restored.get_node(source))->val_ == 4);
+    CHECK(static_cast<totalling_sink*>(restored.get_node(sink))->total_ == 10);
+}
+
+TEST_CASE("Testing restore ignores a checkpoint cut short") {
+    auto [pipeline, sink] = checkpointed_pipeline(100);
+    auto log = std::stringstream();
+    pipeline.step();
+    pipeline.checkpoint(log);
+    const auto complete = log.str();
+    pipeline.step();
+    pipeline.checkpoint(log);
+
+    for (auto cut = std::size_t{1}; cut <= log.str().size() - complete.size(); ++cut) {
+        auto torn = std::stringstream(log.str().substr(0, log.str().size() - cut));
+        auto [restored, restored_sink] = checkpointed_pipeline(100);
+        CHECK(restored.restore(torn));
+        CHECK(static_cast<totalling_sink*>(restored.get_node(restored_sink))->total_ == 2);
+    }
+
+    // The checkpoint after restoring is complete, so it can be read on its own.
+    auto torn = std::stringstream(log.str().substr(0, log.str().size() - 1));
+    auto [restored, restored_sink] = checkpointed_pipeline(100);
+    restored.restore(torn);
+    restored.step();
+    auto fresh = std::stringstream();
+    restored.checkpoint(fresh);
+    auto [again, again_sink] = checkpointed_pipeline(100);
+    CHECK(again.restore(fresh));
+    CHECK(static_cast<totalling_sink*>(again.get_node(again_sink))->total_ == 6);
+}
+
+TEST_CASE("Testing restore rejects checkpoints from a different pipeline") {
+    auto [pipeline, sink] = checkpointed_pipeline(100);
+    auto log = std::stringstream();
+    pipeline.step();
+    pipeline.checkpoint(log);
+
+    auto empty = std::stringstream();
+    CHECK_FALSE(pipeline.restore(empty));
+
+    auto other = ppl::pipeline{};
+    const auto other_source = other.create_node<resumable_source>(100);
+    other.connect(other_source, other.create_node<totalling_sink>(), 0);
+    auto error = std::optional<ppl::pipeline_error>();
+    try {
+        other.restore(log);
+    } catch (const ppl::pipeline_error &e) {
+        error = e;
+    }
+    REQUIRE(error.has_value());
+    CHECK(error->kind() == ppl::pipeline_error_kind::invalid_checkpoint);
+    CHECK(std::string(error->what()) == "invalid checkpoint");
+    CHECK(static_cast<resumable_source*>(other.get_node(other_source))->val_ == 0);
+
+    auto garbage = std::stringstream("not a checkpoint");
+    CHECK_THROWS_AS(pipeline.restore(garbage), ppl::pipeline_error);
+}
+
+// Forwards its input, until it kills its own process after `limit` values.
+struct crashing_component : ppl::component<std::tuple<int>, int> {
+    const ppl::producer<int>* slot0 = nullptr;
+    int limit_;
+    int count_ = 0;
+
+    crashing_component(const int &limit): limit_{limit} {}
+
+    auto name() const -> std::string override {
+        return "crashing_component";
+    }
+
+    auto connect(const ppl::node* src, int) -> void override {
+        slot0 = static_cast<const ppl::producer<int>*>(src);
+    }
+
+    auto poll_next() -> ppl::poll override {
+        if (++count_ > limit_) {
+            ::kill(::getpid(), SIGKILL);
+        }
+        return ppl::poll::ready;
+    }
+
+    auto value() const -> const int& override {
+        return slot0->value();
+    }
+};
+
+// Spells out each number from a range_source.
+struct spelling_component : ppl::component<std::tuple<int>, std::string> {
+    const ppl::producer<int>* slot0 = nullptr;
+    std::string val_;
+
+    auto name() const -> std::string override {
+        return "spelling_component";
+    }
+
+    auto connect(const ppl::node* src, int) -> void override {
+        slot0 = static_cast<const ppl::producer<int>*>(src);
+    }
+
+    auto poll_next() -> ppl::poll override {
+        val_ = std::string(static_cast<std::size_t>(slot0->value() % 50), 'x') + std::to_string(slot0->value());
+        return ppl::poll::ready;
+    }
+
+    auto value() const -> const std::string& override {
+        return val_;
+    }
+};
+
+struct string_collecting_sink : ppl::sink<std::string> {
+    std::vector<std::string> vals_;
+    const ppl::producer<std::string>* slot0 = nullptr;
+
+    auto name() const -> std::string override {
+        return "string_collecting_sink";
+    }
+
+    auto connect(const ppl::node* src, int) -> void override {
+        slot0 = static_cast<const ppl::producer<std::string>*>(src);
+    }
+
+    auto poll_next() -> ppl::poll override {
+        vals_.push_back(slot0->value());
+        return ppl::poll::ready;
+    }
+};
+
+TEST_CASE("Testing run_partitioned carries values between processes") {
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<range_source>(1000);
+    const auto c = pipeline.create_node<adding_component>();
+    const auto sink = pipeline.create_node<collecting_sink>();
+    pipeline.connect(source, c, 0);
+    pipeline.connect(source, c, 1);
+    pipeline.connect(c, sink, 0);
+    pipeline.set_partition(source, 2);
+    pipeline.set_partition(c, 1);
+    CHECK(pipeline.get_partition(source) == 2);
+    CHECK(pipeline.get_partition(sink) == 0);
+
+    // A small ring makes the source wait for the others to catch up.
+    const auto outcomes = pipeline.run_partitioned(256);
+    REQUIRE(outcomes.size() == 3);
+    for (const auto &outcome : outcomes) {
+        CHECK(outcome.completed);
+        CHECK(outcome.signal == 0);
+    }
+    auto expected = std::vector<int>{};
+    for (auto i = 1; i <= 1000; ++i) {
+        expected.push_back(2 * i);
+    }
+    CHECK(static_cast<collecting_sink*>(pipeline.get_node(sink))->vals_ == expected);
+    // The other partitions ran in other processes.
+    CHECK(static_cast<range_source*>(pipeline.get_node(source))->val_ == 0);
+
+    // The pipeline still runs as a whole afterwards.
+    static_cast<collecting_sink*>(pipeline.get_node(sink))->vals_.clear();
+    pipeline.run();
+    CHECK(static_cast<collecting_sink*>(pipeline.get_node(sink))->vals_ == expected);
+}
+
+// Publishes 0 on every other poll, forever.
+struct blinking_source : ppl::source<int> {
+    const int zero_ = 0;
+    bool on_ = false;
+
+    auto name() const -> std::string override {
+        return "blinking_source";
+    }
+
+    auto poll_next() -> ppl::poll override {
+        on_ = !on_;
+        return on_ ? ppl::poll::ready : ppl::poll::empty;
+    }
+
+    auto value() const -> const int& override {
+        return zero_;
+    }
+};
+
+TEST_CASE("Testing a value carried between processes waits for its consumer's other inputs") {
+    auto pipeline = ppl::pipeline{};
+    const auto remote = pipeline.create_node<range_source>(10);
+    const auto local = pipeline.create_node<blinking_source>();
+    const auto c = pipeline.create_node<adding_component>();
+    const auto sink = pipeline.create_node<collecting_sink>();
+    pipeline.connect(remote, c, 0);
+    pipeline.connect(local, c, 1);
+    pipeline.connect(c, sink, 0);
+    pipeline.set_partition(remote, 1);
+
+    CHECK(pipeline.run_partitioned().at(1).completed);
+    // None of the values from the other process are lost in the steps where the local source is empty.
+    CHECK(static_cast<collecting_sink*>(pipeline.get_node(sink))->vals_ == std::vector<int>{1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+}
+
+TEST_CASE("Testing run_partitioned sends strings") {
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<range_source>(200);
+    const auto spell = pipeline.create_node<spelling_component>();
+    const auto sink = pipeline.create_node<string_collecting_sink>();
+    pipeline.connect(source, spell, 0);
+    pipeline.connect(spell, sink, 0);
+    pipeline.set_partition(source, 1);
+    pipeline.set_partition(spell, 1);
+
+    CHECK(pipeline.run_partitioned(128).at(1).completed);
+    const auto &vals = static_cast<string_collecting_sink*>(pipeline.get_node(sink))->vals_;
+    REQUIRE(vals.size() == 200);
+    CHECK(vals[0] == "x1");
+    CHECK(vals[199] == std::string(0, 'x') + "200");
+}
+
+TEST_CASE("Testing run_partitioned fails values too large for the ring") {
+    const auto build = [](ppl::pipeline &pipeline, const std::size_t spelling) {
+        const auto source = pipeline.create_node<range_source>(100);
+        const auto spell = pipeline.create_node<spelling_component>();
+        const auto sink = pipeline.create_node<string_collecting_sink>();
+        pipeline.connect(source, spell, 0);
+        pipeline.connect(spell, sink, 0);
+        pipeline.set_partition(source, spelling);
+        pipeline.set_partition(spell, spelling);
+        pipeline.set_partition(sink, 1 - spelling);
+        return sink;
+    };
+
+    // The 47th value spells out to 49 bytes, which with a length and the ring's own framing
+    // takes 65 bytes.
+    auto far = ppl::pipeline{};
+    const auto sink = build(far, 1);
+    const auto outcomes = far.run_partitioned(64);
+    CHECK_FALSE(outcomes.at(1).completed);
+    CHECK(outcomes.at(1).signal == 0);
+    CHECK(static_cast<string_collecting_sink*>(far.get_node(sink))->vals_.size() == 46);
+
+    auto near = ppl::pipeline{};
+    build(near, 0);
+    CHECK_THROWS_AS(near.run_partitioned(64), std::length_error);
+}
+
+TEST_CASE("Testing a crashing partition closes the edges out of it") {
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<range_source>(1000000);
+    const auto crash = pipeline.create_node<crashing_component>(10);
+    const auto sink = pipeline.create_node<collecting_sink>();
+    pipeline.connect(source, crash, 0);
+    pipeline.connect(crash, sink, 0);
+    pipeline.set_partition(source, 1);
+    pipeline.set_partition(crash, 2);
+
+    const auto outcomes = pipeline.run_partitioned();
+    REQUIRE(outcomes.size() == 3);
+    CHECK(outcomes[0].completed);
+    // The source stops once nothing is listening to it.
+    CHECK(outcomes[1].completed);
+    CHECK_FALSE(outcomes[2].completed);
+    CHECK(outcomes[2].signal == SIGKILL);
+    CHECK(static_cast<collecting_sink*>(pipeline.get_node(sink))->vals_ == std::vector<int>{1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+}
+
+TEST_CASE("Testing run_partitioned rejects partitions it can't run") {
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<range_source>(10);
+    const auto a = pipeline.create_node<int_component>("a");
+    const auto b = pipeline.create_node<int_component>("b");
+    const auto sink = pipeline.create_node<collecting_sink>();
+    pipeline.connect(source, a, 0);
+    pipeline.connect(a, b, 0);
+    pipeline.connect(b, sink, 0);
+
+    // 0 -> 1 -> 0
+    pipeline.set_partition(a, 1);
+    auto error = std::optional<ppl::pipeline_error>();
+    try {
+        pipeline.run_partitioned();
+    } catch (const ppl::pipeline_error &e) {
+        error = e;
+    }
+    REQUIRE(error.has_value());
+    CHECK(error->kind() == ppl::pipeline_error_kind::invalid_partition);
+    CHECK(std::string(error->what()) == "invalid partition");
+    CHECK_THROWS_AS(pipeline.set_partition(-1, 0), ppl::pipeline_error);
+
+    // There's no ppl::wire for vectors.
+    auto vectors = ppl::pipeline{};
+    const auto vector_source = vectors.create_node<simplest_source<std::vector<int>>>();
+    const auto vector_sink = vectors.create_node<simplest_sink<std::vector<int>>>();
+    vectors.connect(vector_source, vector_sink, 0);
+    vectors.set_partition(vector_source, 1);
+    CHECK_THROWS_AS(vectors.run_partitioned(), ppl::pipeline_error);
+
+    // Nor for anything else whose bytes might hold an address, unless it opts in.
+    static_assert(!ppl::wire_type<const char*>);
+    static_assert(!ppl::wire_type<std::pair<int, const int*>>);
+    static_assert(ppl::wire_type<std::pair<int, std::string_view>>);
+}
+
+TEST_CASE("Testing partition balances nodes in topological order") {
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<int_source>(1, "source");
+    auto previous = source;
+    auto ids = std::vector<ppl::pipeline::node_id>{source};
+    for (auto i = 0; i < 6; ++i) {
+        const auto next = pipeline.create_node<int_component>(std::string(1, static_cast<char>('a' + i)));
+        pipeline.connect(previous, next, 0);
+        ids.push_back(next);
+        previous = next;
+    }
+    const auto sink = pipeline.create_node<simple_sink<int>>("sink");
+    pipeline.connect(previous, sink, 0);
+    ids.push_back(sink);
+
+    pipeline.partition(4);
+#ifndef PPL_PROFILING
+    // Every node costs the same.
+    auto partitions = std::vector<std::size_t>{};
+    for (const auto &id : ids) {
+        partitions.push_back(pipeline.get_partition(id));
+    }
+    CHECK(partitions == std::vector<std::size_t>{0, 0, 1, 1, 2, 2, 3, 3});
+#endif
+    for (std::size_t i = 1; i < ids.size(); ++i) {
+        CHECK(pipeline.get_partition(ids[i - 1]) <= pipeline.get_partition(ids[i]));
+    }
+    CHECK(pipeline.get_partition(sink) == 3);
+
+    pipeline.set_partition(ids[2], 0);
+    pipeline.set_partition(ids[3], 0);
+    pipeline.set_partition(ids[4], 0);
+    pipeline.set_partition(ids[5], 1);
+    pipeline.set_partition(ids[6], 1);
+    pipeline.set_partition(sink, 1);
+    auto ss = std::stringstream{};
+    ss << pipeline;
+    CHECK(ss.str() == "digraph G {\n  \"1 source\"\n  \"2 a\"\n  \"3 b\"\n  \"4 c\"\n  \"5 d\"\n  \"6 e\"\n  \"7 f\"\n"
+        "  \"8 sink\"\n\n  \"1 source\" -> \"2 a\"\n  \"2 a\" -> \"3 b\"\n  \"3 b\" -> \"4 c\"\n  \"4 c\" -> \"5 d\"\n"
+        "  \"5 d\" -> \"6 e\"\n  \"6 e\" -> \"7 f\"\n  \"7 f\" -> \"8 sink\"\n\n"
+        "  subgraph \"cluster_partition_0\" {\n    label=\"partition 0\"\n    \"1 source\"\n    \"2 a\"\n    \"3 b\"\n"
+        "    \"4 c\"\n    \"5 d\"\n    subgraph \"cluster_fused_0\" {\n      label=\"fused\"\n      \"2 a\"\n      \"3 b\"\n"
+        "      \"4 c\"\n      \"5 d\"\n    }\n  }\n\n"
+        "  subgraph \"cluster_partition_1\" {\n    label=\"partition 1\"\n    \"6 e\"\n    \"7 f\"\n    \"8 sink\"\n"
+        "    subgraph \"cluster_fused_1\" {\n      label=\"fused\"\n      \"6 e\"\n      \"7 f\"\n    }\n  }\n}\n");
+}
+
+TEST_CASE("Testing a replayed trace takes the same steps as the recording") {
+    const auto build = [](ppl::pipeline &pipeline, const int last, const std::vector<bool> &pattern) {
+        const auto source = pipeline.create_node<patterned_source>(last, pattern);
+        const auto c = pipeline.create_node<adding_component>();
+        const auto sink = pipeline.create_node<collecting_sink>();
+        pipeline.connect(source, c, 0);
+        pipeline.connect(source, c, 1);
+        pipeline.connect(c, sink, 0);
+        return std::pair{source, sink};
+    };
+    // What the sink has collected after each step.
+    const auto steps = [](ppl::pipeline &pipeline, const ppl::pipeline::node_id sink) {
+        auto collected = std::vector<std::vector<int>>{};
+        auto done = false;
+        while (!done) {
+            done = pipeline.step();
+            collected.push_back(static_cast<collecting_sink*>(pipeline.get_node(sink))->vals_);
+        }
+        return collected;
+    };
+
+    auto trace = std::stringstream{};
+    auto recorded = std::vector<std::vector<int>>{};
+    {
+        auto pipeline = ppl::pipeline{};
+        const auto [source, sink] = build(pipeline, 20, {true, false, false, true, false});
+        pipeline.record(trace);
+        recorded = steps(pipeline, sink);
+        pipeline.end_trace();
+        CHECK(static_cast<patterned_source*>(pipeline.get_node(source))->val_ == 20);
+    }
+
+    // The real source would behave completely differently.
+    auto pipeline = ppl::pipeline{};
+    const auto [source, sink] = build(pipeline, 1000, {true});
+    pipeline.replay(trace);
+    CHECK(steps(pipeline, sink) == recorded);
+    CHECK(static_cast<patterned_source*>(pipeline.get_node(source))->polls_ == 0);
+
+    pipeline.end_trace();
+    static_cast<collecting_sink*>(pipeline.get_node(sink))->vals_.clear();
+    pipeline.run();
+    CHECK(static_cast<collecting_sink*>(pipeline.get_node(sink))->vals_.size() == 1000);
+}
+
+TEST_CASE("Testing a trace holds every value in a batch") {
+    const auto build = [](ppl::pipeline &pipeline, const int last) {
+        pipeline.set_batch_size(4);
+        const auto source = pipeline.create_node<counting_batch_source>(last);
+        const auto c = pipeline.create_node<doubling_batch_component>();
+        const auto sink = pipeline.create_node<summing_batch_sink>();
+        pipeline.connect(source, c, 0);
+        pipeline.connect(c, sink, 0);
+        return sink;
+    };
+
+    auto trace = std::stringstream{};
+    {
+        auto pipeline = ppl::pipeline{};
+        build(pipeline, 10);
+        pipeline.record(trace);
+        pipeline.run();
+        pipeline.end_trace();
+    }
+
+    auto pipeline = ppl::pipeline{};
+    const auto sink = build(pipeline, 0);
+    pipeline.replay(trace);
+    pipeline.run();
+    const auto result = static_cast<summing_batch_sink*>(pipeline.get_node(sink));
+    CHECK(result->sum_ == 110);
+    CHECK(result->polls_ == 3);
+}
+
+TEST_CASE("Testing replay rejects traces it can't use") {
+    auto trace = std::stringstream{};
+    {
+        auto pipeline = ppl::pipeline{};
+        const auto source = pipeline.create_node<range_source>(10);
+        pipeline.connect(source, pipeline.create_node<collecting_sink>(), 0);
+        pipeline.record(trace);
+        pipeline.run();
+        pipeline.end_trace();
+    }
+
+    // A different shape of pipeline.
+    auto pipeline = ppl::pipeline{};
+    const auto source = pipeline.create_node<range_source>(10);
+    const auto c = pipeline.create_node<int_component>("c");
+    pipeline.connect(source, c, 0);
+    pipeline.connect(c, pipeline.create_node<collecting_sink>(), 0);
+    auto error = std::optional<ppl::pipeline_error>();
+    try {
+        pipeline.replay(trace);
+    } catch (const ppl::pipeline_error &e) {
+        error = e;
+    }
+    REQUIRE(error.has_value());
+    CHECK(error->kind() == ppl::pipeline_error_kind::invalid_trace);
+    CHECK(std::string(error->what()) == "invalid trace");
+
+    auto garbage = std::stringstream{"not a trace"};
+    CHECK_THROWS_AS(pipeline.replay(garbage), ppl::pipeline_error);
+    // The pipeline is left alone.
+    CHECK(pipeline.get_node(source)->name() == "range_source");
+    pipeline.run();
+
+    // There's no ppl::wire for vectors.
+    auto vectors = ppl::pipeline{};
+    const auto vector_source = vectors.create_node<simplest_source<std::vector<int>>>();
+    vectors.connect(vector_source, vectors.create_node<simplest_sink<std::vector<int>>>(), 0);
+    CHECK_THROWS_AS(vectors.record(trace), ppl::pipeline_error);
+}
@@ -0,0 +1,104 @@
+#ifndef COMP6771_STATIC_PIPELINE_H
+#define COMP6771_STATIC_PIPELINE_H
+
+#include "./pipeline.h"
+
+#include <concepts>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace ppl {
+    namespace internal {
+        // Whether `N::poll_next()` can be called directly, bypassing the vtable.
+        template <typename N>
+        concept statically_pollable = requires(N &n) {
+            { n.N::poll_next() } -> std::same_as<poll>;
+        };
+
+        template <typename... Nodes>
+        struct is_chain : std::true_type {};
+
+        template <typename First, typename Second, typename... Rest>
+        struct is_chain<First, Second, Rest...> {
+            static constexpr bool value = std::is_same_v<typename Second::input_type, std::tuple<typename First::output_type>>
+                and is_chain<Second, Rest...>::value;
+        };
+
+        template <typename... Nodes>
+        constexpr bool is_chain_v = is_chain<Nodes...>::value;
+    }
+
+    // A source, any number of components and a sink, connected one after the other, where the
+    // shape of the graph is known at compile time. Slot types are checked when the pipeline is
+    // instantiated rather than in connect(), and each node's poll_next() is called by name rather
+    // than through the vtable, so it can be inlined into step(). Nodes still read their inputs
+    // through `const producer<T>*`, though, so each value() remains an indirect call unless the
+    // optimiser can devirtualise it.
+    //
+    // The nodes live inside the pipeline, which therefore cannot be copied or moved.
+    template <concrete_node... Nodes>
+    requires (sizeof...(Nodes) >= 2)
+        and (internal::statically_pollable<Nodes> and ...)
+        and internal::is_chain_v<Nodes...>
+        and std::is_same_v<typename std::tuple_element_t<0, std::tuple<Nodes...>>::input_type, std::tuple<>>
+        and std::is_same_v<typename std::tuple_element_t<sizeof...(Nodes) - 1, std::tuple<Nodes...>>::output_type, void>
+    class static_pipeline {
+    public:
+        static_pipeline() {
+            connect_all(std::make_index_sequence<sizeof...(Nodes) - 1>{});
+        }
+
+        explicit static_pipeline(Nodes... nodes): nodes_{std::move(nodes)...} {
+            connect_all(std::make_index_sequence<sizeof...(Nodes) - 1>{});
+        }
+
+        static_pipeline(const static_pipeline &) = delete;
+        auto operator=(const static_pipeline &) -> static_pipeline& = delete;
+
+        // The Ith node, counting from the source.
+        template <std::size_t I>
+        auto get() -> std::tuple_element_t<I, std::tuple<Nodes...>>& {
+            return std::get<I>(nodes_);
+        }
+
+        template <std::size_t I>
+        auto get() const -> const std::tuple_element_t<I, std::tuple<Nodes...>>& {
+            return std::get<I>(nodes_);
+        }
+
+        // Behaves exactly as pipeline::step() would on the same nodes: once a node is empty or
+        // closed, the nodes after it are skipped with the same status.
+        auto step() -> bool {
+            return step_all(std::index_sequence_for<Nodes...>{}) == poll::closed;
+        }
+
+        auto run() -> void {
+            while (!step()) {}
+        }
+
+    private:
+        std::tuple<Nodes...> nodes_;
+
+        template <std::size_t... I>
+        auto connect_all(std::index_sequence<I...>) -> void {
+            (internal::node_access::connect(std::get<I + 1>(nodes_), &std::get<I>(nodes_), 0), ...);
+        }
+
+        template <std::size_t... I>
+        auto step_all(std::index_sequence<I...>) -> poll {
+            auto status = poll::ready;
+            ((status = status == poll::ready ? poll_at<I>() : status), ...);
+            return status;
+        }
+
+        template <std::size_t I>
+        auto poll_at() -> poll {
+            using node_type = std::tuple_element_t<I, std::tuple<Nodes...>>;
+            return std::get<I>(nodes_).node_type::poll_next();
+        }
+    };
+}
+
+#endif  // COMP6771_STATIC_PIPELINE_H
@@ -0,0 +1,174 @@
+#include "./static_pipeline.h"
+#include "./pipeline.h"
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+// Counts up to `last`, with nothing to offer on every third poll.
+struct counting_source : ppl::source<int> {
+    int val_ = 0;
+    int polls_ = 0;
+    int last_ = 0;
+
+    counting_source() = default;
+
+    counting_source(const int &last): last_{last} {}
+
+    auto name() const -> std::string override {
+        return "counting_source";
+    }
+
+    auto poll_next() -> ppl::poll override {
+        if (val_ == last_) {
+            return ppl::poll::closed;
+        }
+        if (++polls_ % 3 == 0) {
+            return ppl::poll::empty;
+        }
+        val_++;
+        return ppl::poll::ready;
+    }
+
+    auto value() const -> const int& override {
+        return val_;
+    }
+};
+
+struct squaring_component final : ppl::component<std::tuple<int>, int> {
+    const ppl::producer<int>* slot0 = nullptr;
+    int val_ = 0;
+
+    auto name() const -> std::string override {
+        return "squaring_component";
+    }
+
+    void connect(const ppl::node* src, int) override {
+        slot0 = static_cast<const ppl::producer<int>*>(src);
+    }
+
+    auto poll_next() -> ppl::poll override {
+        val_ = slot0->value() * slot0->value();
+        return ppl::poll::ready;
+    }
+
+    auto value() const -> const int& override {
+        return val_;
+    }
+};
+
+// Drops odd values.
+struct even_component : ppl::component<std::tuple<int>, int> {
+    const ppl::producer<int>* slot0 = nullptr;
+
+    auto name() const -> std::string override {
+        return "even_component";
+    }
+
+    void connect(const ppl::node* src, int) override {
+        slot0 = static_cast<const ppl::producer<int>*>(src);
+    }
+
+    auto poll_next() -> ppl::poll override {
+        return slot0->value() % 2 == 0 ? ppl::poll::ready : ppl::poll::empty;
+    }
+
+    auto value() const -> const int& override {
+        return slot0->value();
+    }
+};
+
+struct to_string_component : ppl::component<std::tuple<int>, std::string> {
+    const ppl::producer<int>* slot0 = nullptr;
+    std::string val_;
+
+    auto name() const -> std::string override {
+        return "to_string_component";
+    }
+
+    void connect(const ppl::node* src, int) override {
+        slot0 = static_cast<const ppl::producer<int>*>(src);
+    }
+
+    auto poll_next() -> ppl::poll override {
+        val_ = std::to_string(slot0->value());
+        return ppl::poll::ready;
+    }
+
+    auto value() const -> const std::string& override {
+        return val_;
+    }
+};
+
+template <typename Input>
+struct recording_sink : ppl::sink<Input> {
+    const ppl::producer<Input>* slot0 = nullptr;
+    std::vector<Input> vals_;
+
+    auto name() const -> std::string override {
+        return "recording_sink";
+    }
+
+    void connect(const ppl::node* src, int) override {
+        slot0 = static_cast<const ppl::producer<Input>*>(src);
+    }
+
+    auto poll_next() -> ppl::poll override {
+        vals_.push_back(slot0->value());
+        return ppl::poll::ready;
+    }
+};
+
+template <typename... Nodes>
+concept valid_static_pipeline = requires {
+    typename ppl::static_pipeline<Nodes...>;
+};
+
+TEST_CASE("Testing static pipelines check slot types at compile time") {
+    STATIC_REQUIRE(valid_static_pipeline<counting_source, recording_sink<int>>);
+    STATIC_REQUIRE(valid_static_pipeline<counting_source, squaring_component, to_string_component, recording_sink<std::string>>);
+    // Mismatched slot types
+    STATIC_REQUIRE(!valid_static_pipeline<counting_source, recording_sink<std::string>>);
+    STATIC_REQUIRE(!valid_static_pipeline<counting_source, to_string_component, squaring_component, recording_sink<int>>);
+    // Not starting at a source, or not ending at a sink
+    STATIC_REQUIRE(!valid_static_pipeline<squaring_component, recording_sink<int>>);
+    STATIC_REQUIRE(!valid_static_pipeline<counting_source, squaring_component>);
+    STATIC_REQUIRE(!valid_static_pipeline<counting_source>);
+}
+
+TEST_CASE("Testing a static pipeline steps exactly like the equivalent pipeline") {
+    auto dynamic = ppl::pipeline{};
+    const auto source = dynamic.create_node<counting_source>(20);
+    const auto square = dynamic.create_node<squaring_component>();
+    const auto even = dynamic.create_node<even_component>();
+    const auto sink = dynamic.create_node<recording_sink<int>>();
+    dynamic.connect(source, square, 0);
+    dynamic.connect(square, even, 0);
+    dynamic.connect(even, sink, 0);
+
+    auto fixed = ppl::static_pipeline<counting_source, squaring_component, even_component, recording_sink<int>>{
+        counting_source(20), squaring_component(), even_component(), recording_sink<int>()};
+
+    auto steps = 0;
+    while (true) {
+        const auto dynamic_done = dynamic.step();
+        CHECK(fixed.step() == dynamic_done);
+        CHECK(fixed.get<3>().vals_ == static_cast<recording_sink<int>*>(dynamic.get_node(sink))->vals_);
+        if (dynamic_done) {
+            break;
+        }
+        steps++;
+    }
+    // 20 values, with an empty poll after every second one
+    CHECK(steps == 29);
+    CHECK(fixed.get<3>().vals_ == std::vector<int>{4, 16, 36, 64, 100, 144, 196, 256, 324, 400});
+}
+
+TEST_CASE("Testing a static pipeline can change type along the chain") {
+    auto fixed = ppl::static_pipeline<counting_source, squaring_component, to_string_component, recording_sink<std::string>>{};
+    fixed.get<0>().last_ = 3;
+    fixed.run();
+    CHECK(fixed.get<3>().vals_ == std::vector<std::string>{"1", "4", "9"});
+    CHECK(fixed.step());
+}
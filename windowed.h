@@ -0,0 +1,474 @@
+#ifndef COMP6771_WINDOWED_H
+#define COMP6771_WINDOWED_H
+
+#include "./pipeline.h"
+
+#include <algorithm>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ppl::windowed {
+    // Aggregates over windows of a stream, in event time or by position in the stream.
+    //
+    // Each value gets a time, either from a function of the value or, with `by_count`, from its
+    // position in the stream. Values may arrive out of order by up to `lateness`: the watermark
+    // trails the latest time seen by that much, and a window is only published once the
+    // watermark has passed its end. Values older than the watermark are dropped as late.
+    // Nothing is kept for longer than that, so memory is bounded by the lateness and the window
+    // width, or a session's length, rather than by the length of the stream. Once the input
+    // closes, the watermark moves past every time, publishing the windows still open.
+    //
+    // Values are handed to the aggregator in time order, and each one is handed back to pop()
+    // once it has slid out of the window, so every aggregator below costs O(1) amortised time
+    // per value.
+
+    // Times values by their position in the stream, starting from 0.
+    struct by_count {};
+
+    enum class window_kind { tumbling, sliding, session };
+
+    struct window_spec {
+        window_kind kind = window_kind::tumbling;
+        std::int64_t width = 1;
+        std::int64_t slide = 1;
+        // For sessions, the gap in time after which a session ends.
+        std::int64_t gap = 1;
+        std::int64_t lateness = 0;
+        // For sessions, the longest a session may run before it is cut off.
+        std::int64_t length = std::numeric_limits<std::int64_t>::max();
+    };
+
+    // Back to back windows [k * width, (k + 1) * width).
+    inline auto tumbling(const std::int64_t width, const std::int64_t lateness = 0) -> window_spec {
+        return {window_kind::tumbling, width, width, 1, lateness};
+    }
+
+    // Overlapping windows [k * slide, k * slide + width).
+    inline auto sliding(const std::int64_t width, const std::int64_t slide, const std::int64_t lateness = 0) -> window_spec {
+        return {window_kind::sliding, width, slide, 1, lateness};
+    }
+
+    // Runs of values less than `gap` apart. Each session ends `gap` after its last value, or is
+    // cut off `length` after its first, in which case the next value starts a new one. Nothing
+    // slides out of a session, so an aggregator holding more than a total, like min or max, can
+    // hold on to every value in it; a `length` bounds that for sessions that never go quiet.
+    inline auto session(const std::int64_t gap, const std::int64_t lateness = 0,
+        const std::int64_t length = std::numeric_limits<std::int64_t>::max()) -> window_spec {
+        return {window_kind::session, 1, 1, gap, lateness, length};
+    }
+
+    // What a window held, over [start, end).
+    template <typename R>
+    struct result {
+        std::int64_t start = 0;
+        std::int64_t end = 0;
+        R value{};
+
+        auto operator==(const result &) const -> bool = default;
+    };
+
+    template <typename A, typename T>
+    concept aggregator = requires(A a, const A ca, const T &value) {
+        typename A::result_type;
+        a.push(value);
+        // Removes the oldest value still pushed, which is `value`.
+        a.pop(value);
+        a.clear();
+        { ca.result() } -> std::convertible_to<typename A::result_type>;
+    };
+
+    // Each aggregator reads a V out of every value with `Project`.
+
+    // Integers are added up in 64 bits, so that a window of narrower values can't overflow before
+    // its total would.
+    template <typename V, typename Project = std::identity>
+    class sum {
+    public:
+        using result_type = std::conditional_t<std::is_integral_v<V>,
+            std::conditional_t<std::is_signed_v<V>, std::int64_t, std::uint64_t>, V>;
+
+        explicit sum(Project project = Project{}): project_{std::move(project)} {}
+
+        template <typename T>
+        auto push(const T &value) -> void {
+            total_ += std::invoke(project_, value);
+        }
+
+        template <typename T>
+        auto pop(const T &value) -> void {
+            total_ -= std::invoke(project_, value);
+        }
+
+        auto clear() -> void {
+            total_ = result_type{};
+        }
+
+        auto result() const -> result_type {
+            return total_;
+        }
+
+    private:
+        Project project_;
+        result_type total_{};
+    };
+
+    class count {
+    public:
+        using result_type = std::size_t;
+
+        template <typename T>
+        auto push(const T &) -> void {
+            count_++;
+        }
+
+        template <typename T>
+        auto pop(const T &) -> void {
+            count_--;
+        }
+
+        auto clear() -> void {
+            count_ = 0;
+        }
+
+        auto result() const -> std::size_t {
+            return count_;
+        }
+
+    private:
+        std::size_t count_ = 0;
+    };
+
+    // The smallest value under `Compare`, kept with a monotonic deque: each value is pushed once
+    // and popped at most once, whether from the back because a better value arrived, or from
+    // the front because it slid out of the window.
+    template <typename V, typename Project = std::identity, typename Compare = std::less<V>>
+    class extremum {
+    public:
+        using result_type = V;
+
+        explicit extremum(Project project = Project{}, Compare compare = Compare{})
+        : project_{std::move(project)}, compare_{std::move(compare)} {}
+
+        template <typename T>
+        auto push(const T &value) -> void {
+            const auto &v = std::invoke(project_, value);
+            while (!candidates_.empty() && compare_(v, candidates_.back())) {
+                candidates_.pop_back();
+            }
+            candidates_.push_back(v);
+        }
+
+        template <typename T>
+        auto pop(const T &value) -> void {
+            // Unless it was pushed out by a better value already.
+            if (!candidates_.empty() && !compare_(candidates_.front(), std::invoke(project_, value))) {
+                candidates_.pop_front();
+            }
+        }
+
+        auto clear() -> void {
+            candidates_.clear();
+        }
+
+        auto result() const -> V {
+            return candidates_.front();
+        }
+
+    private:
+        Project project_;
+        Compare compare_;
+        std::deque<V> candidates_;
+    };
+
+    template <typename V, typename Project = std::identity>
+    using min = extremum<V, Project, std::less<V>>;
+
+    template <typename V, typename Project = std::identity>
+    using max = extremum<V, Project, std::greater<V>>;
+
+    // The `q`-quantile of the values, approximated with a histogram of `buckets` equal buckets
+    // over [lo, hi), so it is only accurate to within a bucket's width. Values outside the range
+    // are counted in the first or last bucket. Pushing and popping are O(1); finding the
+    // quantile is O(buckets).
+    template <typename V, typename Project = std::identity>
+    requires std::is_arithmetic_v<V>
+    class quantile {
+    public:
+        using result_type = double;
+
+        quantile(const double q, const V lo, const V hi, const std::size_t buckets = 128, Project project = Project{})
+        : project_{std::move(project)}, q_{q}, lo_{static_cast<double>(lo)}, hi_{static_cast<double>(hi)}
+        , counts_(std::max(buckets, std::size_t{1})) {
+            if (q_ < 0 || q_ > 1 || !(lo_ < hi_)) {
+                throw std::invalid_argument("quantile needs 0 <= q <= 1 and lo < hi");
+            }
+        }
+
+        template <typename T>
+        auto push(const T &value) -> void {
+            counts_[bucket(std::invoke(project_, value))]++;
+            total_++;
+        }
+
+        template <typename T>
+        auto pop(const T &value) -> void {
+            counts_[bucket(std::invoke(project_, value))]--;
+            total_--;
+        }
+
+        auto clear() -> void {
+            std::fill(counts_.begin(), counts_.end(), 0);
+            total_ = 0;
+        }
+
+        // The middle of the bucket holding the quantile.
+        auto result() const -> double {
+            const auto rank = static_cast<std::uint64_t>(q_ * static_cast<double>(total_ == 0 ? 0 : total_ - 1));
+            auto seen = std::uint64_t{0};
+            auto b = std::size_t{0};
+            for (; b + 1 < counts_.size(); ++b) {
+                seen += counts_[b];
+                if (seen > rank) {
+                    break;
+                }
+            }
+            return lo_ + (static_cast<double>(b) + 0.5) * width();
+        }
+
+    private:
+        Project project_;
+        double q_;
+        double lo_;
+        double hi_;
+        std::vector<std::uint64_t> counts_;
+        std::uint64_t total_ = 0;
+
+        auto width() const -> double {
+            return (hi_ - lo_) / static_cast<double>(counts_.size());
+        }
+
+        auto bucket(const V v) const -> std::size_t {
+            const auto b = std::floor((static_cast<double>(v) - lo_) / width());
+            return static_cast<std::size_t>(std::clamp(b, 0.0, static_cast<double>(counts_.size() - 1)));
+        }
+    };
+
+    // Publishes the result of `Aggregator` over each window of its input described by a
+    // window_spec, timing values with `Time`, which is either by_count or a function from a value
+    // to its time. Several windows may close at once, so this is a batch component. It is also a
+    // multirate, so that windows that don't fit in one batch, or that close along with the
+    // input, are published in the polls that follow.
+    template <typename T, typename Aggregator, typename Time = by_count>
+    requires aggregator<Aggregator, T>
+        and (std::same_as<Time, by_count> or std::is_invocable_r_v<std::int64_t, const Time&, const T&>)
+    class aggregate : public batch_component<std::tuple<T>, result<typename Aggregator::result_type>>, public multirate {
+    public:
+        using result_type = result<typename Aggregator::result_type>;
+
+        explicit aggregate(const window_spec spec, Time time = Time{}, Aggregator aggregator = Aggregator{})
+        : spec_{spec}, time_{std::move(time)}, aggregator_{std::move(aggregator)} {
+            if (spec_.width <= 0 || spec_.slide <= 0 || spec_.gap <= 0 || spec_.lateness < 0 || spec_.length <= 0) {
+                throw std::invalid_argument("window sizes must be positive, and lateness can't be negative");
+            }
+        }
+
+        auto name() const -> std::string override {
+            return "aggregate";
+        }
+
+        auto connect(const node* src, const int) -> void override {
+            in_.connect(src);
+        }
+
+        auto poll_next_batch(const std::size_t max) -> poll override {
+            if (fresh(0)) {
+                for (const auto &value : in_.values()) {
+                    accept(value);
+                }
+            }
+            if (inputs_closed()) {
+                advance(std::numeric_limits<std::int64_t>::max());
+            }
+            out_.clear();
+            while (!ready_.empty() && out_.size() < max) {
+                out_.push_back(std::move(ready_.front()));
+                ready_.pop_front();
+            }
+            set_backlog(!ready_.empty());
+            return out_.empty() ? poll::empty : poll::ready;
+        }
+
+        auto values() const -> std::span<const result_type> override {
+            return out_;
+        }
+
+        // No value with an earlier time will be aggregated any more.
+        auto watermark() const noexcept -> std::int64_t {
+            return watermark_;
+        }
+
+        // The number of values dropped for arriving after the watermark had passed them.
+        auto late() const noexcept -> std::uint64_t {
+            return late_;
+        }
+
+        // The number of values being held, either until the watermark passes them or until they
+        // slide out of every open window.
+        auto buffered() const noexcept -> std::size_t {
+            return pending_.size() + window_.size();
+        }
+
+    private:
+        struct pending {
+            std::int64_t time;
+            std::uint64_t sequence;
+            T value;
+        };
+
+        window_spec spec_;
+        [[no_unique_address]] Time time_;
+        Aggregator aggregator_;
+        batch_input<T> in_;
+
+        std::int64_t latest_ = std::numeric_limits<std::int64_t>::min();
+        std::int64_t watermark_ = std::numeric_limits<std::int64_t>::min();
+        std::uint64_t sequence_ = 0;
+        std::uint64_t late_ = 0;
+        // A min-heap by time, then by arrival, of values the watermark has yet to pass.
+        std::vector<pending> pending_;
+        // For tumbling and sliding windows, the values in windows that haven't closed, in time order.
+        std::deque<std::pair<std::int64_t, T>> window_;
+        std::int64_t next_end_ = std::numeric_limits<std::int64_t>::min();
+        // For sessions, the open session, if any.
+        bool in_session_ = false;
+        std::int64_t session_start_ = 0;
+        std::int64_t session_last_ = 0;
+
+        std::deque<result_type> ready_;
+        std::vector<result_type> out_;
+
+        static auto later(const pending &a, const pending &b) -> bool {
+            return a.time != b.time ? a.time > b.time : a.sequence > b.sequence;
+        }
+
+        static auto floor_div(const std::int64_t a, const std::int64_t b) -> std::int64_t {
+            return a / b - (a % b != 0 && (a < 0) != (b < 0) ? 1 : 0);
+        }
+
+        auto accept(const T &value) -> void {
+            auto time = std::int64_t{0};
+            if constexpr (std::same_as<Time, by_count>) {
+                time = static_cast<std::int64_t>(sequence_);
+            } else {
+                time = std::invoke(time_, value);
+            }
+            const auto sequence = sequence_++;
+            if (time < watermark_) {
+                late_++;
+                return;
+            }
+            pending_.push_back({time, sequence, value});
+            std::push_heap(pending_.begin(), pending_.end(), later);
+            if (time > latest_) {
+                latest_ = time;
+                // Positions never repeat, so a position's own window is complete as soon as it arrives.
+                advance(std::same_as<Time, by_count> ? latest_ + 1 - spec_.lateness : latest_ - spec_.lateness);
+            }
+        }
+
+        auto advance(const std::int64_t watermark) -> void {
+            if (watermark <= watermark_) {
+                return;
+            }
+            watermark_ = watermark;
+            while (!pending_.empty() && pending_.front().time < watermark_) {
+                std::pop_heap(pending_.begin(), pending_.end(), later);
+                auto next = std::move(pending_.back());
+                pending_.pop_back();
+                release(next.time, std::move(next.value));
+            }
+            close(watermark_);
+        }
+
+        // Values are released in time order.
+        auto release(const std::int64_t time, T value) -> void {
+            if (spec_.kind == window_kind::session) {
+                if (in_session_ && time >= session_last_ + spec_.gap) {
+                    close_session(session_last_ + spec_.gap);
+                } else if (in_session_ && time - session_start_ >= spec_.length) {
+                    close_session(session_start_ + spec_.length);
+                }
+                if (!in_session_) {
+                    in_session_ = true;
+                    session_start_ = time;
+                }
+                aggregator_.push(value);
+                session_last_ = time;
+                return;
+            }
+
+            while (!window_.empty() && next_end_ <= time) {
+                close_window();
+            }
+            // next_end_ is only set once a value is in the window.
+            if (!window_.empty()) {
+                evict(next_end_ - spec_.width);
+            }
+            if (window_.empty()) {
+                // Skip the windows that would be empty, up to the first one to end after `time`.
+                next_end_ = std::max(next_end_, (floor_div(time - spec_.width, spec_.slide) + 1) * spec_.slide + spec_.width);
+            }
+            aggregator_.push(value);
+            window_.emplace_back(time, std::move(value));
+        }
+
+        auto close(const std::int64_t watermark) -> void {
+            if (spec_.kind == window_kind::session) {
+                if (in_session_ && session_last_ + spec_.gap <= watermark) {
+                    close_session(session_last_ + spec_.gap);
+                }
+                return;
+            }
+            while (!window_.empty() && next_end_ <= watermark) {
+                close_window();
+            }
+        }
+
+        // Drops the values from before `start`, which no open window holds.
+        auto evict(const std::int64_t start) -> void {
+            while (!window_.empty() && window_.front().first < start) {
+                aggregator_.pop(window_.front().second);
+                window_.pop_front();
+            }
+        }
+
+        auto close_window() -> void {
+            const auto start = next_end_ - spec_.width;
+            evict(start);
+            if (!window_.empty()) {
+                ready_.push_back({start, next_end_, aggregator_.result()});
+            }
+            next_end_ += spec_.slide;
+        }
+
+        auto close_session(const std::int64_t end) -> void {
+            ready_.push_back({session_start_, end, aggregator_.result()});
+            aggregator_.clear();
+            in_session_ = false;
+        }
+    };
+}
+
+#endif  // COMP6771_WINDOWED_H
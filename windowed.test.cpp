@@ -0,0 +1,272 @@
+#include "./windowed.h"
+#include "./pipeline.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+namespace {
+    // A value and the time it happened at.
+    using event = std::pair<std::int64_t, int>;
+
+    constexpr auto time_of = [](const event &e) { return e.first; };
+    constexpr auto value_of = [](const event &e) { return e.second; };
+
+    // Publishes `values`, one per poll.
+    template <typename T>
+    struct list_source : ppl::source<T> {
+        std::vector<T> values_;
+        std::size_t next_ = 0;
+
+        list_source(std::vector<T> values): values_{std::move(values)} {}
+
+        auto name() const -> std::string override {
+            return "list_source";
+        }
+
+        auto poll_next() -> ppl::poll override {
+            return next_++ < values_.size() ? ppl::poll::ready : ppl::poll::closed;
+        }
+
+        auto value() const -> const T& override {
+            return values_[next_ - 1];
+        }
+    };
+
+    template <typename T>
+    struct list_sink : ppl::batch_sink<T> {
+        ppl::batch_input<T> in_;
+        std::vector<T> values_;
+
+        auto name() const -> std::string override {
+            return "list_sink";
+        }
+
+        auto connect(const ppl::node* src, const int) -> void override {
+            in_.connect(src);
+        }
+
+        auto poll_next_batch(const std::size_t) -> ppl::poll override {
+            const auto values = in_.values();
+            values_.insert(values_.end(), values.begin(), values.end());
+            return ppl::poll::ready;
+        }
+    };
+
+    template <typename T>
+    struct scalar_list_sink : ppl::sink<T> {
+        const ppl::producer<T>* in_ = nullptr;
+        std::vector<T> values_;
+
+        auto name() const -> std::string override {
+            return "scalar_list_sink";
+        }
+
+        auto connect(const ppl::node* src, const int) -> void override {
+            in_ = static_cast<const ppl::producer<T>*>(src);
+        }
+
+        auto poll_next() -> ppl::poll override {
+            values_.push_back(in_->value());
+            return ppl::poll::ready;
+        }
+    };
+
+    template <typename R>
+    struct window_run {
+        std::int64_t watermark;
+        std::uint64_t late;
+        std::size_t buffered;
+        std::vector<R> results;
+    };
+
+    // Runs `values` through an aggregate node made from `args`.
+    template <typename T, typename Aggregate, typename... Args>
+    auto run_windows(const std::vector<T> &values, Args&&... args) -> window_run<typename Aggregate::result_type> {
+        auto pipeline = ppl::pipeline{};
+        const auto source = pipeline.create_node<list_source<T>>(values);
+        const auto windows = pipeline.create_node<Aggregate>(std::forward<Args>(args)...);
+        const auto sink = pipeline.create_node<list_sink<typename Aggregate::result_type>>();
+        pipeline.connect(source, windows, 0);
+        pipeline.connect(windows, sink, 0);
+        pipeline.run();
+        const auto node = static_cast<Aggregate*>(pipeline.get_node(windows));
+        return {node->watermark(), node->late(), node->buffered(),
+            static_cast<list_sink<typename Aggregate::result_type>*>(pipeline.get_node(sink))->values_};
+    }
+}
+
+TEST_CASE("Testing the aggregators add and remove values") {
+    auto low = ppl::windowed::min<int>();
+    auto high = ppl::windowed::max<int>();
+    auto total = ppl::windowed::sum<int>();
+    const auto values = std::vector<int>{5, 3, 8, 3, 9, 1, 7};
+    // A window of three values sliding along.
+    auto expected_low = std::vector<int>{3, 3, 3, 1, 1};
+    auto expected_high = std::vector<int>{8, 8, 9, 9, 9};
+    auto lows = std::vector<int>{};
+    auto highs = std::vector<int>{};
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        if (i >= 3) {
+            low.pop(values[i - 3]);
+            high.pop(values[i - 3]);
+            total.pop(values[i - 3]);
+        }
+        low.push(values[i]);
+        high.push(values[i]);
+        total.push(values[i]);
+        if (i >= 2) {
+            lows.push_back(low.result());
+            highs.push_back(high.result());
+            CHECK(total.result() == values[i - 2] + values[i - 1] + values[i]);
+        }
+    }
+    CHECK(lows == expected_low);
+    CHECK(highs == expected_high);
+
+    auto median = ppl::windowed::quantile<double>(0.5, 0.0, 100.0, 100);
+    for (auto i = 0; i < 101; ++i) {
+        median.push(i);
+    }
+    CHECK(median.result() == Approx(50.5));
+    for (auto i = 0; i < 50; ++i) {
+        median.pop(i);
+    }
+    CHECK(median.result() == Approx(75.5));
+    CHECK_THROWS_AS(ppl::windowed::quantile<double>(2.0, 0.0, 1.0), std::invalid_argument);
+}
+
+TEST_CASE("Testing tumbling windows by count") {
+    using counted = ppl::windowed::aggregate<int, ppl::windowed::sum<int>>;
+    const auto run = run_windows<int, counted>({1, 2, 3, 4, 5, 6, 7, 8, 9, 10}, ppl::windowed::tumbling(3));
+    // The last window never fills up, but is published once the input closes.
+    CHECK(run.results == std::vector<counted::result_type>{{0, 3, 6}, {3, 6, 15}, {6, 9, 24}, {9, 12, 10}});
+    CHECK(run.buffered == 0);
+    CHECK_THROWS_AS(counted(ppl::windowed::tumbling(0)), std::invalid_argument);
+}
+
+TEST_CASE("Testing sums of int windows don't overflow") {
+    using counted = ppl::windowed::aggregate<int, ppl::windowed::sum<int>>;
+    constexpr auto big = std::numeric_limits<int>::max();
+    const auto run = run_windows<int, counted>({big, big, big, big, -big, -big}, ppl::windowed::sliding(4, 2));
+    CHECK(run.results == std::vector<counted::result_type>{{-2, 2, 2LL * big}, {0, 4, 4LL * big}, {2, 6, 0}, {4, 8, -2LL * big}});
+}
+
+TEST_CASE("Testing sliding windows over late values match a brute force") {
+    using highest = ppl::windowed::aggregate<event, ppl::windowed::max<int, decltype(value_of)>, decltype(time_of)>;
+    constexpr auto width = 10;
+    constexpr auto slide = 4;
+    constexpr auto lateness = 6;
+
+    // Each value is a little late, apart from a few that are far too late.
+    auto events = std::vector<event>{};
+    for (auto i = 0; i < 200; ++i) {
+        const auto time = std::int64_t{i * 3 - (i * 5) % 4 - (i % 5 == 0 ? 3 : 0)};
+        events.emplace_back(i % 50 == 49 ? time - 40 : time, (i * 37) % 101);
+    }
+
+    const auto run = run_windows<event, highest>(events, ppl::windowed::sliding(width, slide, lateness));
+    CHECK(run.late == 4);
+
+    const auto last = std::max_element(events.begin(), events.end())->first;
+    auto expected = std::vector<highest::result_type>{};
+    for (auto end = std::int64_t{width - 10 * slide}; end - width <= last; end += slide) {
+        auto found = false;
+        auto best = 0;
+        for (std::size_t i = 0; i < events.size(); ++i) {
+            if (i % 50 != 49 && events[i].first >= end - width && events[i].first < end) {
+                best = found ? std::max(best, events[i].second) : events[i].second;
+                found = true;
+            }
+        }
+        if (found) {
+            expected.push_back({end - width, end, best});
+        }
+    }
+    CHECK(run.results == expected);
+    // Only the values in open windows, or not yet passed by the watermark, are kept.
+    CHECK(run.buffered <= static_cast<std::size_t>(width + lateness));
+}
+
+TEST_CASE("Testing session windows close after a gap") {
+    using sessions = ppl::windowed::aggregate<event, ppl::windowed::sum<int, decltype(value_of)>, decltype(time_of)>;
+    const auto events = std::vector<event>{{1, 1}, {3, 2}, {2, 4}, {10, 8}, {12, 16}, {30, 32}, {40, 64}};
+    const auto run = run_windows<event, sessions>(events, ppl::windowed::session(5, 1));
+    CHECK(run.results == std::vector<sessions::result_type>{{1, 8, 7}, {10, 17, 24}, {30, 35, 32}, {40, 45, 64}});
+    CHECK(run.late == 0);
+}
+
+TEST_CASE("Testing sessions that never go quiet are cut off") {
+    using lowest = ppl::windowed::aggregate<event, ppl::windowed::min<int, decltype(value_of)>, decltype(time_of)>;
+    // Rising values are the ones a min has to keep, since any of them could become the lowest.
+    auto events = std::vector<event>{};
+    for (auto i = 0; i < 35; ++i) {
+        events.emplace_back(i, i);
+    }
+    const auto run = run_windows<event, lowest>(events, ppl::windowed::session(5, 0, 10));
+    CHECK(run.results == std::vector<lowest::result_type>{{0, 10, 0}, {10, 20, 10}, {20, 30, 20}, {30, 39, 30}});
+    CHECK_THROWS_AS(lowest(ppl::windowed::session(5, 0, 0), time_of), std::invalid_argument);
+}
+
+TEST_CASE("Testing memory stays bounded over a long stream") {
+    using counted = ppl::windowed::aggregate<int, ppl::windowed::count>;
+    auto values = std::vector<int>(100000, 1);
+    const auto run = run_windows<int, counted>(values, ppl::windowed::sliding(100, 10));
+    // Windows start every 10 values, from the first one to hold value 0 to the last to hold value 99999.
+    REQUIRE(run.results.size() == 10009);
+    CHECK(std::all_of(run.results.begin() + 9, run.results.end() - 9, [](const auto &r) { return r.value == 100; }));
+    CHECK(run.buffered <= 100);
+}
+
+TEST_CASE("Testing every window is published, however many close at once") {
+    using counted = ppl::windowed::aggregate<event, ppl::windowed::count, decltype(time_of)>;
+    // Each value is in 10 windows, which all close when the next value arrives.
+    auto events = std::vector<event>{};
+    for (auto i = 0; i < 1000; ++i) {
+        events.emplace_back(i * 100, i);
+    }
+    const auto connect = [&](ppl::pipeline &pipeline, const auto sink) {
+        const auto source = pipeline.create_node<list_source<event>>(events);
+        const auto aggregate = pipeline.create_node<counted>(ppl::windowed::sliding(100, 10), time_of);
+        pipeline.connect(source, aggregate, 0);
+        pipeline.connect(aggregate, sink, 0);
+    };
+    const auto every_window = [](const std::vector<counted::result_type> &results) {
+        REQUIRE(results.size() == 10000);
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            CHECK(results[i] == counted::result_type{static_cast<std::int64_t>(i) * 10 - 90, static_cast<std::int64_t>(i) * 10 + 10, 1});
+        }
+    };
+
+    SECTION("In batches") {
+        auto pipeline = ppl::pipeline{};
+        pipeline.set_batch_size(64);
+        const auto sink = pipeline.create_node<list_sink<counted::result_type>>();
+        connect(pipeline, sink);
+        pipeline.run();
+        every_window(static_cast<list_sink<counted::result_type>*>(pipeline.get_node(sink))->values_);
+    }
+
+    SECTION("One at a time") {
+        auto pipeline = ppl::pipeline{};
+        const auto sink = pipeline.create_node<scalar_list_sink<counted::result_type>>();
+        connect(pipeline, sink);
+        pipeline.run();
+        every_window(static_cast<scalar_list_sink<counted::result_type>*>(pipeline.get_node(sink))->values_);
+    }
+
+    SECTION("On threads") {
+        auto pipeline = ppl::pipeline{};
+        const auto sink = pipeline.create_node<scalar_list_sink<counted::result_type>>();
+        connect(pipeline, sink);
+        pipeline.run_parallel(2);
+        every_window(static_cast<scalar_list_sink<counted::result_type>*>(pipeline.get_node(sink))->values_);
+    }
+}